@@ -0,0 +1,170 @@
+#define CL_TARGET_OPENCL_VERSION 110
+
+#include "autotune.h"
+#include "program_cache.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_ENTRIES 256
+
+struct tune_entry {
+  char kernel[64];
+  size_t nunits;
+  struct tune_config cfg;
+};
+
+static size_t
+round_up(size_t n, size_t m)
+{
+  return (n + m - 1) / m * m;
+}
+
+static int
+tune_path(cl_device_id device, char *path, size_t size)
+{
+  char dir[4000];
+  if(program_cache_dir(dir, sizeof(dir)) != 0)
+    return -1;
+  snprintf(path, size, "%s/tune-%016llx.txt", dir,
+           (unsigned long long) program_cache_device_hash(device));
+  return 0;
+}
+
+// One line per entry: kernel nunits global local count seconds
+static int
+read_entries(const char *path, struct tune_entry *e, int max)
+{
+  FILE *fp = fopen(path, "r");
+  int n = 0;
+  if(fp == NULL)
+    return 0;
+  while(n < max &&
+        fscanf(fp, "%63s %zu %zu %zu %zu %lf", e[n].kernel, &e[n].nunits,
+               &e[n].cfg.global, &e[n].cfg.local, &e[n].cfg.count,
+               &e[n].cfg.seconds) == 6)
+    n++;
+  fclose(fp);
+  return n;
+}
+
+int
+autotune_store(cl_device_id device,
+               const char *kernel,
+               size_t nunits,
+               const struct tune_config *cfg)
+{
+  char path[4096], tmp[4200];
+  struct tune_entry entries[MAX_ENTRIES];
+  int n, i;
+
+  if(tune_path(device, path, sizeof(path)) != 0)
+    return -1;
+  n = read_entries(path, entries, MAX_ENTRIES);
+  for(i = 0; i < n; i++)
+    if(strcmp(entries[i].kernel, kernel) == 0 && entries[i].nunits == nunits)
+      break;
+  if(i == n) {
+    // New keys go last, so the file is oldest first; when full, drop
+    // the first entry.
+    if(n == MAX_ENTRIES) {
+      memmove(&entries[0], &entries[1], (n - 1) * sizeof(entries[0]));
+      i = n - 1;
+    }
+    else
+      n++;
+  }
+  snprintf(entries[i].kernel, sizeof(entries[i].kernel), "%s", kernel);
+  entries[i].nunits = nunits;
+  entries[i].cfg = *cfg;
+
+  // Rewrite through a temporary file, as program_cache does.
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int) getpid());
+  FILE *fp = fopen(tmp, "w");
+  if(fp == NULL)
+    return -1;
+  for(i = 0; i < n; i++)
+    fprintf(fp, "%s %zu %zu %zu %zu %.9g\n", entries[i].kernel, entries[i].nunits,
+            entries[i].cfg.global, entries[i].cfg.local, entries[i].cfg.count,
+            entries[i].cfg.seconds);
+  if(fclose(fp) != 0 || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+int
+autotune_load(cl_device_id device,
+              const char *kernel,
+              size_t nunits,
+              struct tune_config *cfg)
+{
+  char path[4096];
+  struct tune_entry entries[MAX_ENTRIES];
+  int best = -1;
+  double best_dist = 0;
+
+  if(tune_path(device, path, sizeof(path)) != 0)
+    return -1;
+  int n = read_entries(path, entries, MAX_ENTRIES);
+  for(int i = 0; i < n; i++) {
+    if(strcmp(entries[i].kernel, kernel) != 0)
+      continue;
+    double dist = fabs(log((double) entries[i].nunits / (double) nunits));
+    if(best < 0 || dist < best_dist) {
+      best = i;
+      best_dist = dist;
+    }
+  }
+  if(best < 0)
+    return -1;
+  *cfg = entries[best].cfg;
+  if(entries[best].nunits != nunits) {
+    cfg->global = round_up((nunits + cfg->count - 1) / cfg->count, cfg->local);
+    cfg->seconds = 0;
+  }
+  return 0;
+}
+
+int
+autotune_search(cl_device_id device,
+                const char *kernel,
+                size_t nunits,
+                size_t max_local,
+                autotune_run_fn run,
+                void *arg,
+                struct tune_config *best)
+{
+  int found = 0;
+
+  printf("autotune %s: %zu units, local up to %zu\n", kernel, nunits, max_local);
+  for(size_t local = 1; local <= max_local; local *= 2) {
+    for(size_t count = 1; count <= nunits; count *= 2) {
+      struct tune_config cfg;
+      cfg.local = local;
+      cfg.count = count;
+      cfg.global = round_up((nunits + count - 1) / count, local);
+      cfg.seconds = 0;
+      // Fewer work-items than one group: larger counts only idle more.
+      if((nunits + count - 1) / count < local)
+        break;
+      double t = run(&cfg, arg);
+      if(t < 0)
+        continue;
+      cfg.seconds = t;
+      if(!found || t < best->seconds) {
+        *best = cfg;
+        found = 1;
+      }
+    }
+  }
+  if(!found)
+    return -1;
+  printf("autotune %s: best global %zu local %zu count %zu, %.2f usec\n", kernel,
+         best->global, best->local, best->count, best->seconds * 1e6);
+  autotune_store(device, kernel, nunits, best);
+  return 0;
+}
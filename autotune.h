@@ -0,0 +1,58 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <CL/cl.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Work-size autotuner with a per-device result cache.
+//
+// A kernel processes `nunits` work units (e.g. uint4 for minp, floats for
+// saxpy). A configuration is a local size and a per-work-item unit count;
+// the global size follows from them. The best configuration per (kernel,
+// nunits) is kept in tune-<device hash>.txt in the program cache
+// directory (see program_cache.h).
+
+struct tune_config {
+  size_t global;
+  size_t local;
+  size_t count;   // work units per work-item
+  double seconds; // measured time per launch, 0 if unknown
+};
+
+// Times `cfg`, returns seconds per launch or a negative value if the
+// configuration is not valid for this kernel.
+typedef double (*autotune_run_fn)(const struct tune_config *cfg, void *arg);
+
+// Tries local sizes 1, 2, 4, ... up to max_local and per-item counts
+// 1, 2, 4, ... up to nunits, keeps the fastest in *best and stores it.
+// Returns 0 if any configuration was valid.
+int autotune_search(cl_device_id device,
+                    const char *kernel,
+                    size_t nunits,
+                    size_t max_local,
+                    autotune_run_fn run,
+                    void *arg,
+                    struct tune_config *best);
+
+// Looks up a stored configuration for `kernel`. An exact nunits match is
+// used as is; otherwise the entry with the closest size is rescaled
+// (same local size and per-item count). Returns 0 if one was found.
+int autotune_load(cl_device_id device,
+                  const char *kernel,
+                  size_t nunits,
+                  struct tune_config *cfg);
+
+int autotune_store(cl_device_id device,
+                   const char *kernel,
+                   size_t nunits,
+                   const struct tune_config *cfg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
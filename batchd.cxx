@@ -0,0 +1,778 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+
+#include "runtime.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+////////////////////////////////////////////////////////////////
+// Request-batching service for small saxpy and min jobs.
+//
+//   ./batchd serve [-s socket] [-w window usec] [-b max jobs] [-m max items] [-i report sec]
+//   ./batchd bench [-s socket] [-c clients] [-r requests] [-n items]
+//
+// serve listens on a Unix-domain socket. Every connection has a thread
+// that reads requests and queues them; one batcher thread waits up to
+// the window after the first queued job (or until -b jobs / -m items are
+// queued), packs the jobs of each kind back to back with an offset
+// table, and runs one saxpy_batch and one minp_batch launch for all of
+// them. Every -i seconds, and on SIGINT, it prints the batch occupancy
+// and the per-request latency (queued to reply written) of the interval.
+//
+// bench opens -c connections, sends -r requests each (alternating saxpy
+// and min of -n items), checks every reply and prints the round-trip
+// latency seen by the clients.
+//
+// Wire format, native byte order:
+//   request  { uint32 op (0 saxpy, 1 min), uint32 n, float a }
+//            saxpy: float x[n], float y[n]; min: uint src[n]
+//   reply    { int32 status (0 or an OpenCL error), uint32 n }
+//            saxpy: float y[n]; min: uint min
+//   A request of more than -m items gets status CL_INVALID_BUFFER_SIZE,
+//   n 0, and the server closes the connection.
+////////////////////////////////////////////////////////////////
+
+void usage()
+{
+  cerr << "usage: batchd serve [-s socket] [-w window usec] [-b max jobs] [-m max items] [-i report sec]" << endl
+       << "       batchd bench [-s socket] [-c clients] [-r requests] [-n items]" << endl;
+}
+
+enum { OP_SAXPY = 0, OP_MIN = 1 };
+
+struct RequestHeader
+{
+  cl_uint op;
+  cl_uint n;
+  cl_float a;
+};
+
+struct ReplyHeader
+{
+  cl_int status;
+  cl_uint n;
+};
+
+// Job j covers items offsets[j] .. offsets[j + 1] - 1 of the packed
+// buffers. saxpy_batch is the grid-stride saxpy with a per-item lookup
+// of its job's a; minp_batch gives each work-group whole jobs and
+// reduces them with work_group_reduce_min, as minp_single does.
+string batchStr =
+  "uint find_job(global const uint *offsets, uint njobs, uint i)\n"
+  "{\n"
+  "  uint lo = 0, hi = njobs;\n"
+  "  while(hi - lo > 1) {\n"
+  "    uint mid = (lo + hi) / 2;\n"
+  "    if(offsets[mid] <= i)\n"
+  "      lo = mid;\n"
+  "    else\n"
+  "      hi = mid;\n"
+  "  }\n"
+  "  return lo;\n"
+  "}\n"
+  "\n"
+  "__kernel void saxpy_batch(global const float *x,\n"
+  "                          global float *y,\n"
+  "                          global const float *a,\n"
+  "                          global const uint *offsets,\n"
+  "                          uint njobs)\n"
+  "{\n"
+  "  uint total = offsets[njobs];\n"
+  "  for(uint gid = get_global_id(0); gid < total; gid += get_global_size(0))\n"
+  "    y[gid] = a[find_job(offsets, njobs, gid)] * x[gid] + y[gid];\n"
+  "}\n"
+  "\n"
+  "__kernel void minp_batch(global const uint *src,\n"
+  "                         global uint *out,\n"
+  "                         global const uint *offsets,\n"
+  "                         uint njobs)\n"
+  "{\n"
+  "  for(uint j = get_group_id(0); j < njobs; j += get_num_groups(0)) {\n"
+  "    uint pmin = (uint) -1;\n"
+  "    for(uint i = offsets[j] + get_local_id(0); i < offsets[j + 1]; i += get_local_size(0))\n"
+  "      pmin = min(pmin, src[i]);\n"
+  "    pmin = work_group_reduce_min(pmin);\n"
+  "    if(get_local_id(0) == 0)\n"
+  "      out[j] = pmin;\n"
+  "  }\n"
+  "}\n";
+
+typedef std::chrono::steady_clock Clock;
+
+double usecBetween(Clock::time_point a, Clock::time_point b)
+{
+  return std::chrono::duration<double, std::micro>(b - a).count();
+}
+
+////////////////////////////////////////////////////////////////
+// Whole-message socket I/O
+////////////////////////////////////////////////////////////////
+bool readFull(int fd, void *buf, size_t size)
+{
+  char *p = (char *) buf;
+  while(size > 0)
+    {
+      ssize_t r = read(fd, p, size);
+      if(r <= 0)
+        return false;
+      p += r;
+      size -= r;
+    }
+  return true;
+}
+
+bool writeFull(int fd, const void *buf, size_t size)
+{
+  const char *p = (const char *) buf;
+  while(size > 0)
+    {
+      ssize_t r = send(fd, p, size, MSG_NOSIGNAL);
+      if(r <= 0)
+        return false;
+      p += r;
+      size -= r;
+    }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////
+// One queued request
+////////////////////////////////////////////////////////////////
+struct Job
+{
+  RequestHeader req;
+  std::vector<cl_float> x, y;   // saxpy; y is replaced by the result
+  std::vector<cl_uint> src;     // min
+  cl_uint result;
+  cl_int status;
+  Clock::time_point queued;
+  Clock::time_point started;    // taken into a batch
+  std::promise<void> done;
+};
+
+////////////////////////////////////////////////////////////////
+// Per-interval statistics
+////////////////////////////////////////////////////////////////
+struct Stats
+{
+  std::mutex lock;
+  size_t batches = 0, jobs = 0, items = 0;
+  std::vector<double> wait, latency;   // usec per request
+
+  void addBatch(size_t njobs, size_t nitems)
+  {
+    std::lock_guard<std::mutex> l(lock);
+    batches++;
+    jobs += njobs;
+    items += nitems;
+  }
+
+  void addRequest(double waitUsec, double latencyUsec)
+  {
+    std::lock_guard<std::mutex> l(lock);
+    wait.push_back(waitUsec);
+    latency.push_back(latencyUsec);
+  }
+
+  static double percentile(std::vector<double> &v, double p)
+  {
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t) (p * v.size()))];
+  }
+
+  // Print the interval and start a new one.
+  void report(size_t maxJobs, size_t maxItems)
+  {
+    std::lock_guard<std::mutex> l(lock);
+    if(batches == 0)
+      return;
+    cout << batches << " batches, " << (double) jobs / batches << " jobs/batch ("
+         << 100.0 * jobs / batches / maxJobs << "% of " << maxJobs << "), "
+         << (double) items / batches << " items/batch (" << 100.0 * items / batches / maxItems << "%)";
+    if(!latency.empty())
+      cout << ", latency p50 " << percentile(latency, 0.5) << " p99 " << percentile(latency, 0.99)
+           << " max " << latency.back() << " usec, batching wait p50 " << percentile(wait, 0.5) << " usec";
+    cout << endl;
+    batches = jobs = items = 0;
+    wait.clear();
+    latency.clear();
+  }
+};
+
+////////////////////////////////////////////////////////////////
+// The service
+////////////////////////////////////////////////////////////////
+class Server
+{
+public:
+  Server(runtime::Runtime &rt, Clock::duration window, size_t maxJobs, size_t maxItems)
+    : rt_(rt), window_(window), maxJobs_(maxJobs), maxItems_(maxItems),
+      pendingItems_(0), stop_(false)
+  {
+    // Build once up front rather than inside the first batch.
+    rt_.program(batchStr, "-cl-std=CL2.0");
+    batcher_ = std::thread(&Server::batcher, this);
+  }
+
+  ~Server()
+  {
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      stop_ = true;
+    }
+    ready_.notify_all();
+    batcher_.join();
+  }
+
+  // Serve one connection until it closes. A request larger than a
+  // whole batch gets CL_INVALID_BUFFER_SIZE and ends the connection;
+  // any other failure ends it too, never the daemon.
+  void connection(int fd)
+  {
+    try
+      {
+        serveRequests(fd);
+      }
+    catch(std::exception &e)
+      {
+        cerr << "connection " << fd << ": " << e.what() << endl;
+      }
+    catch(...)
+      {
+        cerr << "connection " << fd << ": unknown exception" << endl;
+      }
+    close(fd);
+  }
+
+  void report() { stats_.report(maxJobs_, maxItems_); }
+
+private:
+  void serveRequests(int fd)
+  {
+    RequestHeader req;
+    while(readFull(fd, &req, sizeof(req)))
+      {
+        if(req.n > maxItems_)
+          {
+            ReplyHeader rep = { CL_INVALID_BUFFER_SIZE, 0 };
+            writeFull(fd, &rep, sizeof(rep));
+            break;
+          }
+        std::unique_ptr<Job> job(new Job);
+        job->req = req;
+        job->status = CL_SUCCESS;
+        bool ok;
+        if(req.n == 0 || req.op > OP_MIN)
+          break;
+        if(req.op == OP_SAXPY)
+          {
+            job->x.resize(req.n);
+            job->y.resize(req.n);
+            ok = readFull(fd, job->x.data(), req.n * sizeof(cl_float)) &&
+              readFull(fd, job->y.data(), req.n * sizeof(cl_float));
+          }
+        else
+          {
+            job->src.resize(req.n);
+            ok = readFull(fd, job->src.data(), req.n * sizeof(cl_uint));
+          }
+        if(!ok)
+          break;
+
+        std::future<void> done = job->done.get_future();
+        submit(job.get());
+        done.wait();
+
+        ReplyHeader rep = { job->status, req.op == OP_SAXPY ? req.n : 1 };
+        if(job->status != CL_SUCCESS)
+          rep.n = 0;
+        ok = writeFull(fd, &rep, sizeof(rep));
+        if(ok && rep.n)
+          ok = req.op == OP_SAXPY ? writeFull(fd, job->y.data(), req.n * sizeof(cl_float))
+                                  : writeFull(fd, &job->result, sizeof(cl_uint));
+        stats_.addRequest(usecBetween(job->queued, job->started), usecBetween(job->queued, Clock::now()));
+        if(!ok)
+          break;
+      }
+  }
+
+  void submit(Job *job)
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    job->queued = Clock::now();
+    pending_.push_back(job);
+    pendingItems_ += job->req.n;
+    ready_.notify_one();
+  }
+
+  bool full() const { return pending_.size() >= maxJobs_ || pendingItems_ >= maxItems_; }
+
+  ////////////////////////////////////////////////////////////////
+  // Collect a batch: everything queued within the window after the
+  // first job, up to the limits; a single oversized job runs alone.
+  ////////////////////////////////////////////////////////////////
+  void batcher()
+  {
+    for(;;)
+      {
+        std::vector<Job *> batch;
+        {
+          std::unique_lock<std::mutex> l(lock_);
+          ready_.wait(l, [this] { return stop_ || !pending_.empty(); });
+          if(pending_.empty())
+            return;
+          Clock::time_point deadline = pending_.front()->queued + window_;
+          ready_.wait_until(l, deadline, [this] { return stop_ || full(); });
+          size_t items = 0;
+          while(!pending_.empty() && batch.size() < maxJobs_ &&
+                (batch.empty() || items + pending_.front()->req.n <= maxItems_))
+            {
+              Job *job = pending_.front();
+              pending_.pop_front();
+              pendingItems_ -= job->req.n;
+              items += job->req.n;
+              job->started = Clock::now();
+              batch.push_back(job);
+            }
+        }
+        run(batch);
+      }
+  }
+
+  void run(const std::vector<Job *> &batch)
+  {
+    std::vector<Job *> saxpys, mins;
+    size_t items = 0;
+    for(Job *job : batch)
+      {
+        (job->req.op == OP_SAXPY ? saxpys : mins).push_back(job);
+        items += job->req.n;
+      }
+    cl_int status = CL_SUCCESS;
+    try
+      {
+        if(!saxpys.empty())
+          runSaxpy(saxpys);
+        if(!mins.empty())
+          runMin(mins);
+      }
+    catch(cl::Error &err)
+      {
+        cerr << "batch: " << err.what() << " (" << err.err() << ")" << endl;
+        status = err.err();
+      }
+    stats_.addBatch(batch.size(), items);
+    for(Job *job : batch)
+      {
+        if(status != CL_SUCCESS)
+          job->status = status;
+        job->done.set_value();
+      }
+  }
+
+  // A pool buffer of `bytes`, handed back when the batch is done.
+  cl::Buffer get(cl_mem_flags flags, size_t bytes, std::vector<cl::Buffer> &held)
+  {
+    cl_int err;
+    cl_mem buf = buffer_pool_get(rt_.pool(), flags, bytes, &err);
+    if(buf == NULL)
+      throw cl::Error(err, "buffer_pool_get");
+    held.push_back(cl::Buffer(buf, true));
+    return held.back();
+  }
+
+  void putAll(std::vector<cl::Buffer> &held)
+  {
+    rt_.queue().finish();
+    for(cl::Buffer &b : held)
+      buffer_pool_put(rt_.pool(), b());
+    held.clear();
+  }
+
+  static std::vector<cl_uint> offsetTable(const std::vector<Job *> &jobs)
+  {
+    std::vector<cl_uint> offsets(1, 0);
+    for(Job *job : jobs)
+      offsets.push_back(offsets.back() + job->req.n);
+    return offsets;
+  }
+
+  void runSaxpy(const std::vector<Job *> &jobs)
+  {
+    std::vector<cl_uint> offsets = offsetTable(jobs);
+    size_t total = offsets.back();
+    std::vector<cl_float> x(total), y(total), a(jobs.size());
+    for(size_t j = 0; j < jobs.size(); j++)
+      {
+        std::copy(jobs[j]->x.begin(), jobs[j]->x.end(), x.begin() + offsets[j]);
+        std::copy(jobs[j]->y.begin(), jobs[j]->y.end(), y.begin() + offsets[j]);
+        a[j] = jobs[j]->req.a;
+      }
+
+    const cl::CommandQueue &q = rt_.queue();
+    std::vector<cl::Buffer> held;
+    try
+      {
+        cl::Buffer bx = get(CL_MEM_READ_ONLY, total * sizeof(cl_float), held);
+        cl::Buffer by = get(CL_MEM_READ_WRITE, total * sizeof(cl_float), held);
+        cl::Buffer ba = get(CL_MEM_READ_ONLY, a.size() * sizeof(cl_float), held);
+        cl::Buffer bo = get(CL_MEM_READ_ONLY, offsets.size() * sizeof(cl_uint), held);
+        q.enqueueWriteBuffer(bx, CL_FALSE, 0, total * sizeof(cl_float), x.data());
+        q.enqueueWriteBuffer(by, CL_FALSE, 0, total * sizeof(cl_float), y.data());
+        q.enqueueWriteBuffer(ba, CL_FALSE, 0, a.size() * sizeof(cl_float), a.data());
+        q.enqueueWriteBuffer(bo, CL_FALSE, 0, offsets.size() * sizeof(cl_uint), offsets.data());
+        cl::Kernel &k = rt_.kernel(batchStr, "saxpy_batch", "-cl-std=CL2.0");
+        k.setArg(0, bx);
+        k.setArg(1, by);
+        k.setArg(2, ba);
+        k.setArg(3, bo);
+        k.setArg(4, (cl_uint) jobs.size());
+        q.enqueueNDRangeKernel(k, cl::NullRange, cl::NDRange((total + 63) / 64 * 64), cl::NDRange(64));
+        q.enqueueReadBuffer(by, CL_TRUE, 0, total * sizeof(cl_float), y.data());
+      }
+    catch(...)
+      {
+        putAll(held);
+        throw;
+      }
+    putAll(held);
+
+    for(size_t j = 0; j < jobs.size(); j++)
+      std::copy(y.begin() + offsets[j], y.begin() + offsets[j + 1], jobs[j]->y.begin());
+  }
+
+  void runMin(const std::vector<Job *> &jobs)
+  {
+    std::vector<cl_uint> offsets = offsetTable(jobs);
+    size_t total = offsets.back();
+    std::vector<cl_uint> src(total), out(jobs.size());
+    for(size_t j = 0; j < jobs.size(); j++)
+      std::copy(jobs[j]->src.begin(), jobs[j]->src.end(), src.begin() + offsets[j]);
+
+    const cl::CommandQueue &q = rt_.queue();
+    std::vector<cl::Buffer> held;
+    try
+      {
+        cl::Buffer bs = get(CL_MEM_READ_ONLY, total * sizeof(cl_uint), held);
+        cl::Buffer bout = get(CL_MEM_WRITE_ONLY, out.size() * sizeof(cl_uint), held);
+        cl::Buffer bo = get(CL_MEM_READ_ONLY, offsets.size() * sizeof(cl_uint), held);
+        q.enqueueWriteBuffer(bs, CL_FALSE, 0, total * sizeof(cl_uint), src.data());
+        q.enqueueWriteBuffer(bo, CL_FALSE, 0, offsets.size() * sizeof(cl_uint), offsets.data());
+        cl::Kernel &k = rt_.kernel(batchStr, "minp_batch", "-cl-std=CL2.0");
+        k.setArg(0, bs);
+        k.setArg(1, bout);
+        k.setArg(2, bo);
+        k.setArg(3, (cl_uint) jobs.size());
+        // One work-group per job, up to a few per compute unit.
+        size_t local = std::min<size_t>(64, k.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(rt_.device()));
+        size_t groups = std::min<size_t>(jobs.size(), 4 * rt_.device().getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>());
+        q.enqueueNDRangeKernel(k, cl::NullRange, cl::NDRange(groups * local), cl::NDRange(local));
+        q.enqueueReadBuffer(bout, CL_TRUE, 0, out.size() * sizeof(cl_uint), out.data());
+      }
+    catch(...)
+      {
+        putAll(held);
+        throw;
+      }
+    putAll(held);
+
+    for(size_t j = 0; j < jobs.size(); j++)
+      jobs[j]->result = out[j];
+  }
+
+  runtime::Runtime &rt_;
+  Clock::duration window_;
+  size_t maxJobs_;
+  size_t maxItems_;
+
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::deque<Job *> pending_;
+  size_t pendingItems_;
+  bool stop_;
+  std::thread batcher_;
+  Stats stats_;
+};
+
+////////////////////////////////////////////////////////////////
+// serve
+////////////////////////////////////////////////////////////////
+volatile sig_atomic_t quit = 0;
+
+void onSignal(int)
+{
+  quit = 1;
+}
+
+int listenOn(const string &path)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(addr.sun_path))
+    throw(string("socket path too long: " + path));
+  strcpy(addr.sun_path, path.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    throw(string("socket: ") + strerror(errno));
+  unlink(path.c_str());
+  if(bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0)
+    {
+      string err = strerror(errno);
+      close(fd);
+      throw(string("bind " + path + ": " + err));
+    }
+  return fd;
+}
+
+int serve(const string &path, long windowUsec, size_t maxJobs, size_t maxItems, int reportSec)
+{
+  runtime::Runtime rt(cl::Device::getDefault());
+  Server server(rt, std::chrono::microseconds(windowUsec), maxJobs, maxItems);
+  int lfd = listenOn(path);
+  cout << rt.device().getInfo<CL_DEVICE_NAME>() << ": listening on " << path << ", window "
+       << windowUsec << " usec, up to " << maxJobs << " jobs / " << maxItems << " items per batch" << endl;
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  // Connection threads; each one adds its id to `finished` on the way
+  // out and the loop below joins it.
+  std::list<std::thread> threads;
+  std::vector<std::thread::id> finished;
+  std::mutex fdsLock;
+  std::set<int> fds;
+  Clock::time_point lastReport = Clock::now();
+  while(!quit)
+    {
+      pollfd p = { lfd, POLLIN, 0 };
+      if(poll(&p, 1, 200) > 0)
+        {
+          int fd = accept(lfd, NULL, NULL);
+          if(fd >= 0)
+            {
+              std::lock_guard<std::mutex> l(fdsLock);
+              fds.insert(fd);
+              threads.push_back(std::thread([&server, &fdsLock, &fds, &finished, fd]
+                                            {
+                                              server.connection(fd);
+                                              std::lock_guard<std::mutex> l(fdsLock);
+                                              fds.erase(fd);
+                                              finished.push_back(std::this_thread::get_id());
+                                            }));
+            }
+        }
+      std::list<std::thread> done;
+      {
+        std::lock_guard<std::mutex> l(fdsLock);
+        for(std::thread::id id : finished)
+          for(std::list<std::thread>::iterator t = threads.begin(); t != threads.end(); ++t)
+            if(t->get_id() == id)
+              {
+                done.splice(done.end(), threads, t);
+                break;
+              }
+        finished.clear();
+      }
+      for(std::thread &t : done)
+        t.join();
+      if(Clock::now() - lastReport >= std::chrono::seconds(reportSec))
+        {
+          server.report();
+          lastReport = Clock::now();
+        }
+    }
+
+  // Wake up the connection threads blocked in read, let the batcher
+  // finish what is queued, then print the last interval.
+  close(lfd);
+  unlink(path.c_str());
+  {
+    std::lock_guard<std::mutex> l(fdsLock);
+    for(int fd : fds)
+      shutdown(fd, SHUT_RDWR);
+  }
+  for(std::thread &t : threads)
+    t.join();
+  server.report();
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////
+// bench
+////////////////////////////////////////////////////////////////
+int connectTo(const string &path)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+      if(fd >= 0)
+        close(fd);
+      return -1;
+    }
+  return fd;
+}
+
+// One client connection: requests round trips, checked.
+void client(const string &path, int id, size_t requests, size_t n,
+            std::vector<double> *latency, bool *ok)
+{
+  *ok = false;
+  int fd = connectTo(path);
+  if(fd < 0)
+    return;
+  // Small integers, so saxpy is exact whatever the device does with a * x + y.
+  const cl_float a = 2.f;
+  std::vector<cl_float> x(n), y(n), yOut(n);
+  std::vector<cl_uint> src(n);
+  cl_uint ma = 0x12345678 + id, mb = ma, expect = (cl_uint) -1;
+  for(size_t i = 0; i < n; i++)
+    {
+      x[i] = cl_float((i + id) % 1024);
+      y[i] = cl_float(1023 - i % 1024);
+      src[i] = mb = (ma * (mb & 65535)) + (mb >> 16);
+      expect = std::min(expect, src[i]);
+    }
+
+  *ok = true;
+  for(size_t r = 0; r < requests && *ok; r++)
+    {
+      RequestHeader req = { r % 2 ? (cl_uint) OP_MIN : (cl_uint) OP_SAXPY, (cl_uint) n, a };
+      ReplyHeader rep;
+      Clock::time_point start = Clock::now();
+      bool sent = writeFull(fd, &req, sizeof(req));
+      if(req.op == OP_SAXPY)
+        sent = sent && writeFull(fd, x.data(), n * sizeof(cl_float)) && writeFull(fd, y.data(), n * sizeof(cl_float));
+      else
+        sent = sent && writeFull(fd, src.data(), n * sizeof(cl_uint));
+      if(!sent || !readFull(fd, &rep, sizeof(rep)) || rep.status != CL_SUCCESS)
+        {
+          *ok = false;
+          break;
+        }
+      if(req.op == OP_SAXPY)
+        {
+          *ok = rep.n == n && readFull(fd, yOut.data(), n * sizeof(cl_float));
+          for(size_t i = 0; i < n && *ok; i++)
+            *ok = yOut[i] == a * x[i] + y[i];
+        }
+      else
+        {
+          cl_uint m;
+          *ok = rep.n == 1 && readFull(fd, &m, sizeof(m)) && m == expect;
+        }
+      latency->push_back(usecBetween(start, Clock::now()));
+    }
+  close(fd);
+}
+
+int bench(const string &path, size_t clients, size_t requests, size_t n)
+{
+  std::vector<std::vector<double> > latency(clients);
+  std::unique_ptr<bool[]> ok(new bool[clients]);
+  std::vector<std::thread> threads;
+  Clock::time_point start = Clock::now();
+  for(size_t c = 0; c < clients; c++)
+    threads.push_back(std::thread(client, path, (int) c, requests, n, &latency[c], &ok[c]));
+  for(std::thread &t : threads)
+    t.join();
+  double wall = usecBetween(start, Clock::now()) / 1e6;
+
+  std::vector<double> all;
+  bool allOk = true;
+  for(size_t c = 0; c < clients; c++)
+    {
+      all.insert(all.end(), latency[c].begin(), latency[c].end());
+      allOk &= ok[c];
+    }
+  if(all.empty())
+    {
+      cerr << "no replies from " << path << endl;
+      return 1;
+    }
+  cout << all.size() << " requests of " << n << " items from " << clients << " clients in "
+       << wall * 1e3 << " ms, " << all.size() / wall << " requests/sec" << endl
+       << "round trip p50 " << Stats::percentile(all, 0.5) << " p99 " << Stats::percentile(all, 0.99)
+       << " max " << all.back() << " usec" << endl
+       << (allOk ? "result correct" : "result INcorrect") << endl;
+  return allOk ? 0 : 1;
+}
+
+int main(int argc, char * argv[])
+{
+  if(argc < 2 || (strcmp(argv[1], "serve") && strcmp(argv[1], "bench")))
+    {
+      usage();
+      return 1;
+    }
+  string mode = argv[1];
+  string path = "/tmp/opencl-learner.sock";
+  long window = 200;
+  size_t maxJobs = 64, maxItems = (size_t) 1 << 22;
+  int reportSec = 5;
+  size_t clients = 16, requests = 100, n = 256;
+  for(int i = 2; i + 1 < argc; i += 2)
+    {
+      if(!strcmp(argv[i], "-s"))      path = argv[i + 1];
+      else if(!strcmp(argv[i], "-w")) window = strtol(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-b")) maxJobs = strtoull(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-m")) maxItems = strtoull(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-i")) reportSec = atoi(argv[i + 1]);
+      else if(!strcmp(argv[i], "-c")) clients = strtoull(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-r")) requests = strtoull(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-n")) n = strtoull(argv[i + 1], NULL, 0);
+      else
+        {
+          usage();
+          return 1;
+        }
+    }
+  // Offsets are uints.
+  if(argc % 2 != 0 || window < 0 || maxJobs == 0 || maxItems == 0 || maxItems > 0x7fffffff || reportSec <= 0 ||
+     clients == 0 || requests == 0 || n == 0 || n > 0xffffffffu)
+    {
+      usage();
+      return 1;
+    }
+
+  try
+    {
+      return mode == "serve" ? serve(path, window, maxJobs, maxItems, reportSec)
+                             : bench(path, clients, requests, n);
+    }
+  catch(cl::Error &err)
+    {
+      cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << endl;
+    }
+  catch(string msg)
+    {
+      cerr << "Exception caught in main(): " << msg << endl;
+    }
+  return 1;
+}
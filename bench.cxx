@@ -0,0 +1,998 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+
+#include "native.h"
+#include "parallel_min_cl.h"
+#include "roofline.h"
+#include "reduction.hpp"
+#include "shared_buffer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+////////////////////////////////////////////////////////////////
+// Benchmark driver for saxpy, min (parallel_min) and memset, with the
+// native SIMD saxpy and min (native.h) as the CPU baseline, and the
+// minp_vec access patterns of parallel_min.cl.
+//
+//   ./bench --kernel saxpy,min,memset,native-saxpy,native-min --size 1M,16M --local 64,256
+//           --width 1,4,8 --unroll 1,4 --iters 100 --warmup 5 --trials 10
+//           --mem copy,usehost,svm-fine --device cpu --format json
+//
+// Every combination of the swept parameters is one configuration. Each
+// configuration runs `warmup` untimed launches, then `trials` timed
+// trials of `iters` launches followed by a finish; the per-launch time
+// of each trial feeds the statistics. The transfer time (publishing the
+// inputs to the device and reading the outputs back) is measured once
+// per configuration, since it is what the --mem strategies change.
+//
+// The native kernels run on the host: --mem, --local and --width do not
+// apply, and the local column reports the thread count. Only the minp-*
+// kernels (blocked, strided and hybrid minp_vec, from parallel_min.cl as
+// embedded by embed_cl.sh) take --unroll; the others run once per
+// configuration and report unroll 1.
+//
+// --roofline measures the device's peak bandwidth and compute first
+// (roofline.h) and scores every OpenCL configuration against it.
+////////////////////////////////////////////////////////////////
+
+void usage()
+{
+  cerr << "usage: bench [--kernel saxpy,min,memset,native-saxpy,native-min,minp-blocked,minp-strided,minp-hybrid]" << endl
+       << "             [--size N,...] [--local N,...] [--width 1,2,4,8,16] [--unroll N,...]" << endl
+       << "             [--iters N,...] [--warmup N] [--trials N]" << endl
+       << "             [--mem copy,usehost,allochost,svm-coarse,svm-fine]" << endl
+       << "             [--device default|cpu|gpu] [--format text|json|csv] [--roofline]" << endl
+       << "sizes accept K/M/G suffixes; --local 0 keeps the kernel's default." << endl;
+}
+
+////////////////////////////////////////////////////////////////
+// Command line
+////////////////////////////////////////////////////////////////
+struct Options
+{
+  std::vector<string> kernels;
+  std::vector<size_t> sizes;
+  std::vector<size_t> locals;
+  std::vector<size_t> widths;
+  std::vector<size_t> unrolls;
+  std::vector<size_t> iters;
+  std::vector<MemMode> mems;
+  int warmup;
+  int trials;
+  string device;
+  string format;
+  bool roofline;
+
+  Options()
+    : kernels({ "saxpy", "min", "memset" }), sizes({ 1 << 24 }), locals({ 0 }),
+      widths({ 4 }), unrolls({ 1 }), iters({ 100 }), mems({ MEM_COPY }), warmup(5), trials(10),
+      device("default"), format("text"), roofline(false) {}
+};
+
+size_t parseSize(const string &s)
+{
+  char *end;
+  size_t v = strtoull(s.c_str(), &end, 0);
+  switch(*end)
+    {
+    case 'k': case 'K': v <<= 10; break;
+    case 'm': case 'M': v <<= 20; break;
+    case 'g': case 'G': v <<= 30; break;
+    case '\0': break;
+    default: throw(string("bad number: " + s));
+    }
+  return v;
+}
+
+std::vector<string> split(const string &s)
+{
+  std::vector<string> out;
+  std::stringstream ss(s);
+  string item;
+  while(std::getline(ss, item, ','))
+    if(!item.empty())
+      out.push_back(item);
+  return out;
+}
+
+std::vector<size_t> parseSizes(const string &s)
+{
+  std::vector<size_t> out;
+  for(const string &item : split(s))
+    out.push_back(parseSize(item));
+  return out;
+}
+
+Options parseOptions(int argc, char * argv[])
+{
+  Options o;
+  for(int i = 1; i < argc; i++)
+    {
+      string key = argv[i];
+      string value;
+      size_t eq = key.find('=');
+      if(eq != string::npos)
+        {
+          value = key.substr(eq + 1);
+          key = key.substr(0, eq);
+        }
+      else if(key == "--help" || key == "-h")
+        {
+          usage();
+          exit(0);
+        }
+      else if(key == "--roofline")
+        {
+          o.roofline = true;
+          continue;
+        }
+      else if(i + 1 < argc)
+        value = argv[++i];
+      else
+        throw(string("missing value for " + key));
+
+      if(key == "--kernel")       o.kernels = split(value);
+      else if(key == "--size")    o.sizes = parseSizes(value);
+      else if(key == "--local")   o.locals = parseSizes(value);
+      else if(key == "--width")   o.widths = parseSizes(value);
+      else if(key == "--unroll")  o.unrolls = parseSizes(value);
+      else if(key == "--iters")   o.iters = parseSizes(value);
+      else if(key == "--mem")
+        {
+          o.mems.clear();
+          for(const string &m : split(value))
+            o.mems.push_back(parseMemMode(m));
+        }
+      else if(key == "--warmup")  o.warmup = (int) parseSize(value);
+      else if(key == "--trials")  o.trials = (int) parseSize(value);
+      else if(key == "--device")  o.device = value;
+      else if(key == "--format")  o.format = value;
+      else
+        {
+          usage();
+          throw(string("unknown option " + key));
+        }
+    }
+  if(o.trials < 1)
+    throw(string("--trials must be at least 1"));
+  return o;
+}
+
+////////////////////////////////////////////////////////////////
+// Statistics over per-launch times (seconds)
+////////////////////////////////////////////////////////////////
+struct Stats
+{
+  double min, median, mean, stddev, max;
+};
+
+Stats computeStats(std::vector<double> v)
+{
+  Stats s;
+  std::sort(v.begin(), v.end());
+  s.min = v.front();
+  s.max = v.back();
+  s.median = v.size() % 2 ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+  double sum = 0, sq = 0;
+  for(double x : v)
+    sum += x;
+  s.mean = sum / v.size();
+  for(double x : v)
+    sq += (x - s.mean) * (x - s.mean);
+  s.stddev = v.size() > 1 ? std::sqrt(sq / (v.size() - 1)) : 0;
+  return s;
+}
+
+////////////////////////////////////////////////////////////////
+// Kernels under test
+////////////////////////////////////////////////////////////////
+class Bench
+{
+public:
+  virtual ~Bench() {}
+  // Allocate and initialize for n elements; false if the configuration
+  // does not apply (e.g. n not a multiple of the width).
+  virtual bool setup(size_t n, size_t local, size_t width, MemMode mem) = 0;
+  // Loads per loop iteration, for the kernels that have the choice
+  // (takesUnroll()); called before setup().
+  virtual bool takesUnroll() const { return false; }
+  virtual bool setUnroll(size_t unroll) { return unroll == 1; }
+  virtual void enqueue() = 0;
+  // Publish the inputs and read the outputs back once.
+  virtual double transferSeconds() = 0;
+  virtual bool verify() = 0;
+  // Traffic and work of one launch, for the B/W and the roofline;
+  // min and compare count as one operation.
+  virtual double bytesRead() const = 0;
+  virtual double bytesWritten() const = 0;
+  virtual double flopsPerLaunch() const = 0;
+  virtual size_t localSize() const = 0;
+
+  double bytesPerLaunch() const { return bytesRead() + bytesWritten(); }
+};
+
+cl::Context context;
+cl::Device device;
+cl::CommandQueue queue;
+// Sweep points of similar size reuse each other's buffers.
+buffer_pool *pool = NULL;
+
+cl::Program buildProgram(const string &src, const char *options = NULL)
+{
+  cl::Program::Sources sources = { src };
+  cl::Program program(context, sources);
+  try
+    {
+      program.build(std::vector<cl::Device>(1, device), options);
+    }
+  catch(cl::Error &err)
+    {
+      if(err.err() == CL_BUILD_PROGRAM_FAILURE)
+        throw(string("build failed:\n" + program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)));
+      throw;
+    }
+  return program;
+}
+
+string vecType(const char *t, size_t width)
+{
+  return width == 1 ? string(t) : string(t) + std::to_string(width);
+}
+
+size_t roundUp(size_t n, size_t m)
+{
+  return (n + m - 1) / m * m;
+}
+
+// A device buffer from the pool; hand it back with buffer_pool_put.
+cl::Buffer poolBuffer(cl_mem_flags flags, size_t bytes)
+{
+  cl_int err;
+  cl_mem buf = buffer_pool_get(pool, flags, bytes, &err);
+  if(buf == NULL)
+    throw cl::Error(err, "buffer_pool_get");
+  return cl::Buffer(buf, true);
+}
+
+void upload(SharedBuffer &buf, const void *src)
+{
+  void *p = buf.map(CL_MAP_WRITE_INVALIDATE_REGION);
+  memcpy(p, src, buf.size());
+  buf.unmap();
+}
+
+void download(SharedBuffer &buf, void *dst)
+{
+  void *p = buf.map(CL_MAP_READ);
+  memcpy(dst, p, buf.size());
+  buf.unmap();
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// y = a * x + y, W elements per work-item.
+class SaxpyBench : public Bench
+{
+  size_t n_, local_, width_;
+  std::vector<cl_float> x_, y_;
+  std::unique_ptr<SharedBuffer> bufX_, bufY_;
+  cl::Kernel kernel_;
+  std::map<size_t, cl::Program> programs_;
+  static constexpr cl_float a_ = 2.f;
+
+public:
+  bool setup(size_t n, size_t local, size_t width, MemMode mem)
+  {
+    if(n % width != 0)
+      return false;
+    n_ = n;
+    local_ = local;
+    width_ = width;
+    if(programs_.find(width) == programs_.end())
+      {
+        string t = vecType("float", width);
+        programs_[width] = buildProgram(
+          "__kernel void saxpy(const __global " + t + " *x,\n"
+          "                    __global " + t + " *y,\n"
+          "                    const float a,\n"
+          "                    uint n)\n"
+          "{\n"
+          "  uint gid = get_global_id(0);\n"
+          "  if(gid < n)\n"
+          "    y[gid] = a * x[gid] + y[gid];\n"
+          "}\n");
+      }
+    kernel_ = cl::Kernel(programs_[width], "saxpy");
+    x_.resize(n);
+    y_.resize(n);
+    for(size_t i = 0; i < n; i++)
+      {
+        x_[i] = cl_float(i % 1024);
+        y_[i] = cl_float(1023 - i % 1024);
+      }
+    bufX_.reset(new SharedBuffer(context, queue, mem, n * sizeof(cl_float), CL_MEM_READ_ONLY, pool));
+    bufY_.reset(new SharedBuffer(context, queue, mem, n * sizeof(cl_float), CL_MEM_READ_WRITE, pool));
+    upload(*bufX_, x_.data());
+    upload(*bufY_, y_.data());
+    bufX_->setArg(kernel_, 0);
+    bufY_->setArg(kernel_, 1);
+    kernel_.setArg(2, a_);
+    kernel_.setArg(3, (cl_uint) (n / width));
+    return true;
+  }
+
+  void enqueue()
+  {
+    size_t items = n_ / width_;
+    if(local_)
+      queue.enqueueNDRangeKernel(kernel_, cl::NullRange, cl::NDRange(roundUp(items, local_)), cl::NDRange(local_));
+    else
+      queue.enqueueNDRangeKernel(kernel_, cl::NullRange, cl::NDRange(items));
+  }
+
+  // One launch from the initial y.
+  bool verify()
+  {
+    upload(*bufY_, y_.data());
+    enqueue();
+    std::vector<cl_float> out(n_);
+    download(*bufY_, out.data());
+    for(size_t i = 0; i < n_; i++)
+      if(out[i] != a_ * x_[i] + y_[i])
+        return false;
+    return true;
+  }
+
+  double transferSeconds()
+  {
+    std::vector<cl_float> out(n_);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    upload(*bufX_, x_.data());
+    upload(*bufY_, y_.data());
+    download(*bufY_, out.data());
+    return secondsSince(start);
+  }
+
+  double bytesRead() const { return 2.0 * n_ * sizeof(cl_float); }
+  double bytesWritten() const { return (double) n_ * sizeof(cl_float); }
+  double flopsPerLaunch() const { return 2.0 * n_; }
+  size_t localSize() const { return local_; }
+};
+
+// Single-pass min of reduction.hpp, the generalized minp_single.
+class MinBench : public Bench
+{
+  size_t n_, local_, groups_;
+  std::vector<cl_uint> src_;
+  cl_uint expect_;
+  std::unique_ptr<SharedBuffer> buf_;
+  std::function<void ()> enqueue_;
+  std::function<cl_uint ()> result_;
+  std::shared_ptr<void> red_;
+
+  template<int W>
+  void make(size_t local)
+  {
+    typedef reduction::Reduction<reduction::Min, cl_uint, W> Red;
+    std::shared_ptr<Red> red = std::make_shared<Red>(context, device);
+    if(local)
+      {
+        cl_uint cu = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+        bool cpu = device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU;
+        red->setWorkSize(cu * (cpu ? 1 : 7) * local, local);
+      }
+    local_ = red->localSize();
+    groups_ = red->globalSize() / local_;
+    cl_uint n = (cl_uint) n_;
+    Red *r = red.get();
+    enqueue_ = [this, r, n]() { r->enqueue(queue, *buf_, n); };
+    result_ = [r]() { return r->result(queue).value; };
+    red_ = red;
+  }
+
+public:
+  bool setup(size_t n, size_t local, size_t width, MemMode mem)
+  {
+    if(local & (local - 1))
+      return false;
+    n_ = n;
+    switch(width)
+      {
+      case 1: make<1>(local); break;
+      case 2: make<2>(local); break;
+      case 4: make<4>(local); break;
+      case 8: make<8>(local); break;
+      case 16: make<16>(local); break;
+      default: return false;
+      }
+    // MWC init, as in parallel_min.
+    src_.resize(n);
+    cl_uint a = 0x12345678, b = a;
+    expect_ = (cl_uint) -1;
+    for(size_t i = 0; i < n; i++)
+      {
+        src_[i] = b = (a * (b & 65535)) + (b >> 16);
+        expect_ = std::min(expect_, src_[i]);
+      }
+    buf_.reset(new SharedBuffer(context, queue, mem, n * sizeof(cl_uint), CL_MEM_READ_ONLY, pool));
+    upload(*buf_, src_.data());
+    return true;
+  }
+
+  void enqueue() { enqueue_(); }
+  bool verify() { enqueue_(); return result_() == expect_; }
+
+  double transferSeconds()
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    upload(*buf_, src_.data());
+    return secondsSince(start);
+  }
+
+  // The last group reads the partials back; the result is value and index.
+  double bytesRead() const { return (double) (n_ + groups_) * sizeof(cl_uint); }
+  double bytesWritten() const { return (double) (groups_ + 2) * sizeof(cl_uint); }
+  double flopsPerLaunch() const { return (double) (n_ + groups_); }
+  size_t localSize() const { return local_; }
+};
+
+// The memset kernel of hello_opencl, dst[i] = i, W elements per work-item.
+class MemsetBench : public Bench
+{
+  size_t n_, local_, width_;
+  std::unique_ptr<SharedBuffer> buf_;
+  cl::Kernel kernel_;
+  std::map<size_t, cl::Program> programs_;
+
+public:
+  bool setup(size_t n, size_t local, size_t width, MemMode mem)
+  {
+    if(n % width != 0)
+      return false;
+    n_ = n;
+    local_ = local;
+    width_ = width;
+    if(programs_.find(width) == programs_.end())
+      {
+        string t = vecType("uint", width);
+        string lanes = width == 1 ? "0" : "(" + t + ")(0";
+        for(size_t i = 1; i < width; i++)
+          lanes += ", " + std::to_string(i);
+        if(width > 1)
+          lanes += ")";
+        programs_[width] = buildProgram(
+          "__kernel void memset(__global " + t + " *dst, uint n)\n"
+          "{\n"
+          "  uint gid = get_global_id(0);\n"
+          "  if(gid < n)\n"
+          "    dst[gid] = (" + t + ") (gid * " + std::to_string(width) + ") + " + lanes + ";\n"
+          "}\n");
+      }
+    kernel_ = cl::Kernel(programs_[width], "memset");
+    buf_.reset(new SharedBuffer(context, queue, mem, n * sizeof(cl_uint), CL_MEM_WRITE_ONLY, pool));
+    buf_->setArg(kernel_, 0);
+    kernel_.setArg(1, (cl_uint) (n / width));
+    return true;
+  }
+
+  void enqueue()
+  {
+    size_t items = n_ / width_;
+    if(local_)
+      queue.enqueueNDRangeKernel(kernel_, cl::NullRange, cl::NDRange(roundUp(items, local_)), cl::NDRange(local_));
+    else
+      queue.enqueueNDRangeKernel(kernel_, cl::NullRange, cl::NDRange(items));
+  }
+
+  bool verify()
+  {
+    enqueue();
+    std::vector<cl_uint> out(n_);
+    download(*buf_, out.data());
+    for(size_t i = 0; i < n_; i++)
+      if(out[i] != (cl_uint) i)
+        return false;
+    return true;
+  }
+
+  double transferSeconds()
+  {
+    std::vector<cl_uint> out(n_);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    download(*buf_, out.data());
+    return secondsSince(start);
+  }
+
+  double bytesRead() const { return 0; }
+  double bytesWritten() const { return (double) n_ * sizeof(cl_uint); }
+  double flopsPerLaunch() const { return 0; }
+  size_t localSize() const { return local_; }
+};
+
+// native_saxpy on the host, the baseline for saxpy.
+class NativeSaxpyBench : public Bench
+{
+  size_t n_;
+  std::vector<cl_float> x_, y_;
+  static constexpr cl_float a_ = 2.f;
+
+public:
+  bool setup(size_t n, size_t, size_t, MemMode mem)
+  {
+    if(mem != MEM_COPY)
+      return false;
+    n_ = n;
+    x_.resize(n);
+    y_.resize(n);
+    for(size_t i = 0; i < n; i++)
+      {
+        x_[i] = cl_float(i % 1024);
+        y_[i] = cl_float(1023 - i % 1024);
+      }
+    return true;
+  }
+
+  void enqueue() { native_saxpy(a_, x_.data(), y_.data(), n_); }
+
+  bool verify()
+  {
+    for(size_t i = 0; i < n_; i++)
+      y_[i] = cl_float(1023 - i % 1024);
+    enqueue();
+    for(size_t i = 0; i < n_; i++)
+      if(y_[i] != a_ * cl_float(i % 1024) + cl_float(1023 - i % 1024))
+        return false;
+    return true;
+  }
+
+  double transferSeconds() { return 0; }
+  double bytesRead() const { return 2.0 * n_ * sizeof(cl_float); }
+  double bytesWritten() const { return (double) n_ * sizeof(cl_float); }
+  double flopsPerLaunch() const { return 2.0 * n_; }
+  size_t localSize() const { return native_threads(); }
+};
+
+// native_min on the host, the baseline for min.
+class NativeMinBench : public Bench
+{
+  size_t n_;
+  std::vector<cl_uint> src_;
+  cl_uint expect_, got_;
+
+public:
+  bool setup(size_t n, size_t, size_t, MemMode mem)
+  {
+    if(mem != MEM_COPY)
+      return false;
+    n_ = n;
+    // MWC init, as in parallel_min.
+    src_.resize(n);
+    cl_uint a = 0x12345678, b = a;
+    expect_ = (cl_uint) -1;
+    for(size_t i = 0; i < n; i++)
+      {
+        src_[i] = b = (a * (b & 65535)) + (b >> 16);
+        expect_ = std::min(expect_, src_[i]);
+      }
+    return true;
+  }
+
+  void enqueue() { got_ = native_min(src_.data(), n_); }
+  bool verify() { enqueue(); return got_ == expect_; }
+  double transferSeconds() { return 0; }
+  double bytesRead() const { return (double) n_ * sizeof(cl_uint); }
+  double bytesWritten() const { return 0; }
+  double flopsPerLaunch() const { return (double) n_; }
+  size_t localSize() const { return native_threads(); }
+};
+
+// minp_vec of parallel_min.cl with one access pattern; width and unroll
+// are baked in with -D, one program per combination.
+class MinpBench : public Bench
+{
+  int pattern_;
+  size_t n_, local_, global_, unroll_;
+  std::vector<cl_uint> src_;
+  cl_uint expect_;
+  std::unique_ptr<SharedBuffer> buf_;
+  cl::Buffer dst_, partial_, done_, dbg_;
+  cl::Kernel kernel_;
+  std::map<string, cl::Program> programs_;
+
+  // Hand the result, partial, ticket and debug buffers back to the pool.
+  void putScratch()
+  {
+    queue.finish();
+    for(cl::Buffer *b : { &dst_, &partial_, &done_, &dbg_ })
+      if((*b)())
+        {
+          buffer_pool_put(pool, (*b)());
+          *b = cl::Buffer();
+        }
+  }
+
+public:
+  MinpBench(int pattern) : pattern_(pattern), unroll_(1) {}
+  ~MinpBench() { putScratch(); }
+
+  bool takesUnroll() const { return true; }
+  bool setUnroll(size_t unroll)
+  {
+    unroll_ = unroll;
+    return unroll > 0;
+  }
+
+  bool setup(size_t n, size_t local, size_t width, MemMode mem)
+  {
+    if(width == 0 || width > 16 || (width & (width - 1)) || n > 0x7fffffff)
+      return false;
+    string opts = "-cl-std=CL2.0 -DMINP_WIDTH=" + std::to_string(width) +
+      " -DMINP_UNROLL=" + std::to_string(unroll_) + " -DMINP_PATTERN=" + std::to_string(pattern_);
+    if(programs_.find(opts) == programs_.end())
+      programs_[opts] = buildProgram(parallel_min_cl, opts.c_str());
+    kernel_ = cl::Kernel(programs_[opts], "minp_vec");
+
+    // parallel_min's heuristic: one work-item per core on CPUs, 7
+    // wavefronts per SIMD on GPUs; any global size works.
+    bool cpu = device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU;
+    cl_uint cu = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    n_ = n;
+    local_ = local ? local : (cpu ? 1 : 64);
+    global_ = cu * (cpu ? 1 : 7) * local_;
+
+    // MWC init, as in parallel_min.
+    src_.resize(n);
+    cl_uint a = 0x12345678, b = a;
+    expect_ = (cl_uint) -1;
+    for(size_t i = 0; i < n; i++)
+      {
+        src_[i] = b = (a * (b & 65535)) + (b >> 16);
+        expect_ = std::min(expect_, src_[i]);
+      }
+    buf_.reset(new SharedBuffer(context, queue, mem, n * sizeof(cl_uint), CL_MEM_READ_ONLY, pool));
+    upload(*buf_, src_.data());
+
+    cl_uint zero = 0;
+    size_t groups = global_ / local_;
+    putScratch();
+    dst_ = poolBuffer(CL_MEM_READ_WRITE, sizeof(cl_uint));
+    partial_ = poolBuffer(CL_MEM_READ_WRITE, groups * sizeof(cl_uint));
+    done_ = poolBuffer(CL_MEM_READ_WRITE, sizeof(cl_uint));
+    dbg_ = poolBuffer(CL_MEM_WRITE_ONLY, 4 * sizeof(cl_uint));
+    // A recycled ticket counter is not zero.
+    queue.enqueueFillBuffer(done_, zero, 0, sizeof(cl_uint));
+    buf_->setArg(kernel_, 0);
+    kernel_.setArg(1, dst_);
+    kernel_.setArg(2, partial_);
+    kernel_.setArg(3, done_);
+    kernel_.setArg(4, dbg_);
+    kernel_.setArg(5, (cl_int) n);
+    kernel_.setArg(6, (cl_uint) (cpu ? 0 : 1));
+    return true;
+  }
+
+  void enqueue()
+  {
+    queue.enqueueNDRangeKernel(kernel_, cl::NullRange, cl::NDRange(global_), cl::NDRange(local_));
+  }
+
+  bool verify()
+  {
+    cl_uint got;
+    enqueue();
+    queue.enqueueReadBuffer(dst_, CL_TRUE, 0, sizeof(cl_uint), &got);
+    return got == expect_;
+  }
+
+  double transferSeconds()
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    upload(*buf_, src_.data());
+    return secondsSince(start);
+  }
+
+  // Partials, the result and the four debug words on top of src.
+  double bytesRead() const { return (double) (n_ + global_ / local_) * sizeof(cl_uint); }
+  double bytesWritten() const { return (double) (global_ / local_ + 5) * sizeof(cl_uint); }
+  double flopsPerLaunch() const { return (double) (n_ + global_ / local_); }
+  size_t localSize() const { return local_; }
+};
+
+std::unique_ptr<Bench> makeBench(const string &name)
+{
+  if(name == "saxpy")  return std::unique_ptr<Bench>(new SaxpyBench);
+  if(name == "min")    return std::unique_ptr<Bench>(new MinBench);
+  if(name == "memset") return std::unique_ptr<Bench>(new MemsetBench);
+  if(name == "native-saxpy") return std::unique_ptr<Bench>(new NativeSaxpyBench);
+  if(name == "native-min")   return std::unique_ptr<Bench>(new NativeMinBench);
+  if(name == "minp-blocked") return std::unique_ptr<Bench>(new MinpBench(0));
+  if(name == "minp-strided") return std::unique_ptr<Bench>(new MinpBench(1));
+  if(name == "minp-hybrid")  return std::unique_ptr<Bench>(new MinpBench(2));
+  throw(string("unknown kernel " + name));
+}
+
+////////////////////////////////////////////////////////////////
+// Results and output
+////////////////////////////////////////////////////////////////
+struct Record
+{
+  string kernel;
+  string mem;
+  size_t size, local, width, unroll, iters;
+  int trials;
+  bool correct;
+  Stats time;        // seconds per launch
+  double gbPerSec;   // from the median
+  double gflopsPerSec;
+  double intensity;  // flops per byte
+  double transfer;   // seconds to publish inputs and read outputs once
+  bool scored;       // with --roofline, for OpenCL kernels
+  double peakFraction;
+  bool computeBound;
+};
+
+// With --roofline.
+roofline_peak peak;
+
+string jsonString(const string &s)
+{
+  string out = "\"";
+  for(char c : s)
+    {
+      if(c == '"' || c == '\\')
+        out += '\\';
+      if((unsigned char) c >= 0x20)
+        out += c;
+    }
+  return out + "\"";
+}
+
+void printJson(const std::vector<Record> &records, const Options &o)
+{
+  cout << "{" << endl
+       << "  \"device\": " << jsonString(device.getInfo<CL_DEVICE_NAME>()) << "," << endl
+       << "  \"driver\": " << jsonString(device.getInfo<CL_DRIVER_VERSION>()) << "," << endl
+       << "  \"version\": " << jsonString(device.getInfo<CL_DEVICE_VERSION>()) << "," << endl
+       << "  \"warmup\": " << o.warmup << "," << endl;
+  if(o.roofline)
+    cout << "  \"peak\": {\"gb_per_sec\": " << peak.bandwidth / 1e9
+         << ", \"gflop_per_sec\": " << peak.flops / 1e9 << "}," << endl;
+  cout << "  \"results\": [" << endl;
+  for(size_t i = 0; i < records.size(); i++)
+    {
+      const Record &r = records[i];
+      cout << "    {\"kernel\": " << jsonString(r.kernel)
+           << ", \"mem\": " << jsonString(r.mem)
+           << ", \"size\": " << r.size << ", \"local\": " << r.local
+           << ", \"width\": " << r.width << ", \"unroll\": " << r.unroll
+           << ", \"iters\": " << r.iters
+           << ", \"trials\": " << r.trials
+           << ", \"correct\": " << (r.correct ? "true" : "false")
+           << ", \"time_us\": {\"min\": " << r.time.min * 1e6
+           << ", \"median\": " << r.time.median * 1e6
+           << ", \"mean\": " << r.time.mean * 1e6
+           << ", \"stddev\": " << r.time.stddev * 1e6
+           << ", \"max\": " << r.time.max * 1e6 << "}"
+           << ", \"gb_per_sec\": " << r.gbPerSec
+           << ", \"gflop_per_sec\": " << r.gflopsPerSec
+           << ", \"flop_per_byte\": " << r.intensity
+           << ", \"transfer_us\": " << r.transfer * 1e6;
+      if(r.scored)
+        cout << ", \"peak_fraction\": " << r.peakFraction
+             << ", \"bound\": " << (r.computeBound ? "\"compute\"" : "\"memory\"");
+      cout << "}"
+           << (i + 1 < records.size() ? "," : "") << endl;
+    }
+  cout << "  ]" << endl << "}" << endl;
+}
+
+void printCsv(const std::vector<Record> &records)
+{
+  cout << "kernel,mem,size,local,width,unroll,iters,trials,correct,min_us,median_us,mean_us,stddev_us,max_us,gb_per_sec,gflop_per_sec,flop_per_byte,transfer_us,peak_fraction,bound" << endl;
+  for(const Record &r : records)
+    cout << r.kernel << "," << r.mem << "," << r.size << "," << r.local << "," << r.width << ","
+         << r.unroll << "," << r.iters << "," << r.trials << "," << (r.correct ? 1 : 0) << ","
+         << r.time.min * 1e6 << "," << r.time.median * 1e6 << "," << r.time.mean * 1e6 << ","
+         << r.time.stddev * 1e6 << "," << r.time.max * 1e6 << "," << r.gbPerSec << ","
+         << r.gflopsPerSec << "," << r.intensity << "," << r.transfer * 1e6 << ","
+         << (r.scored ? std::to_string(r.peakFraction) : "") << ","
+         << (r.scored ? (r.computeBound ? "compute" : "memory") : "") << endl;
+}
+
+void printText(const Record &r)
+{
+  cout << r.kernel << " " << r.mem << " size " << r.size << " local " << r.local << " width " << r.width
+       << " unroll " << r.unroll << " iters " << r.iters << ": median " << r.time.median * 1e6 << " usec"
+       << " (min " << r.time.min * 1e6 << ", stddev " << r.time.stddev * 1e6 << ")"
+       << ", B/W " << r.gbPerSec << " GB/sec, " << r.gflopsPerSec << " GFLOP/sec, transfer "
+       << r.transfer * 1e6 << " usec";
+  if(r.scored)
+    cout << ", " << r.peakFraction * 100 << "% of peak (" << (r.computeBound ? "compute" : "memory")
+         << "-bound)";
+  cout << (r.correct ? ", result correct" : ", result INcorrect") << endl;
+}
+
+////////////////////////////////////////////////////////////////
+// Warmup, timed trials, verification and transfer time of one
+// configuration
+////////////////////////////////////////////////////////////////
+Record measure(Bench &bench, const Options &o, size_t iters)
+{
+  for(int i = 0; i < o.warmup; i++)
+    bench.enqueue();
+  queue.finish();
+
+  std::vector<double> perLaunch;
+  for(int t = 0; t < o.trials; t++)
+    {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for(size_t i = 0; i < iters; i++)
+        bench.enqueue();
+      queue.finish();
+      perLaunch.push_back(secondsSince(start) / iters);
+    }
+
+  Record r;
+  r.local = bench.localSize();
+  r.iters = iters;
+  r.trials = o.trials;
+  r.correct = bench.verify();
+  r.time = computeStats(perLaunch);
+  r.gbPerSec = bench.bytesPerLaunch() / r.time.median / 1e9;
+  r.gflopsPerSec = bench.flopsPerLaunch() / r.time.median / 1e9;
+  r.intensity = bench.flopsPerLaunch() / bench.bytesPerLaunch();
+  r.transfer = bench.transferSeconds();
+  r.scored = false;
+  if(o.roofline)
+    {
+      int compute;
+      r.peakFraction = roofline_fraction(&peak, bench.bytesPerLaunch(), bench.flopsPerLaunch(),
+                                         r.time.median, &compute);
+      r.computeBound = compute != 0;
+      r.scored = true;
+    }
+  return r;
+}
+
+////////////////////////////////////////////////////////////////
+// Device selection: PoCL and other CPU runtimes via --device cpu
+////////////////////////////////////////////////////////////////
+cl::Device pickDevice(const string &which)
+{
+  if(which == "default")
+    return cl::Device::getDefault();
+  cl_device_type type;
+  if(which == "cpu")
+    type = CL_DEVICE_TYPE_CPU;
+  else if(which == "gpu")
+    type = CL_DEVICE_TYPE_GPU;
+  else
+    throw(string("unknown device " + which));
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+  for(cl::Platform &p : platforms)
+    {
+      std::vector<cl::Device> devices;
+      try
+        {
+          p.getDevices(type, &devices);
+        }
+      catch(cl::Error &err)
+        {
+          if(err.err() != CL_DEVICE_NOT_FOUND)
+            throw;
+        }
+      if(!devices.empty())
+        return devices[0];
+    }
+  throw(string("no " + which + " device found"));
+}
+
+int main(int argc, char * argv[])
+{
+  try
+    {
+      Options o = parseOptions(argc, argv);
+      device = pickDevice(o.device);
+      context = cl::Context(device);
+      queue = cl::CommandQueue(context, device);
+      pool = buffer_pool_create(context(), 0);
+      if(pool == NULL)
+        throw(string("cannot create the buffer pool"));
+      if(o.format == "text")
+        cout << device.getInfo<CL_DEVICE_NAME>() << " (" << device.getInfo<CL_DRIVER_VERSION>() << ")" << endl;
+      if(o.roofline)
+        {
+          cl_int err = roofline_measure_peak(context(), device(), queue(), &peak);
+          if(err != CL_SUCCESS)
+            throw cl::Error(err, "roofline_measure_peak");
+          if(o.format == "text")
+            roofline_print_peak(&peak);
+        }
+
+      std::vector<Record> records;
+      bool allCorrect = true;
+      for(const string &name : o.kernels)
+        {
+          std::unique_ptr<Bench> bench = makeBench(name);
+          for(MemMode mem : o.mems)
+            {
+              if(!memModeSupported(device, mem))
+                {
+                  cerr << name << ": memory mode " << memModeName(mem) << " not supported, skipping" << endl;
+                  continue;
+                }
+              // Unroll does not apply to kernels without the choice: they
+              // run once per sweep point and report unroll 1.
+              const std::vector<size_t> noUnroll({ 1 });
+              for(size_t unroll : bench->takesUnroll() ? o.unrolls : noUnroll)
+                {
+                  if(!bench->setUnroll(unroll))
+                    {
+                      cerr << name << ": skipping unroll " << unroll << endl;
+                      continue;
+                    }
+                  for(size_t size : o.sizes)
+                    for(size_t local : o.locals)
+                      for(size_t width : o.widths)
+                        for(size_t iters : o.iters)
+                          {
+                            if(!bench->setup(size, local, width, mem))
+                              {
+                                cerr << name << ": skipping size " << size << " local " << local
+                                     << " width " << width << endl;
+                                continue;
+                              }
+                            Record r = measure(*bench, o, iters);
+                            r.kernel = name;
+                            r.mem = memModeName(mem);
+                            r.size = size;
+                            r.width = width;
+                            r.unroll = unroll;
+                            // The peak is the device's; the native kernels run on the host.
+                            if(name.compare(0, 7, "native-") == 0)
+                              r.scored = false;
+                            allCorrect &= r.correct;
+                            records.push_back(r);
+                            if(o.format == "text")
+                              printText(r);
+                          }
+                }
+            }
+        }
+      if(o.format == "json")
+        printJson(records, o);
+      else if(o.format == "csv")
+        printCsv(records);
+      else
+        buffer_pool_print_stats(pool);
+      buffer_pool_destroy(pool);
+      return allCorrect ? 0 : 1;
+    }
+  catch(cl::Error &err)
+    {
+      cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << endl;
+    }
+  catch(string msg)
+    {
+      cerr << "Exception caught in main(): " << msg << endl;
+    }
+  return 1;
+}
@@ -0,0 +1,187 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+
+#include "blas1.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using namespace blas1;
+
+// Checks every blas1.hpp operation against the host, then times each
+// fused operation next to the unfused chain it replaces. A chain moves
+// every vector it touches once per step; the fused kernel moves each one
+// once, so the saving shows up as bytes/elem and in the time.
+
+#define NLOOPS 100
+
+////////////////////////////////////////////////////////////////
+// Globals
+////////////////////////////////////////////////////////////////
+cl_uint length = 4096 * 4096;
+
+cl::Context context;
+cl::Device device;
+cl::CommandQueue queue;
+
+// Values in 1/16ths keep every product exact; only the order of the
+// float sums differs from the host.
+std::vector<cl_float> hx, hy, hz;
+cl::Buffer x, y, z;
+
+bool same(double got, double expect)
+{
+  return std::fabs(got - expect) <= 1e-4 * std::fabs(expect);
+}
+
+////////////////////////////////////////////////////////////////
+// Put the original vectors back on the device
+////////////////////////////////////////////////////////////////
+void reset()
+{
+  queue.enqueueWriteBuffer(x, CL_FALSE, 0, length * sizeof(cl_float), hx.data());
+  queue.enqueueWriteBuffer(y, CL_FALSE, 0, length * sizeof(cl_float), hy.data());
+  queue.enqueueWriteBuffer(z, CL_FALSE, 0, length * sizeof(cl_float), hz.data());
+  queue.finish();
+}
+
+bool checkVector(const cl::Buffer &buf, const std::vector<cl_float> &expect)
+{
+  std::vector<cl_float> got(length);
+  queue.enqueueReadBuffer(buf, CL_TRUE, 0, length * sizeof(cl_float), got.data());
+  return got == expect;
+}
+
+////////////////////////////////////////////////////////////////
+// Time NLOOPS runs of op; bytes is what one run moves per element
+////////////////////////////////////////////////////////////////
+void report(const char *name, int bytes, std::function<void()> op)
+{
+  op(); // warm up
+  queue.finish();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(int i = 0; i < NLOOPS; i++)
+    op();
+  queue.finish();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%-22s %3d B/elem %9.3f ms %8.2f GB/sec\n", name, bytes,
+         elapsed / NLOOPS * 1e3, (double) length * bytes * NLOOPS / elapsed / 1e9);
+}
+
+int main(int argc, char * argv[])
+{
+  try
+    {
+      if(argc > 1)
+        length = (cl_uint) strtoul(argv[1], NULL, 0);
+
+      device = cl::Device::getDefault();
+      context = cl::Context(device);
+      queue = cl::CommandQueue(context, device);
+      cout << device.getInfo<CL_DEVICE_NAME>() << ", " << length << " items" << endl;
+
+      Blas1 blas(context, device);
+      const cl_float a = 2.f, b = .5f;
+
+      hx.resize(length);
+      hy.resize(length);
+      hz.resize(length);
+      for(cl_uint i = 0; i < length; i++)
+        {
+          hx[i] = (cl_float) (i * 7 % 17) / 16;
+          hy[i] = (cl_float) (i * 5 % 13) / 16;
+          hz[i] = (cl_float) (i * 3 % 11) / 16;
+        }
+      size_t bytes = length * sizeof(cl_float);
+      x = cl::Buffer(context, CL_MEM_READ_WRITE, bytes);
+      y = cl::Buffer(context, CL_MEM_READ_WRITE, bytes);
+      z = cl::Buffer(context, CL_MEM_READ_WRITE, bytes);
+
+      ////////////////////////////////////////////////////////////////
+      // Correctness
+      ////////////////////////////////////////////////////////////////
+      std::vector<cl_float> axpby(length), scal(length);
+      double dotXY = 0, sumsqX = 0, dotNewZ = 0, sumsqNew = 0;
+      for(cl_uint i = 0; i < length; i++)
+        {
+          axpby[i] = a * hx[i] + b * hy[i];
+          scal[i] = a * hx[i];
+          dotXY += (double) hx[i] * hy[i];
+          sumsqX += (double) hx[i] * hx[i];
+          dotNewZ += (double) axpby[i] * hz[i];
+          sumsqNew += (double) axpby[i] * axpby[i];
+        }
+
+      bool ok = true, r;
+      reset();
+      blas.axpby(queue, a, x, b, y, length);
+      cout << "axpby: " << ((r = checkVector(y, axpby)) ? "result correct" : "result INcorrect") << endl;
+      ok &= r;
+
+      blas.scal(queue, a, x, length);
+      cout << "scal: " << ((r = checkVector(x, scal)) ? "result correct" : "result INcorrect") << endl;
+      ok &= r;
+
+      reset();
+      cl_float got = blas.dot(queue, x, y, length);
+      cout << "dot: " << got << ((r = same(got, dotXY)) ? ", result correct" : ", result INcorrect") << endl;
+      ok &= r;
+
+      got = blas.nrm2(queue, x, length);
+      cout << "nrm2: " << got << ((r = same(got, std::sqrt(sumsqX))) ? ", result correct" : ", result INcorrect") << endl;
+      ok &= r;
+
+      got = blas.axpbyDot(queue, a, x, b, y, z, length);
+      r = same(got, dotNewZ) && checkVector(y, axpby);
+      cout << "axpby_dot: " << got << (r ? ", result correct" : ", result INcorrect") << endl;
+      ok &= r;
+
+      reset();
+      got = blas.axpbyNrm2(queue, a, x, b, y, length);
+      r = same(got, std::sqrt(sumsqNew)) && checkVector(y, axpby);
+      cout << "axpby_nrm2: " << got << (r ? ", result correct" : ", result INcorrect") << endl;
+      ok &= r;
+
+      ////////////////////////////////////////////////////////////////
+      // Bytes moved and time, fused against unfused. Repeated axpby with
+      // a = 2, b = 0.5 converges to y = 4x, so the loops stay finite.
+      ////////////////////////////////////////////////////////////////
+      reset();
+      const int F = sizeof(cl_float);
+      report("axpby", 3 * F, [&] { blas.axpby(queue, a, x, b, y, length); });
+      report("scal", 2 * F, [&] { blas.scal(queue, 1.f, x, length); });
+      report("dot", 2 * F, [&] { blas.dot(queue, x, y, length); });
+      report("nrm2", 1 * F, [&] { blas.nrm2(queue, x, length); });
+      // axpby reads x, y and writes y; dot reads y, z again.
+      report("axpby + dot", 5 * F, [&] {
+          blas.axpby(queue, a, x, b, y, length);
+          blas.dot(queue, y, z, length);
+        });
+      report("axpby_dot (fused)", 4 * F, [&] { blas.axpbyDot(queue, a, x, b, y, z, length); });
+      report("axpby + nrm2", 4 * F, [&] {
+          blas.axpby(queue, a, x, b, y, length);
+          blas.nrm2(queue, y, length);
+        });
+      report("axpby_nrm2 (fused)", 3 * F, [&] { blas.axpbyNrm2(queue, a, x, b, y, length); });
+
+      return ok ? 0 : 1;
+    }
+  catch(cl::Error &err)
+    {
+      cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << endl;
+    }
+  catch(string msg)
+    {
+      cerr << "Exception caught in main(): " << msg << endl;
+    }
+  return 1;
+}
@@ -0,0 +1,298 @@
+#ifndef BLAS1_HPP
+#define BLAS1_HPP
+
+////////////////////////////////////////////////////////////////
+// Level-1 BLAS on float vectors, grown from saxpy.
+//
+//   axpby      y = a * x + b * y          (saxpy is b = 1)
+//   scal       x = a * x
+//   dot        x . y
+//   nrm2       sqrt(x . x)
+//   axpbyDot   y = a * x + b * y, then y . z, in one pass
+//   axpbyNrm2  y = a * x + b * y, then sqrt(y . y), in one pass
+//
+// Every kernel walks the vectors as float4 with a scalar tail and the
+// access pattern of parallel_min (blocked on CPUs, grid-strided on
+// GPUs). The reductions finish the way minp_single does: each group
+// reduces with work_group_reduce_add, publishes a partial and takes a
+// ticket, and the last group adds the partials, so a fused operation
+// is one launch and one pass over memory.
+//
+//   Blas1 blas(context, device);
+//   blas.axpby(queue, 2.f, x, 1.f, y, n);
+//   float d = blas.axpbyDot(queue, -alpha, p, 1.f, r, z, n);
+//
+// Sums accumulate in float per work-item; nrm2 does not rescale, so
+// elements beyond ~1e19 overflow.
+////////////////////////////////////////////////////////////////
+
+#include <CL/opencl.hpp>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace blas1
+{
+
+static const char *source =
+  // Each work-item's share of the n / 4 float4s.
+  "#define FOR_EACH_VEC(k)                                              \\\n"
+  "  uint nvec = n / 4, gid = get_global_id(0), gsize = get_global_size(0); \\\n"
+  "  uint chunk = (nvec + gsize - 1) / gsize;                           \\\n"
+  "  uint end = dev == 0 ? min(nvec, (gid + 1) * chunk) : nvec;         \\\n"
+  "  for(uint k = dev == 0 ? gid * chunk : gid; k < end; k += dev == 0 ? 1 : gsize)\n"
+  // The elements after the last full float4.
+  "#define FOR_EACH_TAIL(t) \\\n"
+  "  for(uint t = n / 4 * 4 + get_global_id(0); t < n; t += get_global_size(0))\n"
+  "\n"
+  "float hsum(float4 v) { return (v.x + v.y) + (v.z + v.w); }\n"
+  "\n"
+  // minp_single's ending with a sum.
+  "void finish_sum(float v, local uint *last, global float *partial,\n"
+  "                global atomic_uint *done, global float *result, uint slot)\n"
+  "{\n"
+  "  v = work_group_reduce_add(v);\n"
+  "  if(get_local_id(0) == 0) {\n"
+  "    partial[get_group_id(0)] = v;\n"
+  "    uint ticket = atomic_fetch_add_explicit(done, 1,\n"
+  "                                            memory_order_acq_rel,\n"
+  "                                            memory_scope_device);\n"
+  "    *last = (ticket == get_num_groups(0) - 1);\n"
+  "  }\n"
+  "  barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);\n"
+  "  if(*last) {\n"
+  "    float s = 0.f;\n"
+  "    for(uint g = get_local_id(0); g < get_num_groups(0); g += get_local_size(0))\n"
+  "      s += partial[g];\n"
+  "    s = work_group_reduce_add(s);\n"
+  "    if(get_local_id(0) == 0) {\n"
+  "      result[slot] = s;\n"
+  "      atomic_store_explicit(done, 0, memory_order_relaxed, memory_scope_device);\n"
+  "    }\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "#define SUM_ARGS global float *partial, global atomic_uint *done, global float *result, uint slot\n"
+  "\n"
+  "__kernel void axpby(float a, global const float *x, float b, global float *y,\n"
+  "                    uint n, uint dev)\n"
+  "{\n"
+  "  FOR_EACH_VEC(k)\n"
+  "    vstore4(a * vload4(k, x) + b * vload4(k, y), k, y);\n"
+  "  FOR_EACH_TAIL(t)\n"
+  "    y[t] = a * x[t] + b * y[t];\n"
+  "}\n"
+  "\n"
+  "__kernel void scal(float a, global float *x, uint n, uint dev)\n"
+  "{\n"
+  "  FOR_EACH_VEC(k)\n"
+  "    vstore4(a * vload4(k, x), k, x);\n"
+  "  FOR_EACH_TAIL(t)\n"
+  "    x[t] = a * x[t];\n"
+  "}\n"
+  "\n"
+  "__kernel void dot(global const float *x, global const float *y,\n"
+  "                  uint n, uint dev, SUM_ARGS)\n"
+  "{\n"
+  "  local uint last;\n"
+  "  float4 acc = 0.f;\n"
+  "  FOR_EACH_VEC(k)\n"
+  "    acc += vload4(k, x) * vload4(k, y);\n"
+  "  float v = hsum(acc);\n"
+  "  FOR_EACH_TAIL(t)\n"
+  "    v += x[t] * y[t];\n"
+  "  finish_sum(v, &last, partial, done, result, slot);\n"
+  "}\n"
+  "\n"
+  "__kernel void sumsq(global const float *x, uint n, uint dev, SUM_ARGS)\n"
+  "{\n"
+  "  local uint last;\n"
+  "  float4 acc = 0.f;\n"
+  "  FOR_EACH_VEC(k) {\n"
+  "    float4 v = vload4(k, x);\n"
+  "    acc += v * v;\n"
+  "  }\n"
+  "  float v = hsum(acc);\n"
+  "  FOR_EACH_TAIL(t)\n"
+  "    v += x[t] * x[t];\n"
+  "  finish_sum(v, &last, partial, done, result, slot);\n"
+  "}\n"
+  "\n"
+  "__kernel void axpby_dot(float a, global const float *x, float b, global float *y,\n"
+  "                        global const float *z, uint n, uint dev, SUM_ARGS)\n"
+  "{\n"
+  "  local uint last;\n"
+  "  float4 acc = 0.f;\n"
+  "  FOR_EACH_VEC(k) {\n"
+  "    float4 v = a * vload4(k, x) + b * vload4(k, y);\n"
+  "    vstore4(v, k, y);\n"
+  "    acc += v * vload4(k, z);\n"
+  "  }\n"
+  "  float s = hsum(acc);\n"
+  "  FOR_EACH_TAIL(t) {\n"
+  "    float v = a * x[t] + b * y[t];\n"
+  "    y[t] = v;\n"
+  "    s += v * z[t];\n"
+  "  }\n"
+  "  finish_sum(s, &last, partial, done, result, slot);\n"
+  "}\n"
+  "\n"
+  "__kernel void axpby_sumsq(float a, global const float *x, float b, global float *y,\n"
+  "                          uint n, uint dev, SUM_ARGS)\n"
+  "{\n"
+  "  local uint last;\n"
+  "  float4 acc = 0.f;\n"
+  "  FOR_EACH_VEC(k) {\n"
+  "    float4 v = a * vload4(k, x) + b * vload4(k, y);\n"
+  "    vstore4(v, k, y);\n"
+  "    acc += v * v;\n"
+  "  }\n"
+  "  float s = hsum(acc);\n"
+  "  FOR_EACH_TAIL(t) {\n"
+  "    float v = a * x[t] + b * y[t];\n"
+  "    y[t] = v;\n"
+  "    s += v * v;\n"
+  "  }\n"
+  "  finish_sum(s, &last, partial, done, result, slot);\n"
+  "}\n";
+
+class Blas1
+{
+public:
+  ////////////////////////////////////////////////////////////////
+  // Build the kernels and size the launch as parallel_min does
+  ////////////////////////////////////////////////////////////////
+  Blas1(const cl::Context &context, const cl::Device &device)
+    : context_(context), device_(device)
+  {
+    cl::Program::Sources sources = { source };
+    program_ = cl::Program(context_, sources);
+    try
+      {
+        program_.build(std::vector<cl::Device>(1, device_), "-cl-std=CL2.0");
+      }
+    catch(cl::Error &err)
+      {
+        if(err.err() == CL_BUILD_PROGRAM_FAILURE)
+          throw(std::string("Build of blas1 failed:\n" +
+                            program_.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device_)));
+        throw;
+      }
+    axpby_ = cl::Kernel(program_, "axpby");
+    scal_ = cl::Kernel(program_, "scal");
+    dot_ = cl::Kernel(program_, "dot");
+    sumsq_ = cl::Kernel(program_, "sumsq");
+    axpbyDot_ = cl::Kernel(program_, "axpby_dot");
+    axpbySumsq_ = cl::Kernel(program_, "axpby_sumsq");
+
+    cl_uint computeUnits = device_.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    dev_ = device_.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU ? 0 : 1;
+    local_ = dev_ == 0 ? 1 : 64;
+    global_ = computeUnits * (dev_ == 0 ? 1 : 7) * local_;
+
+    cl_uint zero = 0;
+    partial_ = cl::Buffer(context_, CL_MEM_READ_WRITE, global_ / local_ * sizeof(cl_float));
+    done_ = cl::Buffer(context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint), &zero);
+    result_ = cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(cl_float));
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // Element-wise, enqueued only
+  ////////////////////////////////////////////////////////////////
+  void axpby(const cl::CommandQueue &queue, cl_float a, const cl::Buffer &x,
+             cl_float b, const cl::Buffer &y, cl_uint n)
+  {
+    axpby_.setArg(0, a);
+    axpby_.setArg(1, x);
+    axpby_.setArg(2, b);
+    axpby_.setArg(3, y);
+    axpby_.setArg(4, n);
+    axpby_.setArg(5, dev_);
+    launch(queue, axpby_);
+  }
+
+  void scal(const cl::CommandQueue &queue, cl_float a, const cl::Buffer &x, cl_uint n)
+  {
+    scal_.setArg(0, a);
+    scal_.setArg(1, x);
+    scal_.setArg(2, n);
+    scal_.setArg(3, dev_);
+    launch(queue, scal_);
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // Reductions, blocking on the result
+  ////////////////////////////////////////////////////////////////
+  cl_float dot(const cl::CommandQueue &queue, const cl::Buffer &x, const cl::Buffer &y, cl_uint n)
+  {
+    dot_.setArg(0, x);
+    dot_.setArg(1, y);
+    dot_.setArg(2, n);
+    dot_.setArg(3, dev_);
+    return sum(queue, dot_, 4);
+  }
+
+  cl_float nrm2(const cl::CommandQueue &queue, const cl::Buffer &x, cl_uint n)
+  {
+    sumsq_.setArg(0, x);
+    sumsq_.setArg(1, n);
+    sumsq_.setArg(2, dev_);
+    return std::sqrt(sum(queue, sumsq_, 3));
+  }
+
+  cl_float axpbyDot(const cl::CommandQueue &queue, cl_float a, const cl::Buffer &x, cl_float b,
+                    const cl::Buffer &y, const cl::Buffer &z, cl_uint n)
+  {
+    axpbyDot_.setArg(0, a);
+    axpbyDot_.setArg(1, x);
+    axpbyDot_.setArg(2, b);
+    axpbyDot_.setArg(3, y);
+    axpbyDot_.setArg(4, z);
+    axpbyDot_.setArg(5, n);
+    axpbyDot_.setArg(6, dev_);
+    return sum(queue, axpbyDot_, 7);
+  }
+
+  cl_float axpbyNrm2(const cl::CommandQueue &queue, cl_float a, const cl::Buffer &x, cl_float b,
+                     const cl::Buffer &y, cl_uint n)
+  {
+    axpbySumsq_.setArg(0, a);
+    axpbySumsq_.setArg(1, x);
+    axpbySumsq_.setArg(2, b);
+    axpbySumsq_.setArg(3, y);
+    axpbySumsq_.setArg(4, n);
+    axpbySumsq_.setArg(5, dev_);
+    return std::sqrt(sum(queue, axpbySumsq_, 6));
+  }
+
+private:
+  void launch(const cl::CommandQueue &queue, cl::Kernel &kernel)
+  {
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_), cl::NDRange(local_));
+  }
+
+  // The SUM_ARGS start at argument `first`.
+  cl_float sum(const cl::CommandQueue &queue, cl::Kernel &kernel, cl_uint first)
+  {
+    cl_float r;
+    kernel.setArg(first, partial_);
+    kernel.setArg(first + 1, done_);
+    kernel.setArg(first + 2, result_);
+    kernel.setArg(first + 3, (cl_uint) 0);
+    launch(queue, kernel);
+    queue.enqueueReadBuffer(result_, CL_TRUE, 0, sizeof(r), &r);
+    return r;
+  }
+
+  cl::Context context_;
+  cl::Device device_;
+  cl::Program program_;
+  cl::Kernel axpby_, scal_, dot_, sumsq_, axpbyDot_, axpbySumsq_;
+  cl::Buffer partial_, done_, result_;
+  cl_uint dev_;
+  size_t global_, local_;
+};
+
+} // namespace blas1
+
+#endif
@@ -0,0 +1,271 @@
+#define CL_TARGET_OPENCL_VERSION 120
+
+#include "buffer_pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MIN_CLASS 256
+#define FINE_CLASS ((size_t) 1 << 20) // above this, eighth steps
+
+struct entry {
+  cl_mem buf;
+  cl_mem_flags flags;
+  size_t size;            // the size class
+  void *host;             // mapping of a staging buffer, else NULL
+  cl_command_queue queue; // the queue that mapped it
+  int in_use;
+  unsigned long returned; // tick of the last put, for eviction
+};
+
+struct buffer_pool {
+  cl_context context;
+  pthread_mutex_t lock;
+  struct entry *entries;
+  int nentries;
+  int capacity;
+  unsigned long tick;
+  size_t max_alloc;       // smallest CL_DEVICE_MAX_MEM_ALLOC_SIZE of the context
+  struct buffer_pool_stats stats;
+};
+
+// Powers of two up to FINE_CLASS, then eighth steps between powers of
+// two (at most 12.5% over), never past the device's max allocation.
+static size_t
+size_class(const struct buffer_pool *pool, size_t size)
+{
+  size_t c = MIN_CLASS;
+  if(size <= FINE_CLASS) {
+    while(c < size)
+      c <<= 1;
+    return c;
+  }
+  size_t step = FINE_CLASS / 8;
+  while(step * 16 <= size)
+    step <<= 1;
+  c = (size + step - 1) / step * step;
+  if(c > pool->max_alloc && size <= pool->max_alloc)
+    c = pool->max_alloc;
+  return c;
+}
+
+static size_t
+context_max_alloc(cl_context context)
+{
+  cl_device_id devices[16];
+  size_t bytes = 0, max = (size_t) -1;
+  if(clGetContextInfo(context, CL_CONTEXT_DEVICES, sizeof(devices), devices, &bytes) != CL_SUCCESS)
+    return max;
+  for(size_t i = 0; i < bytes / sizeof(cl_device_id); i++) {
+    cl_ulong m;
+    if(clGetDeviceInfo(devices[i], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(m), &m, NULL) == CL_SUCCESS &&
+       m < max)
+      max = (size_t) m;
+  }
+  return max;
+}
+
+struct buffer_pool *
+buffer_pool_create(cl_context context, size_t cap)
+{
+  struct buffer_pool *pool = calloc(1, sizeof(*pool));
+  if(pool == NULL)
+    return NULL;
+  if(cap == 0) {
+    const char *env = getenv("BUFFER_POOL_CAP_MB");
+    if(env)
+      cap = (size_t) strtoull(env, NULL, 0) << 20;
+  }
+  pool->stats.cap = cap;
+  pool->context = context;
+  pool->max_alloc = context_max_alloc(context);
+  clRetainContext(context);
+  pthread_mutex_init(&pool->lock, NULL);
+  return pool;
+}
+
+static void
+release_entry(struct entry *e)
+{
+  if(e->host) {
+    clEnqueueUnmapMemObject(e->queue, e->buf, e->host, 0, NULL, NULL);
+    clFinish(e->queue);
+    clReleaseCommandQueue(e->queue);
+  }
+  clReleaseMemObject(e->buf);
+}
+
+// Drop entry i; the last one takes its place.
+static void
+remove_entry(struct buffer_pool *pool, int i)
+{
+  pool->stats.cached -= pool->entries[i].size;
+  release_entry(&pool->entries[i]);
+  pool->entries[i] = pool->entries[--pool->nentries];
+  pool->stats.evictions++;
+}
+
+void
+buffer_pool_destroy(struct buffer_pool *pool)
+{
+  if(pool == NULL)
+    return;
+  for(int i = 0; i < pool->nentries; i++)
+    release_entry(&pool->entries[i]);
+  free(pool->entries);
+  pthread_mutex_destroy(&pool->lock);
+  clReleaseContext(pool->context);
+  free(pool);
+}
+
+// A free entry of this kind, or -1. Staging buffers also have to be
+// mapped through the same queue.
+static int
+find_free(struct buffer_pool *pool, cl_mem_flags flags, size_t size, cl_command_queue queue)
+{
+  for(int i = 0; i < pool->nentries; i++) {
+    struct entry *e = &pool->entries[i];
+    if(!e->in_use && e->flags == flags && e->size == size && e->queue == queue)
+      return i;
+  }
+  return -1;
+}
+
+// Make room for `size` more bytes under the cap by releasing the least
+// recently returned free buffers. Returns 0 if it fits.
+static int
+make_room(struct buffer_pool *pool, size_t size)
+{
+  if(pool->stats.cap == 0)
+    return 0;
+  while(pool->stats.in_use + pool->stats.cached + size > pool->stats.cap) {
+    int oldest = -1;
+    for(int i = 0; i < pool->nentries; i++)
+      if(!pool->entries[i].in_use &&
+         (oldest < 0 || pool->entries[i].returned < pool->entries[oldest].returned))
+        oldest = i;
+    if(oldest < 0)
+      return -1;
+    remove_entry(pool, oldest);
+  }
+  return 0;
+}
+
+static cl_mem
+get(struct buffer_pool *pool, cl_mem_flags flags, size_t size, cl_command_queue queue,
+    void **host, cl_int *errcode_ret)
+{
+  cl_mem buf = NULL;
+  cl_int ret = CL_SUCCESS;
+
+  if(flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR)) {
+    *errcode_ret = CL_INVALID_VALUE;
+    return NULL;
+  }
+  size = size_class(pool, size);
+
+  pthread_mutex_lock(&pool->lock);
+  int i = find_free(pool, flags, size, queue);
+  if(i >= 0) {
+    struct entry *e = &pool->entries[i];
+    e->in_use = 1;
+    pool->stats.hits++;
+    pool->stats.cached -= size;
+    pool->stats.in_use += size;
+    buf = e->buf;
+    if(host)
+      *host = e->host;
+    goto out;
+  }
+
+  pool->stats.misses++;
+  if(make_room(pool, size) != 0) {
+    ret = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+    goto out;
+  }
+  if(pool->nentries == pool->capacity) {
+    int capacity = pool->capacity ? 2 * pool->capacity : 16;
+    struct entry *entries = realloc(pool->entries, capacity * sizeof(*entries));
+    if(entries == NULL) {
+      ret = CL_OUT_OF_HOST_MEMORY;
+      goto out;
+    }
+    pool->entries = entries;
+    pool->capacity = capacity;
+  }
+
+  struct entry e = { NULL, flags, size, NULL, queue, 1, 0 };
+  e.buf = clCreateBuffer(pool->context, flags, size, NULL, &ret);
+  if(ret != CL_SUCCESS)
+    goto out;
+  if(host) {
+    e.host = clEnqueueMapBuffer(queue, e.buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size,
+                                0, NULL, NULL, &ret);
+    if(ret != CL_SUCCESS) {
+      clReleaseMemObject(e.buf);
+      goto out;
+    }
+    clRetainCommandQueue(queue);
+    *host = e.host;
+  }
+  pool->entries[pool->nentries++] = e;
+  pool->stats.in_use += size;
+  if(pool->stats.in_use + pool->stats.cached > pool->stats.peak)
+    pool->stats.peak = pool->stats.in_use + pool->stats.cached;
+  buf = e.buf;
+ out:
+  pthread_mutex_unlock(&pool->lock);
+  *errcode_ret = ret;
+  return buf;
+}
+
+cl_mem
+buffer_pool_get(struct buffer_pool *pool, cl_mem_flags flags, size_t size, cl_int *errcode_ret)
+{
+  return get(pool, flags, size, NULL, NULL, errcode_ret);
+}
+
+cl_mem
+buffer_pool_get_staging(struct buffer_pool *pool, cl_command_queue queue,
+                        size_t size, void **host, cl_int *errcode_ret)
+{
+  return get(pool, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, queue, host, errcode_ret);
+}
+
+void
+buffer_pool_put(struct buffer_pool *pool, cl_mem buf)
+{
+  pthread_mutex_lock(&pool->lock);
+  for(int i = 0; i < pool->nentries; i++) {
+    struct entry *e = &pool->entries[i];
+    if(e->buf == buf && e->in_use) {
+      e->in_use = 0;
+      e->returned = ++pool->tick;
+      pool->stats.in_use -= e->size;
+      pool->stats.cached += e->size;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void
+buffer_pool_stats(struct buffer_pool *pool, struct buffer_pool_stats *stats)
+{
+  pthread_mutex_lock(&pool->lock);
+  *stats = pool->stats;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void
+buffer_pool_print_stats(struct buffer_pool *pool)
+{
+  struct buffer_pool_stats s;
+  buffer_pool_stats(pool, &s);
+  unsigned long calls = s.hits + s.misses;
+  printf("buffer pool: %lu hits, %lu misses (%.1f%% hit rate), %lu evictions, peak %.1f KB",
+         s.hits, s.misses, calls ? 100.0 * s.hits / calls : 0.0, s.evictions, s.peak / 1024.0);
+  if(s.cap)
+    printf(" of %.1f KB cap", s.cap / 1024.0);
+  printf("\n");
+}
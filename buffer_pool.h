@@ -0,0 +1,66 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <CL/cl.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Recycles device buffers and pinned host staging buffers of one context.
+//
+// Sizes are rounded up to classes: powers of two from 256 bytes to 1 MB,
+// then eighth steps between powers of two (at most 12.5% over), capped
+// at the device's max allocation. A returned buffer goes back on a free
+// list keyed by (flags, class) instead of being released, so repeated
+// calls skip clCreateBuffer and the driver's zero-fill. Contents of a
+// recycled buffer are undefined.
+//
+// The pool holds at most `cap` bytes in use plus cached; a miss first
+// releases least recently returned buffers to make room and fails with
+// CL_MEM_OBJECT_ALLOCATION_FAILURE if that is not enough. A cap of 0
+// reads $BUFFER_POOL_CAP_MB, unlimited if unset. Thread-safe.
+
+struct buffer_pool;
+
+struct buffer_pool_stats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  size_t in_use;        // bytes handed out
+  size_t cached;        // bytes on the free lists
+  size_t peak;          // max of in_use + cached
+  size_t cap;           // 0 if unlimited
+};
+
+// Retains the context until buffer_pool_destroy().
+struct buffer_pool *buffer_pool_create(cl_context context, size_t cap);
+// Releases every buffer, including ones still handed out.
+void buffer_pool_destroy(struct buffer_pool *pool);
+
+// A buffer of at least `size` bytes. Flags with a host pointer
+// (CL_MEM_USE_HOST_PTR, CL_MEM_COPY_HOST_PTR) are rejected.
+cl_mem buffer_pool_get(struct buffer_pool *pool, cl_mem_flags flags, size_t size,
+                       cl_int *errcode_ret);
+
+// A CL_MEM_ALLOC_HOST_PTR buffer of at least `size` bytes, mapped for
+// reading and writing through `queue` for as long as it is in the pool.
+// *host is the mapping: the source or destination of clEnqueueRead/Write
+// on other buffers, pinned where the driver supports it.
+cl_mem buffer_pool_get_staging(struct buffer_pool *pool, cl_command_queue queue,
+                               size_t size, void **host, cl_int *errcode_ret);
+
+// Hand a buffer from either get back. Commands using it must be finished
+// or ordered before later users of the buffer on the same queue.
+void buffer_pool_put(struct buffer_pool *pool, cl_mem buf);
+
+void buffer_pool_stats(struct buffer_pool *pool, struct buffer_pool_stats *stats);
+// One line: hits, misses, hit rate, peak and cap.
+void buffer_pool_print_stats(struct buffer_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,136 @@
+#define CL_TARGET_OPENCL_VERSION 120
+
+#include "dataset.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int
+dataset_open(struct dataset *ds, const char *path, size_t elem_size)
+{
+  struct stat st;
+  int fd;
+
+  memset(ds, 0, sizeof(*ds));
+  if((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+    printf("%s: %s\n", path, strerror(errno));
+    if(fd != -1)
+      close(fd);
+    return -1;
+  }
+  if(st.st_size == 0) {
+    printf("%s: empty\n", path);
+    close(fd);
+    return -1;
+  }
+
+  // Private and writable, so that a USE_HOST_PTR buffer may be pinned or
+  // written back without touching the file; pages are copied only if
+  // written.
+  ds->map_size = st.st_size;
+  ds->map = mmap(NULL, ds->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(ds->map == MAP_FAILED) {
+    printf("%s: mmap: %s\n", path, strerror(errno));
+    ds->map = NULL;
+    return -1;
+  }
+  madvise(ds->map, ds->map_size, MADV_SEQUENTIAL);
+
+  struct dataset_header h;
+  size_t offset = 0, count = ds->map_size / elem_size;
+  if(ds->map_size >= sizeof(h) && memcmp(ds->map, DATASET_MAGIC, 4) == 0) {
+    memcpy(&h, ds->map, sizeof(h));
+    if(h.elem_size != elem_size || h.offset < sizeof(h) || h.offset > ds->map_size ||
+       h.count > (ds->map_size - h.offset) / elem_size) {
+      printf("%s: bad header (%u-byte elements, %llu at %llu; want %zu-byte)\n", path,
+             h.elem_size, (unsigned long long) h.count, (unsigned long long) h.offset, elem_size);
+      dataset_close(ds);
+      return -1;
+    }
+    ds->headered = 1;
+    offset = h.offset;
+    count = h.count;
+  }
+  else if(ds->map_size % elem_size != 0) {
+    printf("%s: %zu bytes is not a whole number of %zu-byte elements\n", path,
+           ds->map_size, elem_size);
+    dataset_close(ds);
+    return -1;
+  }
+  ds->data = (char *) ds->map + offset;
+  ds->count = count;
+  ds->elem_size = elem_size;
+  return 0;
+}
+
+void
+dataset_close(struct dataset *ds)
+{
+  if(ds->map != NULL)
+    munmap(ds->map, ds->map_size);
+  memset(ds, 0, sizeof(*ds));
+}
+
+int
+dataset_aligned(const struct dataset *ds)
+{
+  return ((uintptr_t) ds->data % DATASET_ALIGN) == 0;
+}
+
+size_t
+dataset_bytes(const struct dataset *ds)
+{
+  return ds->count * ds->elem_size;
+}
+
+cl_mem
+dataset_create_buffer(const struct dataset *ds, cl_context context,
+                      cl_mem_flags flags, cl_int *errcode_ret)
+{
+  return clCreateBuffer(context, flags | CL_MEM_USE_HOST_PTR, dataset_bytes(ds), ds->data,
+                        errcode_ret);
+}
+
+cl_int
+dataset_upload(const struct dataset *ds, cl_command_queue queue, cl_mem buf, size_t chunk)
+{
+  size_t bytes = dataset_bytes(ds);
+  cl_int ret = CL_SUCCESS;
+
+  if(chunk == 0)
+    chunk = DATASET_CHUNK;
+  for(size_t off = 0; off < bytes && ret == CL_SUCCESS; off += chunk) {
+    size_t n = bytes - off < chunk ? bytes - off : chunk;
+    ret = clEnqueueWriteBuffer(queue, buf, CL_FALSE, off, n, (const char *) ds->data + off,
+                               0, NULL, NULL);
+  }
+  // The mapping must outlive the writes either way.
+  cl_int fin = clFinish(queue);
+  return ret != CL_SUCCESS ? ret : fin;
+}
+
+int
+dataset_write(const char *path, const void *data, size_t elem_size, size_t count)
+{
+  struct dataset_header h;
+  static const char pad[DATASET_ALIGN];
+  FILE *fp = fopen(path, "wb");
+  if(fp == NULL)
+    return -1;
+
+  memcpy(h.magic, DATASET_MAGIC, 4);
+  h.elem_size = (uint32_t) elem_size;
+  h.count = count;
+  h.offset = DATASET_ALIGN;
+  int ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+           fwrite(pad, 1, DATASET_ALIGN - sizeof(h), fp) == DATASET_ALIGN - sizeof(h) &&
+           fwrite(data, elem_size, count, fp) == count;
+  if(fclose(fp) != 0)
+    ok = 0;
+  return ok ? 0 : -1;
+}
@@ -0,0 +1,77 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <CL/cl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Memory-mapped input files, handed to the device without a host copy.
+//
+// A dataset is either raw (the whole file is elements) or starts with a
+// struct dataset_header; dataset_write() puts the data of a headered
+// file at DATASET_ALIGN, so in both cases the mapped data is page-aligned
+// and can back a CL_MEM_USE_HOST_PTR buffer as is. The mapping is
+// private and advised MADV_SEQUENTIAL; nothing is read until the device
+// or the host touches it.
+//
+//   struct dataset ds;
+//   dataset_open(&ds, "input.bin", sizeof(cl_uint));
+//   cl_mem buf = dataset_create_buffer(&ds, context, CL_MEM_READ_ONLY, &ret);
+//   ... or clCreateBuffer() plus dataset_upload(&ds, queue, buf, 0) ...
+//   dataset_close(&ds);   // after the buffer is released
+
+#define DATASET_MAGIC "CLDS"
+#define DATASET_ALIGN 4096
+#define DATASET_CHUNK ((size_t) 16 << 20) // default upload chunk
+
+struct dataset_header {
+  char magic[4];       // DATASET_MAGIC
+  uint32_t elem_size;  // bytes per element
+  uint64_t count;      // elements
+  uint64_t offset;     // of the data from the start of the file
+};
+
+struct dataset {
+  void *map;           // the whole file
+  size_t map_size;
+  void *data;          // the first element
+  size_t count;
+  size_t elem_size;
+  int headered;
+};
+
+// Maps `path`; returns 0 on success and -1 with a message printed on
+// error. A headered file must have elements of elem_size bytes; a raw
+// file must be a whole number of them.
+int dataset_open(struct dataset *ds, const char *path, size_t elem_size);
+void dataset_close(struct dataset *ds);
+
+// Non-zero when the data starts on a page boundary (zero-copy capable).
+int dataset_aligned(const struct dataset *ds);
+
+// count * elem_size.
+size_t dataset_bytes(const struct dataset *ds);
+
+// A buffer over the mapped data, CL_MEM_USE_HOST_PTR | flags. The
+// dataset must stay open while the buffer lives.
+cl_mem dataset_create_buffer(const struct dataset *ds, cl_context context,
+                             cl_mem_flags flags, cl_int *errcode_ret);
+
+// Writes the data into `buf` straight from the mapping in non-blocking
+// chunks of `chunk` bytes (DATASET_CHUNK if 0), so the page faults of one
+// chunk overlap the transfer of the previous; returns after clFinish.
+cl_int dataset_upload(const struct dataset *ds, cl_command_queue queue, cl_mem buf,
+                      size_t chunk);
+
+// Writes a headered dataset; returns 0 on success.
+int dataset_write(const char *path, const void *data, size_t elem_size, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
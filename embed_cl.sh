@@ -0,0 +1,73 @@
+#!/bin/sh
+# Embeds OpenCL C sources in the programs that use them, so they need no
+# .cl file at run time.
+#
+#   sh embed_cl.sh [-s] [file.cl ...]     (default: every *.cl here)
+#
+# Writes NAME_cl.h next to each NAME.cl with
+#
+#   static const char NAME_cl[];            the source, NUL-terminated
+#
+# and with -s also compiles it offline to SPIR-V (clang, then
+# llvm-spirv) and adds
+#
+#   #define NAME_SPV 1
+#   static const unsigned char NAME_spv[];  the module, NAME_spv_size bytes
+#
+# for program_cache_build_il(), which program_cache.c and its users
+# only have when built with -DPROGRAM_CACHE_IL (OpenCL 2.1).
+#
+# $CLANG, $LLVM_SPIRV, $SPIRV_TARGET (spir64) and $SPIRV_STD (CL2.0)
+# override the defaults.
+
+set -e
+
+spirv=0
+if [ "$1" = "-s" ]; then
+  spirv=1
+  shift
+fi
+[ $# -gt 0 ] || set -- *.cl
+
+CLANG=${CLANG:-clang}
+LLVM_SPIRV=${LLVM_SPIRV:-llvm-spirv}
+SPIRV_TARGET=${SPIRV_TARGET:-spir64}
+SPIRV_STD=${SPIRV_STD:-CL2.0}
+
+for src in "$@"; do
+  base=${src%.cl}
+  name=$(basename "$base" | tr -c 'A-Za-z0-9_\n' '_')
+  guard=$(echo "$name" | tr 'a-z' 'A-Z')_CL_H
+  out=${base}_cl.h
+  tmp=$out.$$.tmp
+
+  {
+    echo "// Generated by embed_cl.sh from $(basename "$src"); do not edit."
+    echo "#ifndef $guard"
+    echo "#define $guard"
+    echo
+    echo "static const char ${name}_cl[] ="
+    sed -e 's/\\/\\\\/g' -e 's/"/\\"/g' -e 's/^/  "/' -e 's/$/\\n"/' "$src"
+    echo "  ;"
+  } > "$tmp"
+
+  if [ $spirv = 1 ]; then
+    "$CLANG" -c -cl-std="$SPIRV_STD" -target "$SPIRV_TARGET" -O2 -emit-llvm \
+      -o "$base.bc" "$src"
+    "$LLVM_SPIRV" "$base.bc" -o "$base.spv"
+    rm -f "$base.bc"
+    {
+      echo
+      echo "#define $(echo "$name" | tr 'a-z' 'A-Z')_SPV 1"
+      echo "static const unsigned char ${name}_spv[] = {"
+      od -An -v -tx1 "$base.spv" | sed -e 's/ *\([0-9a-f][0-9a-f]\)/0x\1, /g' -e 's/^/  /' -e 's/ *$//'
+      echo "};"
+      echo "static const size_t ${name}_spv_size = sizeof(${name}_spv);"
+    } >> "$tmp"
+  fi
+
+  echo >> "$tmp"
+  echo "#endif" >> "$tmp"
+  mv "$tmp" "$out"
+  echo "$src -> $out"
+done
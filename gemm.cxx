@@ -0,0 +1,365 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+
+#include <CL/opencl.hpp>
+#include "program_cache.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+////////////////////////////////////////////////////////////////
+// SGEMV and SGEMM, saxpy taken to level 2 and 3.
+//
+//   y = alpha * A x + beta * y    A is M x K
+//   C = alpha * A B + beta * C    A is M x K, B is K x N
+//
+// All matrices are row-major. Both kernels are checked against a host
+// reference and timed in GFLOP/s.
+//
+//   ./gemm [-m M] [-n N] [-k K] [-t TS] [-w WPT] [-l LX] [-r ROWS]
+////////////////////////////////////////////////////////////////
+
+#define NLOOPS 10
+
+////////////////////////////////////////////////////////////////
+// Globals
+////////////////////////////////////////////////////////////////
+cl_uint M = 1024, N = 1024, K = 1024;
+// Tile sizes, baked into the program with -D.
+cl_uint TS = 32, WPT = 8;     // sgemm: TS x TS tiles, WPT rows per work-item
+cl_uint LX = 32, ROWS = 8;    // sgemv: LX work-items per row, ROWS rows per group
+const cl_float alpha = 1.f, beta = .5f;
+
+std::vector<cl_float> hA, hB, hC, hX, hY;
+
+std::vector<cl::Platform> platforms;
+cl::Context context;
+std::vector<cl::Device> devices;
+cl::CommandQueue queue;
+cl::Program program;
+
+////////////////////////////////////////////////////////////////
+// The kernels
+////////////////////////////////////////////////////////////////
+// sgemm: a TS x TS tile of C per work-group of TS x TS / WPT work-items.
+// Each step stages a TS x TS tile of A and of B in local memory (loads
+// coalesced along rows); each work-item keeps WPT results of one column
+// in registers, TS / WPT rows apart, and reads one B value per k for all
+// of them. Edges are zero-padded, so any M, N and K work.
+//
+// sgemv: ROWS rows per work-group, LX work-items striding each row
+// (coalesced), with each LX-wide chunk of x staged once in local memory
+// for all ROWS rows; the LX partial sums of a row end in a local tree.
+string kernelStr =
+  "#define RTS (TS / WPT)\n"
+  "\n"
+  "__kernel __attribute__((reqd_work_group_size(TS, RTS, 1)))\n"
+  "void sgemm(const uint M, const uint N, const uint K, const float alpha,\n"
+  "           __global const float *A, __global const float *B,\n"
+  "           const float beta, __global float *C)\n"
+  "{\n"
+  "  const uint tx = get_local_id(0), ty = get_local_id(1);\n"
+  "  const uint col = get_group_id(0) * TS + tx;\n"
+  "  const uint row = get_group_id(1) * TS + ty;\n"
+  "  __local float As[TS][TS], Bs[TS][TS];\n"
+  "  float acc[WPT];\n"
+  "  for(uint w = 0; w < WPT; w++)\n"
+  "    acc[w] = 0.f;\n"
+  "\n"
+  "  for(uint t = 0; t < K; t += TS) {\n"
+  "    for(uint w = 0; w < WPT; w++) {\n"
+  "      uint r = row + w * RTS, ka = t + tx, kb = t + ty + w * RTS;\n"
+  "      As[ty + w * RTS][tx] = r < M && ka < K ? A[r * K + ka] : 0.f;\n"
+  "      Bs[ty + w * RTS][tx] = kb < K && col < N ? B[kb * N + col] : 0.f;\n"
+  "    }\n"
+  "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "#pragma unroll\n"
+  "    for(uint k = 0; k < TS; k++) {\n"
+  "      float b = Bs[k][tx];\n"
+  "      for(uint w = 0; w < WPT; w++)\n"
+  "        acc[w] = mad(As[ty + w * RTS][k], b, acc[w]);\n"
+  "    }\n"
+  "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "  }\n"
+  "\n"
+  "  for(uint w = 0; w < WPT; w++) {\n"
+  "    uint r = row + w * RTS;\n"
+  "    if(r < M && col < N)\n"
+  "      C[r * N + col] = beta == 0.f ? alpha * acc[w]\n"
+  "                                   : alpha * acc[w] + beta * C[r * N + col];\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "__kernel __attribute__((reqd_work_group_size(LX, ROWS, 1)))\n"
+  "void sgemv(const uint M, const uint K, const float alpha,\n"
+  "           __global const float *A, __global const float *x,\n"
+  "           const float beta, __global float *y)\n"
+  "{\n"
+  "  const uint lx = get_local_id(0), ly = get_local_id(1);\n"
+  "  const uint row = get_group_id(1) * ROWS + ly;\n"
+  "  __local float xs[LX];\n"
+  "  __local float part[ROWS][LX];\n"
+  "  float acc = 0.f;\n"
+  "\n"
+  "  for(uint t = 0; t < K; t += LX) {\n"
+  "    if(ly == 0)\n"
+  "      xs[lx] = t + lx < K ? x[t + lx] : 0.f;\n"
+  "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "    if(row < M && t + lx < K)\n"
+  "      acc = mad(A[row * K + t + lx], xs[lx], acc);\n"
+  "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "  }\n"
+  "\n"
+  "  part[ly][lx] = acc;\n"
+  "  barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "  for(uint s = LX / 2; s > 0; s >>= 1) {\n"
+  "    if(lx < s)\n"
+  "      part[ly][lx] += part[ly][lx + s];\n"
+  "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "  }\n"
+  "  if(lx == 0 && row < M)\n"
+  "    y[row] = beta == 0.f ? alpha * part[ly][0] : alpha * part[ly][0] + beta * y[row];\n"
+  "}\n";
+
+////////////////////////////////////////////////////////////////
+// Quick & dirty MWC random init, in [-1, 1)
+////////////////////////////////////////////////////////////////
+void fill(std::vector<cl_float> &v, size_t n, cl_uint seed)
+{
+  cl_uint a = seed, b = seed;
+  v.resize(n);
+  for(size_t i = 0; i < n; i++)
+    {
+      b = (a * (b & 65535)) + (b >> 16);
+      v[i] = (cl_float) (b & 0xffff) / 32768.f - 1.f;
+    }
+}
+
+void initHost()
+{
+  fill(hA, (size_t) M * K, 0x1234);
+  fill(hB, (size_t) K * N, 0x5678);
+  fill(hC, (size_t) M * N, 0x9abc);
+  fill(hX, K, 0xdef0);
+  fill(hY, M, 0x4321);
+}
+
+////////////////////////////////////////////////////////////////
+// Host references, accumulated in double. Each result is accepted
+// within K float roundings of the sum of the magnitudes of its terms.
+////////////////////////////////////////////////////////////////
+bool checkGemv(const std::vector<cl_float> &y)
+{
+  for(cl_uint i = 0; i < M; i++)
+    {
+      double sum = 0, mag = 0;
+      for(cl_uint k = 0; k < K; k++)
+        {
+          double p = (double) hA[(size_t) i * K + k] * hX[k];
+          sum += p;
+          mag += std::fabs(p);
+        }
+      double expect = alpha * sum + beta * hY[i];
+      double tol = K * 1.2e-7 * (std::fabs(alpha) * mag + std::fabs(beta * hY[i])) + 1e-6;
+      if(std::fabs(y[i] - expect) > tol)
+        return false;
+    }
+  return true;
+}
+
+bool checkGemm(const std::vector<cl_float> &c)
+{
+  std::vector<double> sum(N), mag(N);
+  for(cl_uint i = 0; i < M; i++)
+    {
+      std::fill(sum.begin(), sum.end(), 0.);
+      std::fill(mag.begin(), mag.end(), 0.);
+      for(cl_uint k = 0; k < K; k++)
+        {
+          double a = hA[(size_t) i * K + k];
+          const cl_float *b = &hB[(size_t) k * N];
+          for(cl_uint j = 0; j < N; j++)
+            {
+              sum[j] += a * b[j];
+              mag[j] += std::fabs(a * b[j]);
+            }
+        }
+      for(cl_uint j = 0; j < N; j++)
+        {
+          double old = hC[(size_t) i * N + j];
+          double expect = alpha * sum[j] + beta * old;
+          double tol = K * 1.2e-7 * (std::fabs(alpha) * mag[j] + std::fabs(beta * old)) + 1e-6;
+          if(std::fabs(c[(size_t) i * N + j] - expect) > tol)
+            return false;
+        }
+    }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////
+// Seconds per launch over NLOOPS launches, after one warm-up
+////////////////////////////////////////////////////////////////
+double timeKernel(cl::Kernel &kernel, const cl::NDRange &global, const cl::NDRange &local)
+{
+  queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local);
+  queue.finish();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(int i = 0; i < NLOOPS; i++)
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local);
+  queue.finish();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / NLOOPS;
+}
+
+cl_uint roundUp(cl_uint n, cl_uint m)
+{
+  return (n + m - 1) / m * m;
+}
+
+int main(int argc, char * argv[])
+{
+  try
+    {
+      for(int i = 1; i + 1 < argc; i += 2)
+        {
+          cl_uint v = (cl_uint) strtoul(argv[i + 1], NULL, 0);
+          if(!strcmp(argv[i], "-m"))      M = v;
+          else if(!strcmp(argv[i], "-n")) N = v;
+          else if(!strcmp(argv[i], "-k")) K = v;
+          else if(!strcmp(argv[i], "-t")) TS = v;
+          else if(!strcmp(argv[i], "-w")) WPT = v;
+          else if(!strcmp(argv[i], "-l")) LX = v;
+          else if(!strcmp(argv[i], "-r")) ROWS = v;
+          else
+            throw(string("usage: gemm [-m M] [-n N] [-k K] [-t TS] [-w WPT] [-l LX] [-r ROWS]"));
+        }
+      if(M == 0 || N == 0 || K == 0)
+        throw(string("M, N and K must be positive"));
+      if(TS == 0 || WPT == 0 || TS % WPT != 0)
+        throw(string("-w must divide -t"));
+      if(LX == 0 || (LX & (LX - 1)) || ROWS == 0)
+        throw(string("-l must be a power of 2 and -r positive"));
+      if((double) M * K >= 4294967296.0 || (double) K * N >= 4294967296.0 ||
+         (double) M * N >= 4294967296.0)
+        throw(string("each matrix must have fewer than 2^32 elements"));
+
+      ////////////////////////////////////////////////////////////////
+      // Allocate and initialize memory on the host
+      ////////////////////////////////////////////////////////////////
+      initHost();
+
+      ////////////////////////////////////////////////////////////////
+      // Create an OpenCL context, as saxpy does
+      ////////////////////////////////////////////////////////////////
+      cl::Platform::get(&platforms);
+      std::vector<cl::Platform>::iterator iter;
+      for(iter = platforms.begin(); iter != platforms.end(); ++iter)
+        if(!strcmp((*iter).getInfo<CL_PLATFORM_VENDOR>().c_str(), "Advanced Micro Devices, Inc."))
+          break;
+      if(iter == platforms.end())
+        iter = platforms.begin();
+      cl_context_properties cps[3] = {CL_CONTEXT_PLATFORM, (cl_context_properties)(*iter)(), 0};
+      try
+        {
+          context = cl::Context(CL_DEVICE_TYPE_GPU, cps);
+        }
+      catch(cl::Error &err)
+        {
+          if(err.err() != CL_DEVICE_NOT_FOUND)
+            throw;
+          context = cl::Context(CL_DEVICE_TYPE_ALL, cps);
+        }
+      devices = context.getInfo<CL_CONTEXT_DEVICES>();
+      queue = cl::CommandQueue(context, devices[0]);
+      cout << devices[0].getInfo<CL_DEVICE_NAME>() << ": M " << M << " N " << N << " K " << K << endl;
+
+      ////////////////////////////////////////////////////////////////
+      // Build with the tile sizes baked in
+      ////////////////////////////////////////////////////////////////
+      string opts = "-DTS=" + std::to_string(TS) + " -DWPT=" + std::to_string(WPT) +
+        " -DLX=" + std::to_string(LX) + " -DROWS=" + std::to_string(ROWS);
+      cl_int err;
+      program = cl::Program(program_cache_build(context(), devices[0](), kernelStr.c_str(),
+                                                opts.c_str(), &err));
+      if(err != CL_SUCCESS)
+        throw cl::Error(err, "program_cache_build");
+      cl::Kernel gemm(program, "sgemm"), gemv(program, "sgemv");
+      size_t maxLocal = devices[0].getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+      if(TS * (TS / WPT) > maxLocal || LX * ROWS > maxLocal)
+        throw(string("work-group too large for the device: lower -t, -l or -r, or raise -w"));
+
+      ////////////////////////////////////////////////////////////////
+      // Buffers and arguments
+      ////////////////////////////////////////////////////////////////
+      cl::Buffer bufA(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, hA.size() * sizeof(cl_float), hA.data());
+      cl::Buffer bufB(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, hB.size() * sizeof(cl_float), hB.data());
+      cl::Buffer bufC(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, hC.size() * sizeof(cl_float), hC.data());
+      cl::Buffer bufX(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, hX.size() * sizeof(cl_float), hX.data());
+      cl::Buffer bufY(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, hY.size() * sizeof(cl_float), hY.data());
+
+      gemm.setArg(0, M);
+      gemm.setArg(1, N);
+      gemm.setArg(2, K);
+      gemm.setArg(3, alpha);
+      gemm.setArg(4, bufA);
+      gemm.setArg(5, bufB);
+      gemm.setArg(6, beta);
+      gemm.setArg(7, bufC);
+      cl::NDRange gemmGlobal(roundUp(N, TS), roundUp(M, TS) / WPT), gemmLocal(TS, TS / WPT);
+
+      gemv.setArg(0, M);
+      gemv.setArg(1, K);
+      gemv.setArg(2, alpha);
+      gemv.setArg(3, bufA);
+      gemv.setArg(4, bufX);
+      gemv.setArg(5, beta);
+      gemv.setArg(6, bufY);
+      cl::NDRange gemvGlobal(LX, roundUp(M, ROWS)), gemvLocal(LX, ROWS);
+
+      ////////////////////////////////////////////////////////////////
+      // One checked launch each, from the initial C and y
+      ////////////////////////////////////////////////////////////////
+      std::vector<cl_float> y(M), c((size_t) M * N);
+      queue.enqueueNDRangeKernel(gemv, cl::NullRange, gemvGlobal, gemvLocal);
+      queue.enqueueReadBuffer(bufY, CL_TRUE, 0, y.size() * sizeof(cl_float), y.data());
+      queue.enqueueNDRangeKernel(gemm, cl::NullRange, gemmGlobal, gemmLocal);
+      queue.enqueueReadBuffer(bufC, CL_TRUE, 0, c.size() * sizeof(cl_float), c.data());
+      bool gemvOk = checkGemv(y), gemmOk = checkGemm(c);
+
+      ////////////////////////////////////////////////////////////////
+      // Timing; y and C keep accumulating, which does not change the work
+      ////////////////////////////////////////////////////////////////
+      double gemvTime = timeKernel(gemv, gemvGlobal, gemvLocal);
+      double gemmTime = timeKernel(gemm, gemmGlobal, gemmLocal);
+      cout << "sgemv (LX " << LX << ", ROWS " << ROWS << "): " << gemvTime * 1e3 << " ms, "
+           << 2.0 * M * K / gemvTime / 1e9 << " GFLOP/sec, B/W "
+           << ((double) M * K + K + 2.0 * M) * sizeof(cl_float) / gemvTime / 1e9 << " GB/sec, result "
+           << (gemvOk ? "correct" : "INcorrect") << endl;
+      cout << "sgemm (TS " << TS << ", WPT " << WPT << "): " << gemmTime * 1e3 << " ms, "
+           << 2.0 * M * N * K / gemmTime / 1e9 << " GFLOP/sec, result "
+           << (gemmOk ? "correct" : "INcorrect") << endl;
+      return gemvOk && gemmOk ? 0 : 1;
+    }
+  catch(cl::Error &err)
+    {
+      ////////////////////////////////////////////////////////////////
+      // Catch OpenCL errors and print log if it is a build error
+      ////////////////////////////////////////////////////////////////
+      cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << endl;
+      if(err.err() == CL_BUILD_PROGRAM_FAILURE)
+        cout << "Program Info: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]) << endl;
+    }
+  catch(string msg)
+    {
+      cerr << "Exception caught in main(): " << msg << endl;
+    }
+  return 1;
+}
@@ -0,0 +1,255 @@
+#define CL_TARGET_OPENCL_VERSION 120
+
+#include "generate.h"
+#include "program_cache.h"
+#include <string.h>
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+// The float conversions are exact (24 bits, or int to float with
+// round-to-nearest-even on both sides), so no build options are needed.
+static const char *source =
+  "#define PHILOX_M0 " XSTR(PHILOX_M0) "\n"
+  "#define PHILOX_M1 " XSTR(PHILOX_M1) "\n"
+  "#define PHILOX_W0 " XSTR(PHILOX_W0) "\n"
+  "#define PHILOX_W1 " XSTR(PHILOX_W1) "\n"
+  "#define PHILOX_ROUNDS " XSTR(PHILOX_ROUNDS) "\n"
+  "\n"
+  "kernel void iota_uint(global uint *dst, uint start, int step, uint n)\n"
+  "{\n"
+  "  uint gid = get_global_id(0);\n"
+  "  if(gid < n)\n"
+  "    dst[gid] = start + (uint) step * gid;\n"
+  "}\n"
+  "\n"
+  "kernel void iota_float(global float *dst, int start, int step, uint n)\n"
+  "{\n"
+  "  uint gid = get_global_id(0);\n"
+  "  if(gid < n)\n"
+  "    dst[gid] = (float) (int) ((uint) start + (uint) step * gid);\n"
+  "}\n"
+  "\n"
+  "uint4 philox(uint4 ctr, uint2 key)\n"
+  "{\n"
+  "  for(int r = 0; r < PHILOX_ROUNDS; r++) {\n"
+  "    if(r > 0)\n"
+  "      key += (uint2) (PHILOX_W0, PHILOX_W1);\n"
+  "    uint hi0 = mul_hi(PHILOX_M0, ctr.x), lo0 = PHILOX_M0 * ctr.x;\n"
+  "    uint hi1 = mul_hi(PHILOX_M1, ctr.z), lo1 = PHILOX_M1 * ctr.z;\n"
+  "    ctr = (uint4) (hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);\n"
+  "  }\n"
+  "  return ctr;\n"
+  "}\n"
+  "\n"
+  "// One block of four per work-item.\n"
+  "kernel void philox_uint(global uint *dst, uint2 key, uint n)\n"
+  "{\n"
+  "  uint gid = get_global_id(0);\n"
+  "  uint4 r = philox((uint4) (gid, 0, 0, 0), key);\n"
+  "  uint i = gid * 4;\n"
+  "  if(i + 4 <= n)\n"
+  "    vstore4(r, gid, dst);\n"
+  "  else {\n"
+  "    if(i < n)     dst[i]     = r.x;\n"
+  "    if(i + 1 < n) dst[i + 1] = r.y;\n"
+  "    if(i + 2 < n) dst[i + 2] = r.z;\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "kernel void philox_float(global float *dst, uint2 key, uint n)\n"
+  "{\n"
+  "  uint gid = get_global_id(0);\n"
+  "  float4 r = convert_float4(philox((uint4) (gid, 0, 0, 0), key) >> 8) * 0x1p-24f;\n"
+  "  uint i = gid * 4;\n"
+  "  if(i + 4 <= n)\n"
+  "    vstore4(r, gid, dst);\n"
+  "  else {\n"
+  "    if(i < n)     dst[i]     = r.x;\n"
+  "    if(i + 1 < n) dst[i + 1] = r.y;\n"
+  "    if(i + 2 < n) dst[i + 2] = r.z;\n"
+  "  }\n"
+  "}\n";
+
+cl_int
+generator_create(struct generator *gen, cl_context context, cl_device_id device)
+{
+  cl_int ret;
+
+  memset(gen, 0, sizeof(*gen));
+  gen->program = program_cache_build(context, device, source, NULL, &ret);
+  if(ret != CL_SUCCESS) {
+    generator_release(gen);
+    return ret;
+  }
+  gen->iota_uint = clCreateKernel(gen->program, "iota_uint", &ret);
+  if(ret == CL_SUCCESS)
+    gen->iota_float = clCreateKernel(gen->program, "iota_float", &ret);
+  if(ret == CL_SUCCESS)
+    gen->philox_uint = clCreateKernel(gen->program, "philox_uint", &ret);
+  if(ret == CL_SUCCESS)
+    gen->philox_float = clCreateKernel(gen->program, "philox_float", &ret);
+  if(ret != CL_SUCCESS)
+    generator_release(gen);
+  return ret;
+}
+
+void
+generator_release(struct generator *gen)
+{
+  if(gen->iota_uint)    clReleaseKernel(gen->iota_uint);
+  if(gen->iota_float)   clReleaseKernel(gen->iota_float);
+  if(gen->philox_uint)  clReleaseKernel(gen->philox_uint);
+  if(gen->philox_float) clReleaseKernel(gen->philox_float);
+  if(gen->program)      clReleaseProgram(gen->program);
+  memset(gen, 0, sizeof(*gen));
+}
+
+// Launch with `items` work-items; the implementation picks the local size.
+static cl_int
+launch(cl_command_queue queue, cl_kernel kernel, size_t items, cl_event *ev)
+{
+  if(items == 0)
+    return CL_SUCCESS;
+  return clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &items, NULL, 0, NULL, ev);
+}
+
+static cl_int
+iota(cl_kernel kernel, cl_command_queue queue, cl_mem dst, size_t n,
+     cl_uint start, cl_int step, cl_event *ev)
+{
+  cl_uint count = (cl_uint) n;
+  cl_int ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dst);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(kernel, 1, sizeof(cl_uint), &start);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(kernel, 2, sizeof(cl_int), &step);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(kernel, 3, sizeof(cl_uint), &count);
+  if(ret == CL_SUCCESS)
+    ret = launch(queue, kernel, n, ev);
+  return ret;
+}
+
+cl_int
+generate_iota_uint(struct generator *gen, cl_command_queue queue, cl_mem dst,
+                   size_t n, cl_uint start, cl_int step, cl_event *ev)
+{
+  return iota(gen->iota_uint, queue, dst, n, start, step, ev);
+}
+
+cl_int
+generate_iota_float(struct generator *gen, cl_command_queue queue, cl_mem dst,
+                    size_t n, cl_int start, cl_int step, cl_event *ev)
+{
+  return iota(gen->iota_float, queue, dst, n, (cl_uint) start, step, ev);
+}
+
+cl_int
+generate_constant(cl_command_queue queue, cl_mem dst, const void *pattern,
+                  size_t pattern_size, size_t n, cl_event *ev)
+{
+  return clEnqueueFillBuffer(queue, dst, pattern, pattern_size, 0, n * pattern_size,
+                             0, NULL, ev);
+}
+
+static cl_int
+philox(cl_kernel kernel, cl_command_queue queue, cl_mem dst, size_t n,
+       uint64_t seed, cl_event *ev)
+{
+  cl_uint key[2] = { (cl_uint) seed, (cl_uint) (seed >> 32) };
+  cl_uint count = (cl_uint) n;
+  cl_int ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dst);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(kernel, 1, sizeof(key), key);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(kernel, 2, sizeof(cl_uint), &count);
+  if(ret == CL_SUCCESS)
+    ret = launch(queue, kernel, (n + 3) / 4, ev);
+  return ret;
+}
+
+cl_int
+generate_philox_uint(struct generator *gen, cl_command_queue queue, cl_mem dst,
+                     size_t n, uint64_t seed, cl_event *ev)
+{
+  return philox(gen->philox_uint, queue, dst, n, seed, ev);
+}
+
+cl_int
+generate_philox_float(struct generator *gen, cl_command_queue queue, cl_mem dst,
+                      size_t n, uint64_t seed, cl_event *ev)
+{
+  return philox(gen->philox_float, queue, dst, n, seed, ev);
+}
+
+// Host versions, operation for operation the same as the kernels.
+
+void
+generate_iota_uint_host(cl_uint *dst, size_t n, cl_uint start, cl_int step)
+{
+  for(size_t i = 0; i < n; i++)
+    dst[i] = start + (cl_uint) step * (cl_uint) i;
+}
+
+void
+generate_iota_float_host(cl_float *dst, size_t n, cl_int start, cl_int step)
+{
+  for(size_t i = 0; i < n; i++)
+    dst[i] = (cl_float) (cl_int) ((cl_uint) start + (cl_uint) step * (cl_uint) i);
+}
+
+void
+generate_constant_host(void *dst, const void *pattern, size_t pattern_size, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+    memcpy((char *) dst + i * pattern_size, pattern, pattern_size);
+}
+
+static void
+philox_host(cl_uint ctr[4], uint64_t seed)
+{
+  cl_uint k0 = (cl_uint) seed, k1 = (cl_uint) (seed >> 32);
+  for(int r = 0; r < PHILOX_ROUNDS; r++) {
+    if(r > 0) {
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+    uint64_t p0 = (uint64_t) PHILOX_M0 * ctr[0];
+    uint64_t p1 = (uint64_t) PHILOX_M1 * ctr[2];
+    cl_uint y0 = (cl_uint) (p1 >> 32) ^ ctr[1] ^ k0;
+    cl_uint y2 = (cl_uint) (p0 >> 32) ^ ctr[3] ^ k1;
+    ctr[0] = y0;
+    ctr[1] = (cl_uint) p1;
+    ctr[2] = y2;
+    ctr[3] = (cl_uint) p0;
+  }
+}
+
+void
+generate_philox_uint_host(cl_uint *dst, size_t n, uint64_t seed)
+{
+  for(size_t b = 0; b * 4 < n; b++) {
+    cl_uint r[4] = { (cl_uint) b, 0, 0, 0 };
+    philox_host(r, seed);
+    for(size_t j = 0; j < 4 && b * 4 + j < n; j++)
+      dst[b * 4 + j] = r[j];
+  }
+}
+
+void
+generate_philox_float_host(cl_float *dst, size_t n, uint64_t seed)
+{
+  for(size_t b = 0; b * 4 < n; b++) {
+    cl_uint r[4] = { (cl_uint) b, 0, 0, 0 };
+    philox_host(r, seed);
+    for(size_t j = 0; j < 4 && b * 4 + j < n; j++)
+      dst[b * 4 + j] = (cl_float) (r[j] >> 8) * 0x1p-24f;
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include <CL/cl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Fill buffers on the device instead of uploading host-generated data.
+//
+//   iota      dst[i] = start + step * i (uint, or int converted to float),
+//             the memset kernel of hello_opencl.c with a start and a step
+//   constant  clEnqueueFillBuffer with any pattern
+//   philox    Philox4x32-10 counter-based RNG: block i of four outputs is
+//             philox(counter (i, 0, 0, 0), key (seed lo, seed hi)), so
+//             every work-item computes its block independently. Floats
+//             are the top 24 bits scaled to [0, 1).
+//
+// Every generator has a host version producing bit-identical output, so
+// a result can be checked against host-generated data without uploading
+// it. n is limited to 2^32 - 1 elements.
+
+struct generator {
+  cl_program program;
+  cl_kernel iota_uint;
+  cl_kernel iota_float;
+  cl_kernel philox_uint;
+  cl_kernel philox_float;
+};
+
+// Builds the generator kernels (through program_cache) for `device`.
+cl_int generator_create(struct generator *gen, cl_context context, cl_device_id device);
+void generator_release(struct generator *gen);
+
+// Device generators. dst must hold n elements; ev may be NULL.
+cl_int generate_iota_uint(struct generator *gen, cl_command_queue queue, cl_mem dst,
+                          size_t n, cl_uint start, cl_int step, cl_event *ev);
+cl_int generate_iota_float(struct generator *gen, cl_command_queue queue, cl_mem dst,
+                           size_t n, cl_int start, cl_int step, cl_event *ev);
+cl_int generate_constant(cl_command_queue queue, cl_mem dst, const void *pattern,
+                         size_t pattern_size, size_t n, cl_event *ev);
+cl_int generate_philox_uint(struct generator *gen, cl_command_queue queue, cl_mem dst,
+                            size_t n, uint64_t seed, cl_event *ev);
+cl_int generate_philox_float(struct generator *gen, cl_command_queue queue, cl_mem dst,
+                             size_t n, uint64_t seed, cl_event *ev);
+
+// Host versions.
+void generate_iota_uint_host(cl_uint *dst, size_t n, cl_uint start, cl_int step);
+void generate_iota_float_host(cl_float *dst, size_t n, cl_int start, cl_int step);
+void generate_constant_host(void *dst, const void *pattern, size_t pattern_size, size_t n);
+void generate_philox_uint_host(cl_uint *dst, size_t n, uint64_t seed);
+void generate_philox_float_host(cl_float *dst, size_t n, uint64_t seed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
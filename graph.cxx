@@ -0,0 +1,261 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+
+#include "graph.hpp"
+#include "reduction.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+////////////////////////////////////////////////////////////////
+// Three independent jobs, run serially and as one command graph.
+//
+//   saxpy A   write x, write y -> saxpy -> read y
+//   saxpy B   write x, write y -> saxpy -> read y
+//   min       write src -> single-pass min -> read result
+//
+// The serial run is what saxpy.cxx and parallel_min.c do: one in-order
+// queue and a blocking read at the end of each job. The graph run
+// declares the same twelve commands with their dependencies and submits
+// them at once, so the upload of one job can overlap the kernel of
+// another; results are picked up through futures as they complete.
+//
+//   ./graph [-n items] [-q queues]
+//
+// -q 0 (default) uses an out-of-order queue when the device has one.
+////////////////////////////////////////////////////////////////
+
+void usage()
+{
+  cerr << "usage: graph [-n items] [-q queues]" << endl;
+}
+
+cl::Context context;
+cl::Device device;
+
+// Same grid-stride saxpy as saxpy.cxx.
+string saxpyStr =
+  "__kernel void saxpy(const global float *x,\n"
+  "                       __global float * y,\n"
+  "                            const float a,\n"
+  "                             const uint n)\n"
+  "{                                         \n"
+  "  for(uint gid = get_global_id(0); gid < n;\n"
+  "      gid += get_global_size(0))          \n"
+  "    y[gid] = a * x[gid] + y[gid];         \n"
+  "}                                         \n";
+
+////////////////////////////////////////////////////////////////
+// Host data and device buffers of the three jobs
+////////////////////////////////////////////////////////////////
+struct Jobs
+{
+  size_t n;
+  cl_float a[2];
+  std::vector<cl_float> x[2], y[2], yInit[2];
+  std::vector<cl_uint> src;
+  cl_uint expect;
+  cl_uint got;
+
+  cl::Kernel saxpy[2];
+  cl::Buffer bufX[2], bufY[2], bufSrc, minV, minI;
+  reduction::Reduction<reduction::Min, cl_uint, 4> red;
+
+  Jobs(size_t items)
+    : n(items), red(context, device)
+  {
+    cl::Program::Sources sources = { saxpyStr };
+    cl::Program program(context, sources);
+    program.build(std::vector<cl::Device>(1, device));
+
+    // One kernel object per job, so both keep their own arguments.
+    for(int j = 0; j < 2; j++)
+      {
+        a[j] = j ? 3.f : 2.f;
+        x[j].resize(n);
+        yInit[j].resize(n);
+        for(size_t i = 0; i < n; i++)
+          {
+            x[j][i] = cl_float((i + j) % 1024);
+            yInit[j][i] = cl_float(1023 - i % 1024);
+          }
+        bufX[j] = cl::Buffer(context, CL_MEM_READ_ONLY, n * sizeof(cl_float));
+        bufY[j] = cl::Buffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_float));
+        saxpy[j] = cl::Kernel(program, "saxpy");
+        saxpy[j].setArg(0, bufX[j]);
+        saxpy[j].setArg(1, bufY[j]);
+        saxpy[j].setArg(2, a[j]);
+        saxpy[j].setArg(3, (cl_uint) n);
+      }
+
+    // MWC init, as in parallel_min.
+    src.resize(n);
+    cl_uint ma = 0x12345678, mb = ma;
+    expect = (cl_uint) -1;
+    for(size_t i = 0; i < n; i++)
+      {
+        src[i] = mb = (ma * (mb & 65535)) + (mb >> 16);
+        expect = std::min(expect, src[i]);
+      }
+    bufSrc = cl::Buffer(context, CL_MEM_READ_ONLY, n * sizeof(cl_uint));
+    minV = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    minI = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+  }
+
+  void reset()
+  {
+    for(int j = 0; j < 2; j++)
+      y[j] = yInit[j];
+    got = 0;
+  }
+
+  bool checkSaxpy(int j) const
+  {
+    for(size_t i = 0; i < n; i++)
+      if(y[j][i] != a[j] * x[j][i] + yInit[j][i])
+        return false;
+    return true;
+  }
+
+  size_t saxpyRange() const { return (n + 63) / 64 * 64; }
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+////////////////////////////////////////////////////////////////
+// One in-order queue, blocking reads
+////////////////////////////////////////////////////////////////
+double runSerial(Jobs &jobs)
+{
+  cl::CommandQueue queue(context, device);
+  size_t bytes = jobs.n * sizeof(cl_float);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(int j = 0; j < 2; j++)
+    {
+      queue.enqueueWriteBuffer(jobs.bufX[j], CL_FALSE, 0, bytes, jobs.x[j].data());
+      queue.enqueueWriteBuffer(jobs.bufY[j], CL_FALSE, 0, bytes, jobs.y[j].data());
+      queue.enqueueNDRangeKernel(jobs.saxpy[j], cl::NullRange, cl::NDRange(jobs.saxpyRange()), cl::NDRange(64));
+      queue.enqueueReadBuffer(jobs.bufY[j], CL_TRUE, 0, bytes, jobs.y[j].data());
+    }
+  queue.enqueueWriteBuffer(jobs.bufSrc, CL_FALSE, 0, jobs.n * sizeof(cl_uint), jobs.src.data());
+  jobs.red.enqueueTo(queue, jobs.bufSrc, (cl_uint) jobs.n, jobs.minV, jobs.minI, 0);
+  queue.enqueueReadBuffer(jobs.minV, CL_TRUE, 0, sizeof(cl_uint), &jobs.got);
+  return secondsSince(start);
+}
+
+////////////////////////////////////////////////////////////////
+// The same commands as one graph
+////////////////////////////////////////////////////////////////
+double runGraph(Jobs &jobs, size_t nqueues)
+{
+  graph::Graph g(context, device, nqueues);
+  size_t bytes = jobs.n * sizeof(cl_float);
+  graph::Node done[3];
+  for(int j = 0; j < 2; j++)
+    {
+      graph::Node wx = g.write(jobs.bufX[j], 0, bytes, jobs.x[j].data());
+      graph::Node wy = g.write(jobs.bufY[j], 0, bytes, jobs.y[j].data());
+      graph::Node k = g.kernel(jobs.saxpy[j], cl::NDRange(jobs.saxpyRange()), cl::NDRange(64), { wx, wy });
+      done[j] = g.read(jobs.bufY[j], 0, bytes, jobs.y[j].data(), { k });
+    }
+  graph::Node ws = g.write(jobs.bufSrc, 0, jobs.n * sizeof(cl_uint), jobs.src.data());
+  graph::Node m = g.enqueue([&jobs](const cl::CommandQueue &queue, const std::vector<cl::Event> *wait, cl::Event *ev)
+                            {
+                              jobs.red.enqueueTo(queue, jobs.bufSrc, (cl_uint) jobs.n, jobs.minV, jobs.minI, 0,
+                                                 wait, ev);
+                            }, { ws });
+  done[2] = g.read(jobs.minV, 0, sizeof(cl_uint), &jobs.got, { m });
+
+  cout << "graph: " << g.size() << " nodes on "
+       << (g.outOfOrder() ? string("one out-of-order queue")
+                          : std::to_string(g.queueCount()) + " in-order queues") << endl;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  g.run();
+  // Pick the results up in completion order.
+  const char *names[3] = { "saxpy A", "saxpy B", "min" };
+  bool ready[3] = { false, false, false };
+  for(int left = 3; left > 0; )
+    for(int j = 0; j < 3; j++)
+      if(!ready[j] && g.future(done[j]).wait_for(std::chrono::microseconds(50)) == std::future_status::ready)
+        {
+          g.future(done[j]).get();
+          ready[j] = true;
+          left--;
+          cout << "  " << names[j] << " ready at " << secondsSince(start) * 1e3 << " ms" << endl;
+        }
+  return secondsSince(start);
+}
+
+bool check(const Jobs &jobs)
+{
+  bool ok = jobs.checkSaxpy(0) && jobs.checkSaxpy(1) && jobs.got == jobs.expect;
+  cout << (ok ? "result correct" : "result INcorrect") << endl;
+  return ok;
+}
+
+int main(int argc, char * argv[])
+{
+  size_t n = (size_t) 1 << 24;
+  size_t nqueues = 0;
+  for(int i = 1; i + 1 < argc; i += 2)
+    {
+      if(!strcmp(argv[i], "-n"))      n = strtoull(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-q")) nqueues = strtoull(argv[i + 1], NULL, 0);
+      else
+        {
+          usage();
+          return 1;
+        }
+    }
+  if(argc % 2 == 0 || n == 0 || n > 0xffffffffu)
+    {
+      usage();
+      return 1;
+    }
+
+  try
+    {
+      device = cl::Device::getDefault();
+      context = cl::Context(device);
+      cout << device.getInfo<CL_DEVICE_NAME>() << ": 2 saxpy + 1 min of " << n << " items" << endl;
+
+      Jobs jobs(n);
+      bool ok = true;
+
+      // Once untimed, so neither run pays for first-launch setup.
+      jobs.reset();
+      runSerial(jobs);
+
+      jobs.reset();
+      double serial = runSerial(jobs);
+      cout << "serial: " << serial * 1e3 << " ms" << endl;
+      ok &= check(jobs);
+
+      jobs.reset();
+      double overlapped = runGraph(jobs, nqueues);
+      cout << "graph:  " << overlapped * 1e3 << " ms (" << serial / overlapped << "x)" << endl;
+      ok &= check(jobs);
+      return ok ? 0 : 1;
+    }
+  catch(cl::Error &err)
+    {
+      cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << endl;
+    }
+  catch(string msg)
+    {
+      cerr << "Exception caught in main(): " << msg << endl;
+    }
+  return 1;
+}
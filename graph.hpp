@@ -0,0 +1,241 @@
+#ifndef GRAPH_HPP
+#define GRAPH_HPP
+
+////////////////////////////////////////////////////////////////
+// Command graph: declare transfers and kernels with their
+// dependencies, then submit them all at once.
+//
+//   graph::Graph g(context, device);
+//   graph::Node wx = g.write(x, 0, bytes, hostX);
+//   graph::Node wy = g.write(y, 0, bytes, hostY);
+//   graph::Node k  = g.kernel(saxpy, cl::NDRange(n), cl::NullRange, { wx, wy });
+//   graph::Node ry = g.read(y, 0, bytes, hostY, { k });
+//   g.run();
+//   g.future(ry).get();   // hostY is ready
+//
+// A node may only depend on nodes declared before it, so declaration
+// order is a valid submission order. run() enqueues every node with the
+// events of its dependencies as wait list and flushes, without blocking.
+// Nodes without a path between them are free to overlap: on one
+// out-of-order queue if the device has one, otherwise on several
+// in-order queues (a node goes to the queue of its first dependency,
+// roots round-robin).
+//
+// The graph owns the events of the last run and releases them on the
+// next run() or on destruction; each node's future is completed from an
+// event callback and rethrows a failed command as a string, like the
+// rest of the host code. Kernel arguments are those set when run() is
+// called, so two nodes need two cl::Kernel objects to run the same
+// kernel with different arguments.
+////////////////////////////////////////////////////////////////
+
+#include <CL/opencl.hpp>
+#include <exception>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace graph
+{
+
+typedef size_t Node;
+typedef std::vector<Node> Deps;
+
+// Enqueue one command on queue after wait (NULL if none), setting ev.
+typedef std::function<void(const cl::CommandQueue &queue,
+                           const std::vector<cl::Event> *wait,
+                           cl::Event *ev)> Command;
+
+class Graph
+{
+public:
+  ////////////////////////////////////////////////////////////////
+  // nqueues 0: one out-of-order queue when the device supports it,
+  // else two in-order queues. nqueues > 0: that many in-order queues.
+  ////////////////////////////////////////////////////////////////
+  Graph(const cl::Context &context, const cl::Device &device,
+        size_t nqueues = 0, cl_command_queue_properties props = 0)
+    : nextQueue_(0)
+  {
+    cl_command_queue_properties caps = device.getInfo<CL_DEVICE_QUEUE_ON_HOST_PROPERTIES>();
+    outOfOrder_ = nqueues == 0 && (caps & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+    if(outOfOrder_)
+      queues_.push_back(cl::CommandQueue(context, device, props | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE));
+    else
+      for(size_t q = 0; q < (nqueues ? nqueues : 2); q++)
+        queues_.push_back(cl::CommandQueue(context, device, props));
+  }
+
+  ~Graph()
+  {
+    // Commands of the last run may still reference host pointers.
+    try
+      {
+        for(const cl::CommandQueue &q : queues_)
+          q.finish();
+      }
+    catch(...)
+      {
+      }
+  }
+
+  Graph(const Graph &) = delete;
+  Graph & operator=(const Graph &) = delete;
+
+  ////////////////////////////////////////////////////////////////
+  // Node declarations
+  ////////////////////////////////////////////////////////////////
+  Node enqueue(const Command &command, const Deps &deps = Deps())
+  {
+    for(Node d : deps)
+      if(d >= nodes_.size())
+        throw(std::string("graph: dependency on an undeclared node"));
+    size_t q = 0;
+    if(!outOfOrder_)
+      q = deps.empty() ? nextQueue_++ % queues_.size() : nodes_[deps[0]].queue;
+    nodes_.push_back(Entry{ command, deps, q });
+    return nodes_.size() - 1;
+  }
+
+  Node kernel(const cl::Kernel &k, const cl::NDRange &global,
+              const cl::NDRange &local = cl::NullRange, const Deps &deps = Deps())
+  {
+    return enqueue([=](const cl::CommandQueue &queue, const std::vector<cl::Event> *wait, cl::Event *ev)
+                   {
+                     queue.enqueueNDRangeKernel(k, cl::NullRange, global, local, wait, ev);
+                   }, deps);
+  }
+
+  Node write(const cl::Buffer &buf, size_t offset, size_t size, const void *ptr,
+             const Deps &deps = Deps())
+  {
+    return enqueue([=](const cl::CommandQueue &queue, const std::vector<cl::Event> *wait, cl::Event *ev)
+                   {
+                     queue.enqueueWriteBuffer(buf, CL_FALSE, offset, size, ptr, wait, ev);
+                   }, deps);
+  }
+
+  Node read(const cl::Buffer &buf, size_t offset, size_t size, void *ptr,
+            const Deps &deps = Deps())
+  {
+    return enqueue([=](const cl::CommandQueue &queue, const std::vector<cl::Event> *wait, cl::Event *ev)
+                   {
+                     queue.enqueueReadBuffer(buf, CL_FALSE, offset, size, ptr, wait, ev);
+                   }, deps);
+  }
+
+  Node copy(const cl::Buffer &src, const cl::Buffer &dst, size_t srcOffset, size_t dstOffset,
+            size_t size, const Deps &deps = Deps())
+  {
+    return enqueue([=](const cl::CommandQueue &queue, const std::vector<cl::Event> *wait, cl::Event *ev)
+                   {
+                     queue.enqueueCopyBuffer(src, dst, srcOffset, dstOffset, size, wait, ev);
+                   }, deps);
+  }
+
+  template<typename P>
+  Node fill(const cl::Buffer &buf, P pattern, size_t offset, size_t size,
+            const Deps &deps = Deps())
+  {
+    return enqueue([=](const cl::CommandQueue &queue, const std::vector<cl::Event> *wait, cl::Event *ev)
+                   {
+                     queue.enqueueFillBuffer(buf, pattern, offset, size, wait, ev);
+                   }, deps);
+  }
+
+  // Completes when all of deps have; a single node to depend on or wait for.
+  Node join(const Deps &deps)
+  {
+    return enqueue([](const cl::CommandQueue &queue, const std::vector<cl::Event> *wait, cl::Event *ev)
+                   {
+                     queue.enqueueMarkerWithWaitList(wait, ev);
+                   }, deps);
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // Submit every node and return without blocking. A previous run
+  // is waited for first, so runs never overlap; its failures were
+  // for its own futures to report and do not stop this one.
+  ////////////////////////////////////////////////////////////////
+  void run()
+  {
+    for(std::shared_future<void> &f : futures_)
+      if(f.valid())
+        f.wait();
+    events_.assign(nodes_.size(), cl::Event());
+    futures_.assign(nodes_.size(), std::shared_future<void>());
+    for(size_t i = 0; i < nodes_.size(); i++)
+      {
+        const Entry &e = nodes_[i];
+        std::vector<cl::Event> deps;
+        for(Node d : e.deps)
+          deps.push_back(events_[d]);
+        e.command(queues_[e.queue], deps.empty() ? NULL : &deps, &events_[i]);
+
+        std::promise<void> *p = new std::promise<void>;
+        futures_[i] = p->get_future().share();
+        try
+          {
+            events_[i].setCallback(CL_COMPLETE, complete, p);
+          }
+        catch(...)
+          {
+            delete p;
+            throw;
+          }
+      }
+    // Without a flush, commands on the other queues may never start.
+    for(const cl::CommandQueue &q : queues_)
+      q.flush();
+  }
+
+  // Future of node n in the last run.
+  std::shared_future<void> future(Node n) const { return futures_.at(n); }
+
+  // Event of node n in the last run, e.g. for profiling.
+  const cl::Event & event(Node n) const { return events_.at(n); }
+
+  // Wait for every node of the last run; rethrows the first failure.
+  void wait()
+  {
+    for(std::shared_future<void> &f : futures_)
+      if(f.valid())
+        f.get();
+  }
+
+  bool outOfOrder() const { return outOfOrder_; }
+  size_t queueCount() const { return queues_.size(); }
+  size_t size() const { return nodes_.size(); }
+
+private:
+  struct Entry
+  {
+    Command command;
+    Deps deps;
+    size_t queue;
+  };
+
+  // Runs on a runtime thread: no OpenCL calls here.
+  static void CL_CALLBACK complete(cl_event, cl_int status, void *data)
+  {
+    std::promise<void> *p = static_cast<std::promise<void> *>(data);
+    if(status < 0)
+      p->set_exception(std::make_exception_ptr(std::string("graph: command failed with status ") +
+                                               std::to_string(status)));
+    else
+      p->set_value();
+    delete p;
+  }
+
+  std::vector<cl::CommandQueue> queues_;
+  std::vector<Entry> nodes_;
+  std::vector<cl::Event> events_;
+  std::vector<std::shared_future<void> > futures_;
+  size_t nextQueue_;
+  bool outOfOrder_;
+};
+
+} // namespace graph
+
+#endif
@@ -1,6 +1,7 @@
 #define CL_TARGET_OPENCL_VERSION 110
 
 #include <CL/cl.h>
+#include "program_cache.h"
 #include <stdio.h>
 
 const char * get_error_string(cl_int err){
@@ -112,14 +113,9 @@ main(int argc,  char **agrv)
                                                 0,
                                                 NULL);
 
-  // 4. Perform runtime source compilation, and obtain kernel entry point.
-  cl_program program = clCreateProgramWithSource(
-                                                 context,
-                                                 1,
-                                                 &source,
-                                                 NULL,
-                                                 NULL);
-  ret = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
+  // 4. Perform runtime source compilation (or load the cached binary),
+  // and obtain kernel entry point.
+  cl_program program = program_cache_build(context, device, source, NULL, &ret);
   if(ret!=0) {
     const char * err = get_error_string(ret);
     printf("clBuildProgram: %s\n", err);
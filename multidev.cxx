@@ -0,0 +1,358 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+
+#include "reduction.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+////////////////////////////////////////////////////////////////
+// One min or saxpy spread over every OpenCL device of every platform.
+//
+// Each device first runs a probe of `probe` items (upload, kernel and
+// read back, as in the real run) to measure its throughput. The input
+// is then cut into one contiguous slice per device, sized in proportion
+// to that throughput, and every device works on its slice from its own
+// host thread. Min partials are merged on the host; saxpy slices are
+// read back into place.
+//
+//   ./multidev min|saxpy [-n items] [-p probe items] [-e]
+//
+// -e splits evenly instead, for comparison.
+////////////////////////////////////////////////////////////////
+
+void usage()
+{
+  cerr << "usage: multidev min|saxpy [-n items] [-p probe items] [-e]" << endl;
+}
+
+// Same grid-stride saxpy as saxpy.cxx.
+string saxpyStr =
+  "__kernel void saxpy(const global float *x,\n"
+  "                       __global float * y,\n"
+  "                            const float a,\n"
+  "                             const uint n)\n"
+  "{                                         \n"
+  "  for(uint gid = get_global_id(0); gid < n;\n"
+  "      gid += get_global_size(0))          \n"
+  "    y[gid] = a * x[gid] + y[gid];         \n"
+  "}                                         \n";
+
+////////////////////////////////////////////////////////////////
+// One device with its own context and queue. Devices of different
+// platforms cannot share a context, so nothing is shared.
+////////////////////////////////////////////////////////////////
+struct Worker
+{
+  cl::Device device;
+  cl::Context context;
+  cl::CommandQueue queue;
+  string name;
+  std::unique_ptr<reduction::Reduction<reduction::Min, cl_uint, 4> > red;
+  cl::Kernel saxpy;
+
+  double rate;     // items per second from the probe
+  size_t off, len; // slice of the input
+  double seconds;  // wall time of the slice
+  cl_uint min;     // min result of the slice
+};
+
+////////////////////////////////////////////////////////////////
+// Slice work for each benchmark: upload, kernel, read back
+////////////////////////////////////////////////////////////////
+cl_uint minSlice(Worker &w, const cl_uint *src, size_t n)
+{
+  cl::Buffer buf(w.context, CL_MEM_READ_ONLY, n * sizeof(cl_uint));
+  w.queue.enqueueWriteBuffer(buf, CL_FALSE, 0, n * sizeof(cl_uint), src);
+  return (*w.red)(w.queue, buf, (cl_uint) n).value;
+}
+
+void saxpySlice(Worker &w, const cl_float *x, const cl_float *y, cl_float *out, cl_float a, size_t n)
+{
+  cl::Buffer bufX(w.context, CL_MEM_READ_ONLY, n * sizeof(cl_float));
+  cl::Buffer bufY(w.context, CL_MEM_READ_WRITE, n * sizeof(cl_float));
+  w.queue.enqueueWriteBuffer(bufX, CL_FALSE, 0, n * sizeof(cl_float), x);
+  w.queue.enqueueWriteBuffer(bufY, CL_FALSE, 0, n * sizeof(cl_float), y);
+  w.saxpy.setArg(0, bufX);
+  w.saxpy.setArg(1, bufY);
+  w.saxpy.setArg(2, a);
+  w.saxpy.setArg(3, (cl_uint) n);
+  w.queue.enqueueNDRangeKernel(w.saxpy, cl::NullRange, cl::NDRange((n + 63) / 64 * 64), cl::NDRange(64));
+  w.queue.enqueueReadBuffer(bufY, CL_TRUE, 0, n * sizeof(cl_float), out);
+}
+
+////////////////////////////////////////////////////////////////
+// Every device of every platform, CPUs included
+////////////////////////////////////////////////////////////////
+std::vector<Worker> openAll(bool min)
+{
+  std::vector<Worker> workers;
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+  for(cl::Platform &platform : platforms)
+    {
+      std::vector<cl::Device> devices;
+      try
+        {
+          platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+        }
+      catch(cl::Error &)
+        {
+          continue; // CL_DEVICE_NOT_FOUND
+        }
+      for(cl::Device &device : devices)
+        {
+          Worker w;
+          w.device = device;
+          w.context = cl::Context(device);
+          w.queue = cl::CommandQueue(w.context, device);
+          w.name = device.getInfo<CL_DEVICE_NAME>();
+          try
+            {
+              if(min)
+                w.red.reset(new reduction::Reduction<reduction::Min, cl_uint, 4>(w.context, device));
+              else
+                {
+                  cl::Program::Sources sources = { saxpyStr };
+                  cl::Program program(w.context, sources);
+                  program.build(std::vector<cl::Device>(1, device));
+                  w.saxpy = cl::Kernel(program, "saxpy");
+                }
+            }
+          catch(string msg)
+            {
+              // e.g. a 1.2 device without work_group_reduce_min
+              cerr << w.name << ": skipped, " << msg << endl;
+              continue;
+            }
+          catch(cl::Error &err)
+            {
+              cerr << w.name << ": skipped, " << err.what() << "(" << err.err() << ")" << endl;
+              continue;
+            }
+          workers.push_back(std::move(w));
+        }
+    }
+  if(workers.empty())
+    throw(string("no usable OpenCL device"));
+  return workers;
+}
+
+////////////////////////////////////////////////////////////////
+// Cut n items into one slice per device, proportional to rate (or
+// even). Slices are multiples of 1024 items; the rest goes to the
+// fastest device.
+////////////////////////////////////////////////////////////////
+void partition(std::vector<Worker> &workers, size_t n, bool even)
+{
+  double total = 0;
+  for(Worker &w : workers)
+    total += even ? 1 : w.rate;
+  size_t used = 0, fastest = 0;
+  for(size_t i = 0; i < workers.size(); i++)
+    {
+      double share = (even ? 1 : workers[i].rate) / total;
+      workers[i].len = (size_t) (share * n) / 1024 * 1024;
+      used += workers[i].len;
+      if(workers[i].rate > workers[fastest].rate)
+        fastest = i;
+    }
+  workers[fastest].len += n - used;
+  size_t off = 0;
+  for(Worker &w : workers)
+    {
+      w.off = off;
+      off += w.len;
+    }
+}
+
+////////////////////////////////////////////////////////////////
+// Run fn(worker) for every worker with a non-empty slice, one host
+// thread each, and time each one
+////////////////////////////////////////////////////////////////
+template<typename Fn>
+void runAll(std::vector<Worker> &workers, Fn fn)
+{
+  std::vector<std::thread> threads;
+  std::vector<string> errors(workers.size());
+  for(size_t i = 0; i < workers.size(); i++)
+    {
+      if(workers[i].len == 0)
+        continue;
+      threads.push_back(std::thread([&, i]() {
+            Worker &w = workers[i];
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            try
+              {
+                fn(w);
+              }
+            catch(cl::Error &err)
+              {
+                errors[i] = w.name + ": " + err.what() + "(" + std::to_string(err.err()) + ")";
+              }
+            w.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          }));
+    }
+  for(std::thread &t : threads)
+    t.join();
+  for(string &e : errors)
+    if(!e.empty())
+      throw(e);
+}
+
+////////////////////////////////////////////////////////////////
+// Probe each device alone, so the rates do not disturb each other
+////////////////////////////////////////////////////////////////
+template<typename Fn>
+void calibrate(std::vector<Worker> &workers, size_t probe, Fn fn)
+{
+  for(Worker &w : workers)
+    {
+      fn(w, probe); // warmup: first launch, allocation
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      fn(w, probe);
+      double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      w.rate = probe / t;
+    }
+}
+
+void report(const std::vector<Worker> &workers, size_t n, size_t bytesPerItem, double wall)
+{
+  for(const Worker &w : workers)
+    cout << "  " << w.name << ": probe " << w.rate * bytesPerItem / 1e9 << " GB/sec, "
+         << w.len << " items (" << 100.0 * w.len / n << "%), "
+         << (w.len ? w.seconds * 1e3 : 0) << " ms" << endl;
+  cout << "total: " << n * bytesPerItem / 1e9 << " GB in " << wall * 1e3 << " ms, "
+       << n * bytesPerItem / wall / 1e9 << " GB/sec" << endl;
+}
+
+////////////////////////////////////////////////////////////////
+// min over n uints
+////////////////////////////////////////////////////////////////
+bool multiMin(size_t n, size_t probe, bool even)
+{
+  // MWC init, as in parallel_min.
+  std::vector<cl_uint> host(n);
+  cl_uint a = (cl_uint) time(NULL), b = a;
+  cl_uint expect = (cl_uint) -1;
+  for(size_t i = 0; i < n; i++)
+    {
+      host[i] = b = (a * (b & 65535)) + (b >> 16);
+      expect = std::min(expect, host[i]);
+    }
+
+  std::vector<Worker> workers = openAll(true);
+  calibrate(workers, std::min(probe, n), [&](Worker &w, size_t len) {
+      minSlice(w, host.data(), len);
+    });
+  partition(workers, n, even);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  runAll(workers, [&](Worker &w) {
+      w.min = minSlice(w, &host[w.off], w.len);
+    });
+  cl_uint got = (cl_uint) -1;
+  for(Worker &w : workers)
+    if(w.len)
+      got = std::min(got, w.min);
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  cout << "min, " << workers.size() << " devices" << (even ? ", even split" : "") << endl;
+  report(workers, n, sizeof(cl_uint), wall);
+  cout << "computed value: " << got << (got == expect ? ", result correct" : ", result INcorrect") << endl;
+  return got == expect;
+}
+
+////////////////////////////////////////////////////////////////
+// y = a * x + y over n floats
+////////////////////////////////////////////////////////////////
+bool multiSaxpy(size_t n, size_t probe, bool even)
+{
+  const cl_float a = 2.f;
+  std::vector<cl_float> x(n), y(n);
+  for(size_t i = 0; i < n; i++)
+    {
+      x[i] = cl_float(i % 1024);
+      y[i] = cl_float(1023 - i % 1024);
+    }
+
+  std::vector<Worker> workers = openAll(false);
+  std::vector<cl_float> scratch(std::min(probe, n));
+  calibrate(workers, scratch.size(), [&](Worker &w, size_t len) {
+      saxpySlice(w, x.data(), y.data(), scratch.data(), a, len);
+    });
+  partition(workers, n, even);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  runAll(workers, [&](Worker &w) {
+      saxpySlice(w, &x[w.off], &y[w.off], &y[w.off], a, w.len);
+    });
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  bool ok = true;
+  for(size_t i = 0; i < n && ok; i++)
+    ok = y[i] == a * cl_float(i % 1024) + cl_float(1023 - i % 1024);
+  cout << "saxpy, " << workers.size() << " devices" << (even ? ", even split" : "") << endl;
+  report(workers, n, 3 * sizeof(cl_float), wall);
+  cout << (ok ? "result correct" : "result INcorrect") << endl;
+  return ok;
+}
+
+int main(int argc, char * argv[])
+{
+  if(argc < 2 || (strcmp(argv[1], "min") && strcmp(argv[1], "saxpy")))
+    {
+      usage();
+      return 1;
+    }
+  string which = argv[1];
+  size_t n = (size_t) 1 << 26;
+  size_t probe = (size_t) 1 << 22;
+  bool even = false;
+  for(int i = 2; i < argc; i++)
+    {
+      if(!strcmp(argv[i], "-e"))
+        even = true;
+      else if(!strcmp(argv[i], "-n") && i + 1 < argc)
+        n = strtoull(argv[++i], NULL, 0);
+      else if(!strcmp(argv[i], "-p") && i + 1 < argc)
+        probe = strtoull(argv[++i], NULL, 0);
+      else
+        {
+          usage();
+          return 1;
+        }
+    }
+  // Slices are launched with a cl_uint item count.
+  if(n == 0 || probe == 0 || n > 0xffffffffu)
+    {
+      usage();
+      return 1;
+    }
+
+  try
+    {
+      bool ok = which == "min" ? multiMin(n, probe, even) : multiSaxpy(n, probe, even);
+      return ok ? 0 : 1;
+    }
+  catch(cl::Error &err)
+    {
+      cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << endl;
+    }
+  catch(string msg)
+    {
+      cerr << "Exception caught in main(): " << msg << endl;
+    }
+  return 1;
+}
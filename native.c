@@ -0,0 +1,306 @@
+#include "native.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NATIVE_X86 1
+#include <immintrin.h>
+#endif
+
+// Below this many elements per thread the spawn costs more than it saves.
+#define MIN_PER_THREAD (1 << 16)
+#define MAX_THREADS 256
+
+static const char *isa_names[] = { "scalar", "sse", "avx2", "avx512" };
+
+typedef void (*saxpy_fn)(float a, const float *x, float *y, size_t n);
+typedef unsigned int (*min_fn)(const unsigned int *src, size_t n);
+
+// 1. Scalar variants, also used for the tails of the SIMD ones.
+
+static void
+saxpy_scalar(float a, const float *x, float *y, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+    y[i] = a * x[i] + y[i];
+}
+
+static unsigned int
+min_scalar(const unsigned int *src, size_t n)
+{
+  unsigned int m = UINT_MAX;
+  for(size_t i = 0; i < n; i++)
+    m = src[i] < m ? src[i] : m;
+  return m;
+}
+
+#ifdef NATIVE_X86
+
+// 2. SSE / SSE4.1. Four accumulators hide the latency of pminud.
+
+__attribute__((target("sse2")))
+static void
+saxpy_sse(float a, const float *x, float *y, size_t n)
+{
+  __m128 va = _mm_set1_ps(a);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_mul_ps(va, _mm_loadu_ps(x + i)), _mm_loadu_ps(y + i)));
+  saxpy_scalar(a, x + i, y + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static unsigned int
+min_sse(const unsigned int *src, size_t n)
+{
+  __m128i m0 = _mm_set1_epi32(-1), m1 = m0, m2 = m0, m3 = m0;
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16) {
+    m0 = _mm_min_epu32(m0, _mm_loadu_si128((const __m128i *) (src + i)));
+    m1 = _mm_min_epu32(m1, _mm_loadu_si128((const __m128i *) (src + i + 4)));
+    m2 = _mm_min_epu32(m2, _mm_loadu_si128((const __m128i *) (src + i + 8)));
+    m3 = _mm_min_epu32(m3, _mm_loadu_si128((const __m128i *) (src + i + 12)));
+  }
+  m0 = _mm_min_epu32(_mm_min_epu32(m0, m1), _mm_min_epu32(m2, m3));
+  m0 = _mm_min_epu32(m0, _mm_shuffle_epi32(m0, _MM_SHUFFLE(1, 0, 3, 2)));
+  m0 = _mm_min_epu32(m0, _mm_shuffle_epi32(m0, _MM_SHUFFLE(2, 3, 0, 1)));
+  unsigned int m = (unsigned int) _mm_cvtsi128_si32(m0);
+  unsigned int t = min_scalar(src + i, n - i);
+  return t < m ? t : m;
+}
+
+// 3. AVX2.
+
+__attribute__((target("avx2")))
+static void
+saxpy_avx2(float a, const float *x, float *y, size_t n)
+{
+  __m256 va = _mm256_set1_ps(a);
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_mul_ps(va, _mm256_loadu_ps(x + i)),
+                                          _mm256_loadu_ps(y + i)));
+  saxpy_scalar(a, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static unsigned int
+min_avx2(const unsigned int *src, size_t n)
+{
+  __m256i m0 = _mm256_set1_epi32(-1), m1 = m0, m2 = m0, m3 = m0;
+  size_t i = 0;
+  for(; i + 32 <= n; i += 32) {
+    m0 = _mm256_min_epu32(m0, _mm256_loadu_si256((const __m256i *) (src + i)));
+    m1 = _mm256_min_epu32(m1, _mm256_loadu_si256((const __m256i *) (src + i + 8)));
+    m2 = _mm256_min_epu32(m2, _mm256_loadu_si256((const __m256i *) (src + i + 16)));
+    m3 = _mm256_min_epu32(m3, _mm256_loadu_si256((const __m256i *) (src + i + 24)));
+  }
+  m0 = _mm256_min_epu32(_mm256_min_epu32(m0, m1), _mm256_min_epu32(m2, m3));
+  __m128i h = _mm_min_epu32(_mm256_castsi256_si128(m0), _mm256_extracti128_si256(m0, 1));
+  h = _mm_min_epu32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1, 0, 3, 2)));
+  h = _mm_min_epu32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1)));
+  unsigned int m = (unsigned int) _mm_cvtsi128_si32(h);
+  unsigned int t = min_scalar(src + i, n - i);
+  return t < m ? t : m;
+}
+
+// 4. AVX-512F. Its EVEX encoding includes FMA, so the multiply and add
+// must not be contracted to keep saxpy bit-identical.
+
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void
+saxpy_avx512(float a, const float *x, float *y, size_t n)
+{
+  __m512 va = _mm512_set1_ps(a);
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16)
+    _mm512_storeu_ps(y + i, _mm512_add_ps(_mm512_mul_ps(va, _mm512_loadu_ps(x + i)),
+                                          _mm512_loadu_ps(y + i)));
+  saxpy_scalar(a, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static unsigned int
+min_avx512(const unsigned int *src, size_t n)
+{
+  __m512i m0 = _mm512_set1_epi32(-1), m1 = m0, m2 = m0, m3 = m0;
+  size_t i = 0;
+  for(; i + 64 <= n; i += 64) {
+    m0 = _mm512_min_epu32(m0, _mm512_loadu_si512(src + i));
+    m1 = _mm512_min_epu32(m1, _mm512_loadu_si512(src + i + 16));
+    m2 = _mm512_min_epu32(m2, _mm512_loadu_si512(src + i + 32));
+    m3 = _mm512_min_epu32(m3, _mm512_loadu_si512(src + i + 48));
+  }
+  m0 = _mm512_min_epu32(_mm512_min_epu32(m0, m1), _mm512_min_epu32(m2, m3));
+  unsigned int m = _mm512_reduce_min_epu32(m0);
+  unsigned int t = min_scalar(src + i, n - i);
+  return t < m ? t : m;
+}
+
+#endif
+
+static saxpy_fn saxpy_fns[] = {
+  saxpy_scalar,
+#ifdef NATIVE_X86
+  saxpy_sse, saxpy_avx2, saxpy_avx512
+#endif
+};
+
+static min_fn min_fns[] = {
+  min_scalar,
+#ifdef NATIVE_X86
+  min_sse, min_avx2, min_avx512
+#endif
+};
+
+// 5. Dispatch: the widest supported variant, capped by NATIVE_ISA.
+
+static int
+detect_isa(void)
+{
+  int isa = NATIVE_SCALAR;
+#ifdef NATIVE_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse4.1"))
+    isa = NATIVE_SSE;
+  if(__builtin_cpu_supports("avx2"))
+    isa = NATIVE_AVX2;
+  if(__builtin_cpu_supports("avx512f"))
+    isa = NATIVE_AVX512;
+#endif
+  const char *cap = getenv("NATIVE_ISA");
+  if(cap != NULL) {
+    for(int i = NATIVE_SCALAR; i <= NATIVE_AVX512; i++)
+      if(strcmp(cap, isa_names[i]) == 0 && i < isa)
+        isa = i;
+  }
+  return isa;
+}
+
+// Worker threads read it too, hence the pthread_once.
+static int current_isa = NATIVE_SCALAR;
+static pthread_once_t isa_once = PTHREAD_ONCE_INIT;
+
+static void
+init_isa(void)
+{
+  current_isa = detect_isa();
+}
+
+int
+native_isa(void)
+{
+  pthread_once(&isa_once, init_isa);
+  return current_isa;
+}
+
+const char *
+native_isa_name(int isa)
+{
+  return isa >= NATIVE_SCALAR && isa <= NATIVE_AVX512 ? isa_names[isa] : "?";
+}
+
+static int nthreads = -1;
+
+// Unsynchronized: callers on several threads should set it first.
+int
+native_threads(void)
+{
+  if(nthreads < 0) {
+    const char *env = getenv("NATIVE_THREADS");
+    native_set_threads(env != NULL ? atoi(env) : 0);
+  }
+  return nthreads;
+}
+
+void
+native_set_threads(int n)
+{
+  if(n <= 0)
+    n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  nthreads = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+}
+
+// 6. Threading: one contiguous slice per thread, the caller takes the
+// first one.
+
+struct slice {
+  float a;
+  const float *x;
+  float *y;
+  const unsigned int *src;
+  size_t n;
+  unsigned int min;
+};
+
+static void *
+saxpy_slice(void *p)
+{
+  struct slice *s = (struct slice *) p;
+  saxpy_fns[native_isa()](s->a, s->x, s->y, s->n);
+  return NULL;
+}
+
+static void *
+min_slice(void *p)
+{
+  struct slice *s = (struct slice *) p;
+  s->min = min_fns[native_isa()](s->src, s->n);
+  return NULL;
+}
+
+// Runs fn over `count` slices of n elements and returns how many ran.
+static int
+run_sliced(void *(*fn)(void *), struct slice *slices, size_t n,
+           float a, const float *x, float *y, const unsigned int *src)
+{
+  int count = native_threads();
+  if((size_t) count > n / MIN_PER_THREAD)
+    count = n / MIN_PER_THREAD > 0 ? (int) (n / MIN_PER_THREAD) : 1;
+  // Slices are multiples of 64 elements, so every one starts on a cache line
+  // boundary relative to the input.
+  size_t per = (n / count + 63) / 64 * 64;
+  pthread_t threads[MAX_THREADS];
+  int started[MAX_THREADS];
+
+  for(int t = 0; t < count; t++) {
+    size_t off = per * t < n ? per * t : n;
+    slices[t].a = a;
+    slices[t].x = x ? x + off : NULL;
+    slices[t].y = y ? y + off : NULL;
+    slices[t].src = src ? src + off : NULL;
+    slices[t].n = off + per < n && t + 1 < count ? per : n - off;
+    slices[t].min = UINT_MAX;
+  }
+  for(int t = 1; t < count; t++)
+    started[t] = pthread_create(&threads[t], NULL, fn, &slices[t]) == 0;
+  fn(&slices[0]);
+  for(int t = 1; t < count; t++) {
+    if(started[t])
+      pthread_join(threads[t], NULL);
+    else
+      fn(&slices[t]); // no thread: run it here
+  }
+  return count;
+}
+
+void
+native_saxpy(float a, const float *x, float *y, size_t n)
+{
+  struct slice slices[MAX_THREADS];
+  run_sliced(saxpy_slice, slices, n, a, x, y, NULL);
+}
+
+unsigned int
+native_min(const unsigned int *src, size_t n)
+{
+  struct slice slices[MAX_THREADS];
+  unsigned int m = UINT_MAX;
+  int count = run_sliced(min_slice, slices, n, 0, NULL, NULL, src);
+  for(int t = 0; t < count; t++)
+    m = slices[t].min < m ? slices[t].min : m;
+  return m;
+}
@@ -0,0 +1,45 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Native CPU versions of saxpy and the min reduction, without OpenCL.
+//
+// Each operation has a scalar, SSE, AVX2 and AVX-512 variant; the widest
+// one the CPU supports is picked at run time by CPUID, so the file is
+// built without -m flags. Large inputs are split across host threads.
+// The results are the same as the kernels': saxpy is a multiply and an
+// add (never fused) in every variant, so the outputs are bit-identical
+// to the scalar loop.
+//
+// NATIVE_ISA=scalar|sse|avx2|avx512 caps the variant and NATIVE_THREADS
+// sets the thread count, e.g. to compare against the OpenCL CPU device.
+
+#define NATIVE_SCALAR 0
+#define NATIVE_SSE    1 // SSE for saxpy, SSE4.1 for min
+#define NATIVE_AVX2   2
+#define NATIVE_AVX512 3 // AVX-512F
+
+// The variant in use.
+int native_isa(void);
+const char *native_isa_name(int isa);
+
+// Host threads per call; 0 (the default) is one per online CPU.
+int native_threads(void);
+void native_set_threads(int n);
+
+// y[i] = a * x[i] + y[i] for i < n.
+void native_saxpy(float a, const float *x, float *y, size_t n);
+
+// min(src[0..n-1]), UINT_MAX if n is 0.
+unsigned int native_min(const unsigned int *src, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
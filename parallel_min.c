@@ -1,8 +1,22 @@
-#define CL_TARGET_OPENCL_VERSION 110
+#define CL_TARGET_OPENCL_VERSION 200
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 
 #include <CL/cl.h>
+#include "autotune.h"
+#include "buffer_pool.h"
+#include "dataset.h"
+#include "generate.h"
+#include "native.h"
+#include "specialize.h"
+#include "program_cache.h"
+#include "roofline.h"
+#include "parallel_min_cl.h" // sh embed_cl.sh [-s] parallel_min.cl
+#if defined(PARALLEL_MIN_SPV) && !defined(PROGRAM_CACHE_IL)
+#error "parallel_min_cl.h embeds SPIR-V (embed_cl.sh -s): build with -DPROGRAM_CACHE_IL"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -11,37 +25,382 @@
 
 #define NDEVS 1
 
+// Reduction paths selectable with -r.
+#define REDUCE_ATOMIC 0 // minp (local atom_min) + reduce (global atom_min)
+#define REDUCE_SINGLE 1 // minp_single: work_group_reduce_min, one launch
+#define REDUCE_VEC    2 // minp_vec: minp_single with -w/-u/-a variants, any size
+
+static const char *reduce_names[] = { "atomic", "single", "vec" };
+static const char *pattern_names[] = { "blocked", "strided", "hybrid" };
+
+// Memory strategies for the source buffer, selectable with -m.
+#define MEM_COPY       0 // CL_MEM_COPY_HOST_PTR
+#define MEM_USE_HOST   1 // page-aligned src_ptr with CL_MEM_USE_HOST_PTR
+#define MEM_ALLOC_HOST 2 // CL_MEM_ALLOC_HOST_PTR, filled through map/unmap
+#define MEM_SVM_COARSE 3 // coarse-grained SVM, filled through SVM map/unmap
+#define MEM_SVM_FINE   4 // fine-grained SVM, filled directly
+
+static const char *mem_names[] = { "copy", "usehost", "allochost", "svm-coarse", "svm-fine" };
+
 // A parallel min() kernel that works well on CPU and GPU
 
+static void
+usage(const char *prog)
+{
+  printf("usage: %s [-r atomic|single|vec] [-p] [-t] [-g] [-s] [-n items]\n"
+         "       [-m copy|usehost|allochost|svm-coarse|svm-fine] [-i file] [-o file]\n"
+         "       [-w 1|2|4|8|16] [-u unroll] [-a blocked|strided|hybrid]   (-r vec)\n", prog);
+}
+
+// The source is either a buffer or an SVM pointer.
+static void
+set_src_arg(cl_kernel kernel, cl_uint index, const cl_mem *buf, void *svm)
+{
+  if(svm != NULL)
+    clSetKernelArgSVMPointer(kernel, index, svm);
+  else
+    clSetKernelArg(kernel, index, sizeof(void *), (const void *) buf);
+}
+
+// State shared with the autotuner's timing callback.
+struct tune_arg {
+  cl_context context;
+  cl_command_queue queue;
+  cl_kernel minp;
+  cl_kernel reduce;
+  cl_kernel single;
+  cl_mem src_buf;
+  void *src_svm;
+  unsigned int num_src_items;
+  int dev;
+  int reduce_path;
+  struct buffer_pool *pool;
+};
+
+#define TUNE_LOOPS 20
+
+// Arguments of minp, reduce and minp_single, shared by the timing
+// callback and the main loop.
+static void
+set_min_args(const struct tune_arg *t, cl_mem *dst, cl_mem *part, cl_mem *done, cl_mem *dbg)
+{
+  set_src_arg(t->minp, 0, &t->src_buf, t->src_svm);
+  clSetKernelArg(t->minp, 1, sizeof(void *),            (void *) dst);
+  clSetKernelArg(t->minp, 2, 1 * sizeof(cl_uint),       (void *) NULL);
+  clSetKernelArg(t->minp, 3, sizeof(void *),            (void *) dbg);
+  clSetKernelArg(t->minp, 4, sizeof(t->num_src_items),  (void *) &t->num_src_items);
+  clSetKernelArg(t->minp, 5, sizeof(t->dev),            (void *) &t->dev);
+  set_src_arg(t->reduce, 0, &t->src_buf, t->src_svm);
+  clSetKernelArg(t->reduce, 1, sizeof(void *),          (void *) dst);
+  set_src_arg(t->single, 0, &t->src_buf, t->src_svm);
+  clSetKernelArg(t->single, 1, sizeof(void *),          (void *) dst);
+  clSetKernelArg(t->single, 2, sizeof(void *),          (void *) part);
+  clSetKernelArg(t->single, 3, sizeof(void *),          (void *) done);
+  clSetKernelArg(t->single, 4, sizeof(void *),          (void *) dbg);
+  clSetKernelArg(t->single, 5, sizeof(t->num_src_items), (void *) &t->num_src_items);
+  clSetKernelArg(t->single, 6, sizeof(t->dev),          (void *) &t->dev);
+}
+
+// Time one work-size configuration of the selected path. minp derives
+// its per-item count from the global size, so the global size has to
+// divide the number of uint4 items exactly.
+static double
+time_minp(const struct tune_config *cfg, void *p)
+{
+  struct tune_arg *t = (struct tune_arg *) p;
+  size_t global = cfg->global, local = cfg->local;
+  size_t groups = global / local;
+  cl_uint zero = 0;
+  cl_int ret;
+  double elapsed = -1;
+
+  if((t->reduce_path != REDUCE_VEC && (t->num_src_items / 4) % global != 0) ||
+     global % local != 0)
+    return -1;
+
+  // Every configuration needs the same few buffers; the pool hands the
+  // previous configuration's back instead of creating new ones.
+  cl_mem dst = buffer_pool_get(t->pool, CL_MEM_READ_WRITE, groups * sizeof(cl_uint), &ret);
+  cl_mem part = buffer_pool_get(t->pool, CL_MEM_READ_WRITE, groups * sizeof(cl_uint), &ret);
+  cl_mem dbg = buffer_pool_get(t->pool, CL_MEM_WRITE_ONLY, global * sizeof(cl_uint), &ret);
+  cl_mem done = buffer_pool_get(t->pool, CL_MEM_READ_WRITE, sizeof(cl_uint), &ret);
+  if(dst == NULL || part == NULL || dbg == NULL || done == NULL)
+    goto out;
+  if(clEnqueueFillBuffer(t->queue, done, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, NULL) != CL_SUCCESS)
+    goto out;
+
+  set_min_args(t, &dst, &part, &done, &dbg);
+
+  // One untimed launch, then TUNE_LOOPS timed ones.
+  struct timespec start, end;
+  for(int i = 0; i <= TUNE_LOOPS; i++) {
+    if(i == 1) {
+      if(clFinish(t->queue) != CL_SUCCESS)
+        goto out;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    if(t->reduce_path != REDUCE_ATOMIC)
+      ret = clEnqueueNDRangeKernel(t->queue, t->single, 1, NULL, &global, &local, 0, NULL, NULL);
+    else {
+      ret = clEnqueueNDRangeKernel(t->queue, t->minp, 1, NULL, &global, &local, 0, NULL, NULL);
+      if(ret == CL_SUCCESS)
+        ret = clEnqueueNDRangeKernel(t->queue, t->reduce, 1, NULL, &groups, NULL, 0, NULL, NULL);
+    }
+    if(ret != CL_SUCCESS)
+      goto out;
+  }
+  if(clFinish(t->queue) != CL_SUCCESS)
+    goto out;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = ((1.0e9 * (double)(end.tv_sec - start.tv_sec)) + (double)(end.tv_nsec - start.tv_nsec)) / 1e9 / TUNE_LOOPS;
+ out:
+  clFinish(t->queue);
+  if(dst)  buffer_pool_put(t->pool, dst);
+  if(part) buffer_pool_put(t->pool, part);
+  if(dbg)  buffer_pool_put(t->pool, dbg);
+  if(done) buffer_pool_put(t->pool, done);
+  return elapsed;
+}
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Native SIMD min() for result verification, and the CPU baseline to
+// compare the kernels against.
+static cl_uint
+native_reference(const cl_uint *src, unsigned int n)
+{
+  double t = now();
+  cl_uint min = native_min(src, n);
+  t = now() - t;
+  printf("min: %d (native %s, %d threads: %.2f GB/sec)\n", min,
+         native_isa_name(native_isa()), native_threads(), n * sizeof(cl_uint) / t / 1e9);
+  return min;
+}
+
+// One launch of the selected path; the min lands in dst[0].
+static cl_int
+enqueue_min(cl_command_queue queue, int reduce_path, cl_kernel minp, cl_kernel reduce,
+            cl_kernel single, size_t global, size_t local)
+{
+  size_t groups = global / local;
+  if(reduce_path != REDUCE_ATOMIC)
+    return clEnqueueNDRangeKernel(queue, single, 1, NULL, &global, &local, 0, NULL, NULL);
+  cl_int ret = clEnqueueNDRangeKernel(queue, minp, 1, NULL, &global, &local, 0, NULL, NULL);
+  if(ret == CL_SUCCESS)
+    ret = clEnqueueNDRangeKernel(queue, reduce, 1, NULL, &groups, NULL, 0, NULL, NULL);
+  return ret;
+}
+
+// Reads a whole file into a NUL-terminated malloc'ed string, or NULL.
+static char *
+load_source(const char *path)
+{
+  struct stat st;
+  char *buf = NULL;
+  size_t done = 0;
+  int fd = open(path, O_RDONLY);
+  if(fd == -1)
+    return NULL;
+  if(fstat(fd, &st) == -1 || (buf = (char *) malloc(st.st_size + 1)) == NULL)
+    goto out;
+  while(done < (size_t) st.st_size) {
+    ssize_t n = read(fd, buf + done, st.st_size - done);
+    if(n <= 0) {
+      free(buf);
+      buf = NULL;
+      goto out;
+    }
+    done += n;
+  }
+  buf[done] = '\0';
+ out:
+  close(fd);
+  return buf;
+}
+
+static int
+cmp_ulong(const void *a, const void *b)
+{
+  cl_ulong x = *(const cl_ulong *) a, y = *(const cl_ulong *) b;
+  return x < y ? -1 : x > y;
+}
+
+// min / median / p99 of n samples in ns, printed in usec. Sorts in place.
+static void
+print_dist(const char *what, cl_ulong *v, int n)
+{
+  qsort(v, n, sizeof(cl_ulong), cmp_ulong);
+  printf("  %-16s min %9.2f  median %9.2f  p99 %9.2f usec\n", what,
+         v[0] / 1e3, v[n / 2] / 1e3, v[(n * 99) / 100] / 1e3);
+}
+
+// Per-kernel report from QUEUED/SUBMIT/START/END of n profiled events.
+// Releases the events.
+static void
+report_profile(const char *name, cl_event *ev, int n)
+{
+  cl_ulong *exec   = (cl_ulong *) malloc(n * sizeof(cl_ulong));
+  cl_ulong *submit = (cl_ulong *) malloc(n * sizeof(cl_ulong));
+  cl_ulong *launch = (cl_ulong *) malloc(n * sizeof(cl_ulong));
+  cl_ulong busy = 0;
+
+  for(int i = 0; i < n; i++) {
+    cl_ulong queued, submitted, started, ended;
+    clGetEventProfilingInfo(ev[i], CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+    clGetEventProfilingInfo(ev[i], CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submitted, NULL);
+    clGetEventProfilingInfo(ev[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &started, NULL);
+    clGetEventProfilingInfo(ev[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ended, NULL);
+    exec[i] = ended - started;
+    submit[i] = submitted - queued;
+    launch[i] = started - submitted;
+    busy += exec[i];
+    clReleaseEvent(ev[i]);
+  }
+  printf("%s: %d launches, %.3f ms on device\n", name, n, busy / 1e6);
+  print_dist("exec", exec, n);
+  print_dist("queued->submit", submit, n);
+  print_dist("submit->start", launch, n);
+  free(exec);
+  free(submit);
+  free(launch);
+}
+
 int
-main()
+main(int argc, char **argv)
 {
   cl_platform_id  platform;
   cl_device_type devs[NDEVS] = {  CL_DEVICE_TYPE_GPU };
 
   cl_uint *src_ptr;
   unsigned int num_src_items = 4096*4096;
+  int reduce_path = REDUCE_SINGLE;
+  int profile = 0;
+  int tune = 0;
+  int mem_mode = MEM_COPY;
+  int generate = 0;
+  int specialize = 0;
+  unsigned int width = 4, unroll = 1;
+  int pattern = -1; // from dev
+  const char *input_path = NULL, *output_path = NULL;
+  struct dataset input = { 0 };
 
-  // load source file
-  const char *kernel_source;
-  {
-    struct stat stat_buf;
-    const char *source_path = "./parallel_min.cl";
-    char * buf;
-    size_t size;
-    int fd;
-    if(stat(source_path, &stat_buf) == -1) {
-      printf("stat\n");
+  int opt;
+  while((opt = getopt(argc, argv, "r:ptgsm:n:w:u:a:i:o:h")) != -1) {
+    switch(opt) {
+    case 'r':
+      if(strcmp(optarg, "atomic") == 0)
+        reduce_path = REDUCE_ATOMIC;
+      else if(strcmp(optarg, "single") == 0)
+        reduce_path = REDUCE_SINGLE;
+      else if(strcmp(optarg, "vec") == 0)
+        reduce_path = REDUCE_VEC;
+      else {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case 'p':
+      profile = 1;
+      break;
+    case 't':
+      tune = 1;
+      break;
+    case 'g':
+      generate = 1;
+      break;
+    case 's':
+      specialize = 1;
+      break;
+    case 'n':
+      num_src_items = strtoul(optarg, NULL, 0);
+      break;
+    case 'w':
+      width = strtoul(optarg, NULL, 0);
+      if(width == 0 || width > 16 || (width & (width - 1))) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case 'u':
+      unroll = strtoul(optarg, NULL, 0);
+      if(unroll == 0) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case 'a':
+      for(pattern = 0; pattern < 3; pattern++)
+        if(strcmp(optarg, pattern_names[pattern]) == 0)
+          break;
+      if(pattern == 3) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case 'm':
+      for(mem_mode = 0; mem_mode <= MEM_SVM_FINE; mem_mode++)
+        if(strcmp(optarg, mem_names[mem_mode]) == 0)
+          break;
+      if(mem_mode > MEM_SVM_FINE) {
+        usage(argv[0]);
+        return -1;
+      }
+      break;
+    case 'i':
+      input_path = optarg;
+      break;
+    case 'o':
+      output_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
       return -1;
-    };
-    size = stat_buf.st_size;
-    buf = (char *)malloc(size);
-    fd = open(source_path, O_RDONLY);
-    if(read(fd, buf, size) == -1) {
-      printf("read\n");
+    }
+  }
+  // The generated input only ever lives on the device.
+  if(generate && (mem_mode != MEM_COPY || input_path != NULL)) {
+    usage(argv[0]);
+    return -1;
+  }
+  if(num_src_items == 0 || num_src_items > 0x7fffffff) {
+    usage(argv[0]);
+    return -1;
+  }
+
+  // minp_vec is configured at build time; the other kernels ignore these.
+  char build_opts[256] = "-cl-std=CL2.0";
+  char tune_name[64];
+  if(reduce_path == REDUCE_VEC) {
+    char w[8];
+    snprintf(w, sizeof(w), "%u", width); // pasted into vload<W>, no suffix
+    spec_define(build_opts, sizeof(build_opts), "MINP_WIDTH", w);
+    spec_define_uint(build_opts, sizeof(build_opts), "MINP_UNROLL", unroll);
+    if(pattern >= 0)
+      spec_define_uint(build_opts, sizeof(build_opts), "MINP_PATTERN", pattern);
+    snprintf(tune_name, sizeof(tune_name), "minp_vec_w%u_u%u_%s", width, unroll,
+             pattern >= 0 ? pattern_names[pattern] : "dev");
+  }
+  else
+    snprintf(tune_name, sizeof(tune_name), "%s",
+             reduce_path == REDUCE_SINGLE ? "minp_single" : "minp");
+
+  // The kernels are compiled in (embed_cl.sh); $PARALLEL_MIN_CL names a
+  // .cl file to use instead while working on them.
+  const char *kernel_source = parallel_min_cl;
+  char *loaded_source = NULL;
+  const char *source_path = getenv("PARALLEL_MIN_CL");
+  if(source_path != NULL) {
+    if((loaded_source = load_source(source_path)) == NULL) {
+      printf("cannot read %s\n", source_path);
       return -1;
     }
-    kernel_source = buf;
+    kernel_source = loaded_source;
   }
 
   // 1. quick & dirty MWC random init of source buffer.
@@ -49,19 +408,65 @@ main()
   time_t ltime;
   time(&ltime);
 
-  src_ptr = (cl_uint *) malloc(num_src_items * sizeof(cl_uint));
+  // With -i the input is the mapped file instead, untouched until the
+  // device (or the upload) reads it; see the file-to-result time below.
+  double open_time = 0;
+  if(input_path != NULL) {
+    open_time = now();
+    if(dataset_open(&input, input_path, sizeof(cl_uint)) != 0)
+      return -1;
+    open_time = now() - open_time;
+    if(input.count == 0 || input.count > 0x7fffffff) {
+      printf("%s: %zu items, want 1 to 2^31 - 1\n", input_path, input.count);
+      return -1;
+    }
+    if(mem_mode == MEM_USE_HOST && !dataset_aligned(&input)) {
+      printf("%s: data is not page-aligned, -m usehost would copy it\n", input_path);
+      return -1;
+    }
+    src_ptr = (cl_uint *) input.data;
+    num_src_items = (unsigned int) input.count;
+    printf("%s: %u items, mapped in %.2f ms\n", input_path, num_src_items, open_time * 1e3);
+  }
+  // Page-aligned, so that -m usehost can hand it to the device as is.
+  else if(posix_memalign((void **) &src_ptr, 4096, num_src_items * sizeof(cl_uint)) != 0) {
+    printf("malloc\n");
+    return -1;
+  }
+
+  // With -g the device fills its buffer with Philox instead, and the
+  // host runs the same generator only to know the answer.
+  if(generate)
+    generate_philox_uint_host(src_ptr, num_src_items, (uint64_t) ltime);
+  else if(input_path == NULL) {
+    cl_uint a = (cl_uint) ltime, b = (cl_uint) ltime;
+    for(unsigned int i = 0; i < num_src_items; i++)
+      src_ptr[i] = (cl_uint) (b = (a * (b & 65535)) + (b >> 16));
+  }
 
-  cl_uint a = (cl_uint) ltime, b = (cl_uint) ltime;
-  cl_uint min = (cl_uint) - 1;
-  // Do serial computation of min() for result verification.
-  for(unsigned int i = 0; i < num_src_items; i++) {
-    src_ptr[i] = (cl_uint) (b = (a * (b & 65535)) + (b >> 16));
-    min = src_ptr[i] < min ? src_ptr[i] : min;
+  if(output_path != NULL) {
+    if(dataset_write(output_path, src_ptr, sizeof(cl_uint), num_src_items) != 0) {
+      printf("%s: write failed\n", output_path);
+      return -1;
+    }
+    printf("wrote %u items to %s\n", num_src_items, output_path);
   }
-  printf("min: %d\n", min);
 
-  // Get a platform.
-  clGetPlatformIDs(1, &platform, NULL);
+  // 2. Native SIMD min() for result verification, and the CPU baseline.
+  // For a file it runs after the device has read the input, so that it
+  // does not prefault the mapping.
+  cl_uint min = 0;
+  if(input_path == NULL)
+    min = native_reference(src_ptr, num_src_items);
+
+  // Get a platform. Without one the native result is all there is.
+  cl_uint num_platforms = 0;
+  if(clGetPlatformIDs(1, &platform, &num_platforms) != CL_SUCCESS || num_platforms == 0) {
+    printf("no OpenCL platform, native result only\n");
+    if(input_path != NULL)
+      native_reference(src_ptr, num_src_items);
+    return 0;
+  }
 
 
   // 3. Iterate over devices.
@@ -72,15 +477,21 @@ main()
     cl_program     program;
     cl_kernel         minp;
     cl_kernel       reduce;
+    cl_kernel       single;
+    struct buffer_pool *pool;
 
-    cl_mem         src_buf;
+    cl_mem         src_buf = NULL;
+    void          *src_svm = NULL;
     cl_mem         dst_buf;
     cl_mem         dbg_buf;
+    cl_mem         part_buf;
+    cl_mem         done_buf;
 
     cl_uint       *dst_ptr,
                   *dbg_ptr;
 
-    printf("\n%s: ", devs[dev] == CL_DEVICE_TYPE_CPU ? "CPU" : "GPU");
+    printf("\n%s (%s%s): ", devs[dev] == CL_DEVICE_TYPE_CPU ? "CPU" : "GPU",
+           reduce_names[reduce_path], build_opts + strlen("-cl-std=CL2.0"));
     // Find the device.
     clGetDeviceIDs(platform, devs[dev], 1, &device, NULL);
 
@@ -103,12 +514,13 @@ main()
     else {
       cl_uint ws = 64;
       global_work_size = compute_units * 7 * ws; // 7 wavefronts per SIMD
-      while((num_src_items / 4) % global_work_size != 0)
+      // minp_vec takes any global size; the others need it to divide the input.
+      while(reduce_path != REDUCE_VEC &&
+            (num_src_items / 4) % global_work_size != 0 &&
+            global_work_size < num_src_items / 4)
         global_work_size += ws;
       local_work_size = ws;
     }
-    printf("global_work_size : %lu\n", global_work_size);
-    num_groups = global_work_size / local_work_size;
     // Create a context and command queue on that device.
     context = clCreateContext(NULL,
                               1,
@@ -116,26 +528,52 @@ main()
                               NULL,
                               NULL,
                               NULL);
-    queue = clCreateCommandQueue(context, device, 0, NULL);
+    queue = clCreateCommandQueue(context,
+                                 device,
+                                 profile ? CL_QUEUE_PROFILING_ENABLE : 0,
+                                 NULL);
     // Minimal error check.
     if(queue == NULL) {
       printf("Compute device setup failed\n");
       return -1;
     }
+    // Output, partial, ticket and debug buffers come from the pool;
+    // autotuning reuses them across configurations.
+    pool = buffer_pool_create(context, 0);
+    if(pool == NULL) {
+      printf("buffer pool\n");
+      return -1;
+    }
 
-    // Perform runtime source compilation, and obtain kernel entry point.
-    program = clCreateProgramWithSource(context,
-                                        1,
-                                        &kernel_source,
-                                        NULL,
-                                        NULL);
-    // Tell compiler to dump intermediate .il and .isa GPU files.
-    cl_int ret = clBuildProgram(program,
-                                1,
-                                &device,
-                                "-cl-std=CL2.0",
-                                NULL,
-                                NULL);
+    // Perform runtime source compilation (or load the cached binary),
+    // and obtain kernel entry point. The SPIR-V module, when embedded,
+    // was compiled without -D, so minp_vec variants and an overriding
+    // source still go through the source.
+    cl_int ret;
+    program = NULL;
+#ifdef PARALLEL_MIN_SPV
+    if(reduce_path != REDUCE_VEC && loaded_source == NULL)
+      program = program_cache_build_il(context,
+                                       device,
+                                       parallel_min_spv,
+                                       parallel_min_spv_size,
+                                       build_opts,
+                                       &ret);
+    if(program != NULL && ret != CL_SUCCESS) {
+      clReleaseProgram(program);
+      program = NULL;
+    }
+#endif
+    if(program == NULL)
+      program = program_cache_build(context,
+                                    device,
+                                    kernel_source,
+                                    build_opts,
+                                    &ret);
+    if(program == NULL) {
+      printf("create program: %d\n", ret);
+      return -1;
+    }
     // 5. Print compiler error messages
     if(ret != CL_SUCCESS) {
       printf("clBuildProgram failed: %d\n", ret);
@@ -160,43 +598,264 @@ main()
       printf("reduce kernel: %d\n", ret);
       return -1;
     }
+    // The one-launch kernel: minp_single or its configurable minp_vec.
+    single = clCreateKernel(program, reduce_path == REDUCE_VEC ? "minp_vec" : "minp_single", &ret);
+    if(ret != CL_SUCCESS) {
+      printf("%s kernel: %d\n", reduce_path == REDUCE_VEC ? "minp_vec" : "minp_single", ret);
+      return -1;
+    }
     // Create input, output and debug buffer.
-    src_buf = clCreateBuffer(context,
-                             CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                             num_src_items * sizeof(cl_uint),
-                             src_ptr,
-                             &ret);
+    // The input goes through the memory strategy selected with -m.
+    struct timespec setup_start, setup_end;
+    size_t src_size = num_src_items * sizeof(cl_uint);
+    struct generator gen;
+    if(generate && (ret = generator_create(&gen, context, device)) != CL_SUCCESS) {
+      printf("generator: %d\n", ret);
+      return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &setup_start);
+    switch(mem_mode) {
+    case MEM_COPY:
+      if(generate) {
+        src_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, src_size, NULL, &ret);
+        if(ret == CL_SUCCESS)
+          ret = generate_philox_uint(&gen, queue, src_buf, num_src_items, (uint64_t) ltime, NULL);
+        break;
+      }
+      // A file goes up straight from the mapping, in chunks.
+      if(input_path != NULL) {
+        src_buf = clCreateBuffer(context, CL_MEM_READ_ONLY, src_size, NULL, &ret);
+        if(ret == CL_SUCCESS)
+          ret = dataset_upload(&input, queue, src_buf, 0);
+        break;
+      }
+      src_buf = clCreateBuffer(context,
+                               CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                               src_size,
+                               src_ptr,
+                               &ret);
+      break;
+    case MEM_USE_HOST:
+      src_buf = clCreateBuffer(context,
+                               CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                               src_size,
+                               src_ptr,
+                               &ret);
+      break;
+    case MEM_ALLOC_HOST:
+      src_buf = clCreateBuffer(context,
+                               CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                               src_size,
+                               NULL,
+                               &ret);
+      if(ret == CL_SUCCESS) {
+        void *p = clEnqueueMapBuffer(queue, src_buf, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+                                     0, src_size, 0, NULL, NULL, &ret);
+        if(ret == CL_SUCCESS) {
+          memcpy(p, src_ptr, src_size);
+          ret = clEnqueueUnmapMemObject(queue, src_buf, p, 0, NULL, NULL);
+        }
+      }
+      break;
+    case MEM_SVM_COARSE:
+    case MEM_SVM_FINE: {
+      cl_device_svm_capabilities caps = 0;
+      if(clGetDeviceInfo(device, CL_DEVICE_SVM_CAPABILITIES, sizeof(caps), &caps, NULL) != CL_SUCCESS ||
+         !(caps & (mem_mode == MEM_SVM_FINE ? CL_DEVICE_SVM_FINE_GRAIN_BUFFER
+                                            : CL_DEVICE_SVM_COARSE_GRAIN_BUFFER))) {
+        ret = CL_INVALID_OPERATION;
+        break;
+      }
+      src_svm = clSVMAlloc(context,
+                           CL_MEM_READ_ONLY |
+                           (mem_mode == MEM_SVM_FINE ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0),
+                           src_size,
+                           0);
+      if(src_svm == NULL) {
+        ret = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+        break;
+      }
+      if(mem_mode == MEM_SVM_COARSE)
+        ret = clEnqueueSVMMap(queue, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+                              src_svm, src_size, 0, NULL, NULL);
+      else
+        ret = CL_SUCCESS;
+      if(ret == CL_SUCCESS) {
+        memcpy(src_svm, src_ptr, src_size);
+        if(mem_mode == MEM_SVM_COARSE)
+          ret = clEnqueueSVMUnmap(queue, src_svm, 0, NULL, NULL);
+      }
+      break;
+    }
+    }
+    if(ret == CL_SUCCESS)
+      ret = clFinish(queue);
     if(ret != CL_SUCCESS) {
-      printf("create src buffer: %d\n", ret);
+      printf("create src buffer (%s): %d\n", mem_names[mem_mode], ret);
       return -1;
     }
-    dst_buf = clCreateBuffer(context,
-                             CL_MEM_READ_WRITE,
-                             num_groups * sizeof(cl_uint),
-                             NULL,
-                             &ret);
+    clock_gettime(CLOCK_MONOTONIC, &setup_end);
+    if(generate)
+      generator_release(&gen);
+    double setup_time = ((1.0e9 * (double)(setup_end.tv_sec - setup_start.tv_sec)) +
+                         (double)(setup_end.tv_nsec - setup_start.tv_nsec)) / 1e9;
+    printf("memory mode %s: setup %.2f ms\n", generate ? "philox on device" : mem_names[mem_mode],
+           setup_time * 1e3);
+
+    // Replace the heuristic with a measured work size: search now with -t,
+    // otherwise reuse what an earlier -t run stored for this device.
+    {
+      const char *name = tune_name;
+      struct tune_config cfg;
+      int found;
+      if(tune) {
+        struct tune_arg arg = { context, queue, minp, reduce, single, src_buf,
+                                src_svm, num_src_items, dev, reduce_path, pool };
+        size_t max_local;
+        clGetKernelWorkGroupInfo(reduce_path != REDUCE_ATOMIC ? single : minp,
+                                 device,
+                                 CL_KERNEL_WORK_GROUP_SIZE,
+                                 sizeof(max_local),
+                                 &max_local,
+                                 NULL);
+        found = autotune_search(device, name, num_src_items / 4, max_local,
+                                time_minp, &arg, &cfg) == 0;
+      }
+      else
+        found = autotune_load(device, name, num_src_items / 4, &cfg) == 0 &&
+                (reduce_path == REDUCE_VEC || (num_src_items / 4) % cfg.global == 0) &&
+                cfg.global % cfg.local == 0;
+      if(found) {
+        printf("tuned work size: global %zu local %zu\n", cfg.global, cfg.local);
+        global_work_size = cfg.global;
+        local_work_size = cfg.local;
+      }
+    }
+
+    // With -s, rebuild with the count and access pattern as constants,
+    // compare it with the generic build and run the specialized one.
+    // minp_vec strides over any size and has no per-item count, so only
+    // SPEC_DEV applies to -r vec.
+    if(specialize) {
+      char opts[256];
+      snprintf(opts, sizeof(opts), "%s", build_opts);
+      if(reduce_path != REDUCE_VEC)
+        spec_define_uint(opts, sizeof(opts), "SPEC_COUNT", (num_src_items / 4) / global_work_size);
+      else
+        printf("specialization: -r vec has no per-item count, only SPEC_DEV applies\n");
+      spec_define_uint(opts, sizeof(opts), "SPEC_DEV", dev);
+      cl_program spec = spec_build(context, device, kernel_source, opts, &ret);
+      if(spec == NULL || ret != CL_SUCCESS) {
+        printf("specialized build (%s): %d\n", opts, ret);
+        return -1;
+      }
+      struct tune_arg generic = { context, queue, minp, reduce, single, src_buf,
+                                  src_svm, num_src_items, dev, reduce_path, pool };
+      struct tune_arg special = generic;
+      const char *single_name = reduce_path == REDUCE_VEC ? "minp_vec" : "minp_single";
+      special.minp = clCreateKernel(spec, "minp", &ret);
+      if(ret != CL_SUCCESS) {
+        printf("specialized minp kernel: %d\n", ret);
+        return -1;
+      }
+      special.reduce = clCreateKernel(spec, "reduce", &ret);
+      if(ret != CL_SUCCESS) {
+        printf("specialized reduce kernel: %d\n", ret);
+        return -1;
+      }
+      special.single = clCreateKernel(spec, single_name, &ret);
+      if(ret != CL_SUCCESS) {
+        printf("specialized %s kernel: %d\n", single_name, ret);
+        return -1;
+      }
+      struct tune_config cfg = { global_work_size, local_work_size, 0, 0 };
+      double tg = time_minp(&cfg, &generic);
+      double ts = time_minp(&cfg, &special);
+      if(tg < 0 || ts < 0)
+        printf("specialization: global size does not divide the input, not timed\n");
+      else
+        printf("specialization%s: generic %.2f usec, specialized %.2f usec (%.2fx)\n",
+               opts + strlen("-cl-std=CL2.0"), tg * 1e6, ts * 1e6, tg / ts);
+      clReleaseKernel(minp);
+      clReleaseKernel(reduce);
+      clReleaseKernel(single);
+      minp   = special.minp;
+      reduce = special.reduce;
+      single = special.single;
+      clReleaseProgram(spec);
+    }
+    printf("global_work_size : %lu\n", global_work_size);
+    if(reduce_path != REDUCE_VEC &&
+       (num_src_items % 4 != 0 || (num_src_items / 4) % global_work_size != 0)) {
+      printf("-r %s needs (items / 4) %% global_work_size == 0; -r vec takes any size\n",
+             reduce_names[reduce_path]);
+      return -1;
+    }
+    num_groups = global_work_size / local_work_size;
+    dst_buf = buffer_pool_get(pool,
+                              CL_MEM_READ_WRITE,
+                              num_groups * sizeof(cl_uint),
+                              &ret);
     if(ret != CL_SUCCESS) {
       printf("create dst buffer: %d\n", ret);
       return -1;
     }
-    dbg_buf = clCreateBuffer(context,
-                             CL_MEM_WRITE_ONLY,
-                             global_work_size * sizeof(cl_uint),
-                             NULL,
-                             &ret);
+    dbg_buf = buffer_pool_get(pool,
+                              CL_MEM_WRITE_ONLY,
+                              global_work_size * sizeof(cl_uint),
+                              &ret);
     if(ret != CL_SUCCESS) {
       printf("create dbg buffer: %d\n", ret);
       return -1;
     }
-    clSetKernelArg(minp, 0, sizeof(void *),        (void *) &src_buf);
-    clSetKernelArg(minp, 1, sizeof(void *),        (void *) &dst_buf);
-    clSetKernelArg(minp, 2, 1 * sizeof(cl_uint),   (void *) NULL);
-    clSetKernelArg(minp, 3, sizeof(void *),        (void *) &dbg_buf);
-    clSetKernelArg(minp, 4, sizeof(num_src_items), (void *) &num_src_items);
-    clSetKernelArg(minp, 5, sizeof(dev),           (void *) &dev);
+    // Per-group partials and the ticket counter of the single-pass path.
+    part_buf = buffer_pool_get(pool,
+                               CL_MEM_READ_WRITE,
+                               num_groups * sizeof(cl_uint),
+                               &ret);
+    if(ret != CL_SUCCESS) {
+      printf("create partial buffer: %d\n", ret);
+      return -1;
+    }
+    cl_uint zero = 0;
+    done_buf = buffer_pool_get(pool,
+                               CL_MEM_READ_WRITE,
+                               sizeof(cl_uint),
+                               &ret);
+    if(ret == CL_SUCCESS)
+      ret = clEnqueueFillBuffer(queue, done_buf, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, NULL);
+    if(ret != CL_SUCCESS) {
+      printf("create done buffer: %d\n", ret);
+      return -1;
+    }
+    {
+      struct tune_arg arg = { context, queue, minp, reduce, single, src_buf,
+                              src_svm, num_src_items, dev, reduce_path, pool };
+      set_min_args(&arg, &dst_buf, &part_buf, &done_buf, &dbg_buf);
+    }
 
-    clSetKernelArg(reduce, 0, sizeof(void *), (void *) &src_buf);
-    clSetKernelArg(reduce, 1, sizeof(void *), (void *) &dst_buf);
+    // -i: file to result is the mapping, the setup above and the first
+    // launch with its result read back. Only then does the host read the
+    // file for the reference min.
+    if(input_path != NULL) {
+      cl_uint result = 0;
+      double t = now();
+      ret = enqueue_min(queue, reduce_path, minp, reduce, single, global_work_size, local_work_size);
+      if(ret == CL_SUCCESS)
+        ret = clEnqueueReadBuffer(queue, dst_buf, CL_TRUE, 0, sizeof(cl_uint), &result, 0, NULL, NULL);
+      if(ret != CL_SUCCESS) {
+        printf("first launch %d\n", ret);
+        return -1;
+      }
+      t = now() - t;
+      double total = open_time + setup_time + t;
+      printf("file to result: %.2f ms (map %.2f, setup %.2f, min + read back %.2f), %.2f GB/sec\n",
+             total * 1e3, open_time * 1e3, setup_time * 1e3, t * 1e3,
+             dataset_bytes(&input) / total / 1e9);
+      min = native_reference(src_ptr, num_src_items);
+      if(result != min)
+        printf("first result INcorrect: %d\n", result);
+    }
 
     struct timespec start;
     clock_gettime(CLOCK_MONOTONIC, &start);
@@ -207,10 +866,30 @@ main()
     // 6. Main timing loop.
     #define NLOOPS 500
 
+    // With -p every event is kept for the profiling report.
     cl_event ev;
+    cl_event minp_ev[NLOOPS];
+    cl_event reduce_ev[NLOOPS];
     int nloops = NLOOPS;
 
     while(nloops--) {
+      int i = NLOOPS - 1 - nloops;
+      if(reduce_path != REDUCE_ATOMIC) {
+        cl_int ret = clEnqueueNDRangeKernel(queue,
+                               single,
+                               1,
+                               NULL,
+                               &global_work_size,
+                               &local_work_size,
+                               0,
+                               NULL,
+                               profile ? &minp_ev[i] : NULL);
+        if (ret != CL_SUCCESS) {
+          printf("%s %d\n", reduce_path == REDUCE_VEC ? "minp_vec" : "minp_single", ret);
+          return -1;
+        }
+        continue;
+      }
       cl_int ret = clEnqueueNDRangeKernel(queue,
                              minp,
                              1,
@@ -232,11 +911,15 @@ main()
                              NULL,
                              1,
                              &ev,
-                             NULL);
+                             profile ? &reduce_ev[i] : NULL);
       if (ret != CL_SUCCESS) {
         printf("reduce %d\n", ret);
         return -1;
       }
+      if(profile)
+        minp_ev[i] = ev;
+      else
+        clReleaseEvent(ev);
     }
     ret =  clFinish(queue);
     if (ret != CL_SUCCESS) {
@@ -249,6 +932,42 @@ main()
 
     printf("B/W %.2f GB/sec, ", ((float) num_src_items * sizeof(cl_uint) * NLOOPS) / elapsed / 1e9);
 
+    // Split the wall time into device time per kernel and launch overhead.
+    if(profile) {
+      // Roofline: the traffic of each kernel, including the partials
+      // and the reduce pass, against the measured peak of the device.
+      double src_bytes = (double) num_src_items * sizeof(cl_uint);
+      double part_bytes = (double) num_groups * sizeof(cl_uint);
+      struct roofline_peak peak;
+      struct roofline roof;
+      roofline_init(&roof);
+      for(int i = 0; i < NLOOPS; i++) {
+        if(reduce_path != REDUCE_ATOMIC)
+          // src, then the last group reads back the partials.
+          roofline_record_event(&roof, reduce_path == REDUCE_VEC ? "minp_vec" : "minp_single",
+                                minp_ev[i], src_bytes + part_bytes, part_bytes + sizeof(cl_uint),
+                                num_src_items + num_groups);
+        else {
+          roofline_record_event(&roof, "minp", minp_ev[i], src_bytes, part_bytes, num_src_items);
+          // Each atom_min reads and writes gmin[0].
+          roofline_record_event(&roof, "reduce", reduce_ev[i], 2 * part_bytes, part_bytes, num_groups);
+        }
+      }
+
+      printf("\nwall %.3f ms for %d iterations\n", elapsed * 1e3, NLOOPS);
+      if(reduce_path != REDUCE_ATOMIC)
+        report_profile(reduce_path == REDUCE_VEC ? "minp_vec" : "minp_single", minp_ev, NLOOPS);
+      else {
+        report_profile("minp", minp_ev, NLOOPS);
+        report_profile("reduce", reduce_ev, NLOOPS);
+      }
+      ret = roofline_measure_peak(context, device, queue, &peak);
+      if(ret != CL_SUCCESS)
+        printf("roofline peak %d\n", ret);
+      else
+        roofline_print(&roof, &peak);
+    }
+
     // 7. Look at the results via synchronous buffer map.
     dst_ptr = (cl_uint *) clEnqueueMapBuffer(queue,
                                              dst_buf,
@@ -282,8 +1001,21 @@ main()
       printf("result correct\n");
     else
       printf("result INcorrect\n");
+
+    clEnqueueUnmapMemObject(queue, dst_buf, dst_ptr, 0, NULL, NULL);
+    clEnqueueUnmapMemObject(queue, dbg_buf, dbg_ptr, 0, NULL, NULL);
+    clFinish(queue);
+    buffer_pool_put(pool, dst_buf);
+    buffer_pool_put(pool, dbg_buf);
+    buffer_pool_put(pool, part_buf);
+    buffer_pool_put(pool, done_buf);
+    buffer_pool_print_stats(pool);
+    buffer_pool_destroy(pool);
   }
 
   printf("\n");
+  if(input_path != NULL)
+    dataset_close(&input);
+  free(loaded_source);
   return 0;
 }
@@ -1,6 +1,20 @@
 #pragma OPENCL EXTENSION cl_khr_local_int32_extended_atmics : enable
 #pragma OPENCL EXTENSION cl_khr_global_int32_extended_atmics : enable
 
+// 15. Compile-time specialization (see specialize.h). The host may bake
+// the per-item count and the access pattern in with -DSPEC_COUNT and
+// -DSPEC_DEV; otherwise they come from the kernel arguments.
+#ifdef SPEC_COUNT
+#define COUNT SPEC_COUNT
+#else
+#define COUNT ((nitems / 4) / get_global_size(0))
+#endif
+#ifdef SPEC_DEV
+#define DEV SPEC_DEV
+#else
+#define DEV dev
+#endif
+
 // 9. The source buffer is accessed as 4-vectors.
 __kernel void minp(
                    __global uint4 *src,
@@ -11,10 +25,10 @@ __kernel void minp(
                    uint dev)
 {
   // 10. Set up global memory access pattern.
-  uint count = (nitems / 4) / get_global_size(0);
-  uint idx = (dev == 0) ? get_global_id(0) * count
+  uint count = COUNT;
+  uint idx = (DEV == 0) ? get_global_id(0) * count
                         : get_global_id(0);
-  uint stride = (dev == 0) ? 1  : get_global_size(0);
+  uint stride = (DEV == 0) ? 1  : get_global_size(0);
   uint pmin = (uint) -1;
 
   // 11. First, compute private min, for this work-item.
@@ -51,3 +65,183 @@ kernel void reduce(
 {
   (void) atom_min(gmin, gmin[get_global_id(0)]);
 }
+
+// 14. Single-pass variant of minp + reduce.
+// The work-group min is computed with work_group_reduce_min() instead of
+// a contended atom_min on local memory. Each group writes its partial to
+// __global and takes a ticket; the last group to finish reduces all
+// partials and writes the final value to gmin[0], so one launch suffices.
+__kernel void minp_single(
+                   __global uint4 *src,
+                   __global uint *gmin,
+                   __global uint *partial,
+                   __global atomic_uint *done,
+                   __global uint *dbg,
+                   int nitems,
+                   uint dev)
+{
+  __local uint last;
+  uint count = COUNT;
+  uint idx = (DEV == 0) ? get_global_id(0) * count
+                        : get_global_id(0);
+  uint stride = (DEV == 0) ? 1  : get_global_size(0);
+  uint pmin = (uint) -1;
+
+  for(int n = 0; n < count; n++, idx += stride)
+  {
+    pmin = min(pmin, src[idx].x);
+    pmin = min(pmin, src[idx].y);
+    pmin = min(pmin, src[idx].z);
+    pmin = min(pmin, src[idx].w);
+  }
+
+  // Reduce inside the work-group, publish the partial, take a ticket.
+  pmin = work_group_reduce_min(pmin);
+  if(get_local_id(0) == 0) {
+    partial[get_group_id(0)] = pmin;
+    uint ticket = atomic_fetch_add_explicit(done, 1,
+                                            memory_order_acq_rel,
+                                            memory_scope_device);
+    last = (ticket == get_num_groups(0) - 1);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+  // The last group sees every partial; reduce them to the final value.
+  if(last) {
+    uint m = (uint) -1;
+    for(uint i = get_local_id(0); i < get_num_groups(0); i += get_local_size(0))
+      m = min(m, partial[i]);
+    m = work_group_reduce_min(m);
+    if(get_local_id(0) == 0) {
+      gmin[0] = m;
+      // Re-arm the ticket counter for the next launch.
+      atomic_store_explicit(done, 0, memory_order_relaxed, memory_scope_device);
+    }
+  }
+  if(get_global_id(0) == 0) {
+    dbg[0] = get_num_groups(0);
+    dbg[1] = get_global_size(0);
+    dbg[2] = count;
+    dbg[3] = stride;
+  }
+}
+
+// 16. minp_single with the load width, unrolling and access pattern
+// picked at build time, and no restriction on nitems.
+//   MINP_WIDTH    uints per load: 1, 2, 4, 8 or 16 (default 4)
+//   MINP_UNROLL   loads per loop iteration (default 1)
+//   MINP_PATTERN  0 blocked: each work-item scans one contiguous range
+//                 1 strided: work-item i reads vectors i, i + G, i + 2G, ...
+//                 2 hybrid:  work-item i reads MINP_UNROLL consecutive
+//                            vectors per tile, tiles i, i + G, ...
+//                 (default: blocked if dev == 0, else strided)
+// where G is the global size. The last nitems % MINP_WIDTH uints are
+// read one by one.
+#ifndef MINP_WIDTH
+#define MINP_WIDTH 4
+#endif
+#ifndef MINP_UNROLL
+#define MINP_UNROLL 1
+#endif
+#ifdef MINP_PATTERN
+#define PATTERN MINP_PATTERN
+#else
+#define PATTERN (DEV == 0 ? 0 : 1)
+#endif
+
+#define CAT_(a, b) a ## b
+#define CAT(a, b) CAT_(a, b)
+
+#if MINP_WIDTH == 1
+#define VTYPE uint
+#define LOAD(i) src[i]
+#define HMIN(v) (v)
+#else
+#define VTYPE CAT(uint, MINP_WIDTH)
+#define LOAD(i) CAT(vload, MINP_WIDTH)(i, src)
+#define HMIN(v) CAT(hmin, MINP_WIDTH)(v)
+#endif
+
+uint hmin2(uint2 v)   { return min(v.x, v.y); }
+uint hmin4(uint4 v)   { return min(hmin2(v.lo), hmin2(v.hi)); }
+uint hmin8(uint8 v)   { return min(hmin4(v.lo), hmin4(v.hi)); }
+uint hmin16(uint16 v) { return min(hmin8(v.lo), hmin8(v.hi)); }
+
+__kernel void minp_vec(
+                   __global uint *src,
+                   __global uint *gmin,
+                   __global uint *partial,
+                   __global atomic_uint *done,
+                   __global uint *dbg,
+                   int nitems,
+                   uint dev)
+{
+  __local uint last;
+  uint gid = get_global_id(0);
+  uint gsize = get_global_size(0);
+  uint nvec = (uint) nitems / MINP_WIDTH;
+  VTYPE vmin = (VTYPE) (uint) -1;
+  uint i;
+
+  if(PATTERN == 0) {
+    // Ranges of ceil(nvec / G) vectors; the last ones may be short or empty.
+    uint per = (nvec + gsize - 1) / gsize;
+    uint end = min(nvec, (gid + 1) * per);
+    for(i = min(nvec, gid * per); i + MINP_UNROLL <= end; i += MINP_UNROLL)
+      for(uint u = 0; u < MINP_UNROLL; u++)
+        vmin = min(vmin, LOAD(i + u));
+    for(; i < end; i++)
+      vmin = min(vmin, LOAD(i));
+  }
+  else if(PATTERN == 1) {
+    for(i = gid; i + (MINP_UNROLL - 1) * gsize < nvec; i += MINP_UNROLL * gsize)
+      for(uint u = 0; u < MINP_UNROLL; u++)
+        vmin = min(vmin, LOAD(i + u * gsize));
+    for(; i < nvec; i += gsize)
+      vmin = min(vmin, LOAD(i));
+  }
+  else {
+    for(uint t = gid; t * MINP_UNROLL < nvec; t += gsize) {
+      i = t * MINP_UNROLL;
+      if(i + MINP_UNROLL <= nvec)
+        for(uint u = 0; u < MINP_UNROLL; u++)
+          vmin = min(vmin, LOAD(i + u));
+      else
+        for(; i < nvec; i++) // the one partial tile at the end
+          vmin = min(vmin, LOAD(i));
+    }
+  }
+  uint pmin = HMIN(vmin);
+
+  // Tail: the uints after the last full vector.
+  for(i = nvec * MINP_WIDTH + gid; i < (uint) nitems; i += gsize)
+    pmin = min(pmin, src[i]);
+
+  // From here on as minp_single.
+  pmin = work_group_reduce_min(pmin);
+  if(get_local_id(0) == 0) {
+    partial[get_group_id(0)] = pmin;
+    uint ticket = atomic_fetch_add_explicit(done, 1,
+                                            memory_order_acq_rel,
+                                            memory_scope_device);
+    last = (ticket == get_num_groups(0) - 1);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+
+  if(last) {
+    uint m = (uint) -1;
+    for(uint j = get_local_id(0); j < get_num_groups(0); j += get_local_size(0))
+      m = min(m, partial[j]);
+    m = work_group_reduce_min(m);
+    if(get_local_id(0) == 0) {
+      gmin[0] = m;
+      atomic_store_explicit(done, 0, memory_order_relaxed, memory_scope_device);
+    }
+  }
+  if(gid == 0) {
+    dbg[0] = get_num_groups(0);
+    dbg[1] = gsize;
+    dbg[2] = nvec;
+    dbg[3] = PATTERN;
+  }
+}
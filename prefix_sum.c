@@ -0,0 +1,179 @@
+#define CL_TARGET_OPENCL_VERSION 200
+
+#include <CL/cl.h>
+#include "scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Exclusive scan, inclusive scan and compaction (keep src[i] < -t) with
+// scan.c over MWC random data, each checked against the host and timed.
+// Throughput counts the traffic of the reduce-then-scan passes: src read
+// twice and the result written once (the kept elements only, for
+// compaction).
+
+#define NLOOPS 20
+
+static void
+usage(const char *prog)
+{
+  printf("usage: %s [-n items] [-t threshold]\n", prog);
+}
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+#define OP_EXCLUSIVE 0
+#define OP_INCLUSIVE 1
+#define OP_COMPACT   2
+
+static const char *op_names[] = { "exclusive scan", "inclusive scan", "compact" };
+
+static cl_int
+run(struct scan *scan, cl_command_queue queue, int op, cl_mem src, cl_mem dst, size_t n,
+    cl_uint threshold, cl_uint *count)
+{
+  switch(op) {
+  case OP_EXCLUSIVE: return scan_exclusive(scan, queue, src, dst, n, NULL);
+  case OP_INCLUSIVE: return scan_inclusive(scan, queue, src, dst, n, NULL);
+  default:           return scan_compact(scan, queue, src, dst, n, threshold, count, NULL);
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  size_t n = (size_t) 1 << 26;
+  cl_uint threshold = 1u << 30;
+  int c;
+
+  while((c = getopt(argc, argv, "n:t:")) != -1) {
+    switch(c) {
+    case 'n': n = strtoull(optarg, NULL, 0); break;
+    case 't': threshold = (cl_uint) strtoul(optarg, NULL, 0); break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(n == 0 || n > ((size_t) 1 << 31)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // 1. quick & dirty MWC random init of source buffer.
+  cl_uint *src = (cl_uint *) malloc(n * sizeof(cl_uint));
+  cl_uint *dst = (cl_uint *) malloc(n * sizeof(cl_uint));
+  cl_uint *expect = (cl_uint *) malloc(n * sizeof(cl_uint));
+  if(src == NULL || dst == NULL || expect == NULL) {
+    printf("malloc\n");
+    return -1;
+  }
+  cl_uint a = (cl_uint) time(NULL), b = a;
+  for(size_t i = 0; i < n; i++)
+    src[i] = b = (a * (b & 65535)) + (b >> 16);
+
+  // 2. Platform, device, context, queue.
+  cl_platform_id platform;
+  cl_device_id device;
+  cl_uint num_platforms = 0;
+  cl_int ret;
+  if(clGetPlatformIDs(1, &platform, &num_platforms) != CL_SUCCESS || num_platforms == 0) {
+    printf("no OpenCL platform\n");
+    return -1;
+  }
+  if(clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, NULL) != CL_SUCCESS) {
+    printf("clGetDeviceIDs\n");
+    return -1;
+  }
+  cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, &ret);
+  if(ret != CL_SUCCESS) {
+    printf("clCreateContext %d\n", ret);
+    return -1;
+  }
+  cl_command_queue queue = clCreateCommandQueueWithProperties(context, device, NULL, &ret);
+  if(ret != CL_SUCCESS) {
+    printf("clCreateCommandQueueWithProperties %d\n", ret);
+    return -1;
+  }
+
+  // 3. Kernels and buffers.
+  struct scan scan;
+  ret = scan_create(&scan, context, device);
+  if(ret != CL_SUCCESS) {
+    printf("scan_create %d\n", ret);
+    return -1;
+  }
+  cl_mem src_buf = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  n * sizeof(cl_uint), src, &ret);
+  cl_mem dst_buf = NULL;
+  if(ret == CL_SUCCESS)
+    dst_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_uint), NULL, &ret);
+  if(ret != CL_SUCCESS) {
+    printf("clCreateBuffer %d\n", ret);
+    return -1;
+  }
+  printf("%zu items, local size %zu, tile %zu\n", n, scan.local, scan.local * SCAN_ITEMS);
+
+  // 4. Each operation: host reference, one checked run, then NLOOPS timed.
+  int correct = 1;
+  for(int op = OP_EXCLUSIVE; op <= OP_COMPACT; op++) {
+    size_t expect_count = n;
+    cl_uint count = (cl_uint) n;
+    double t = now();
+    if(op == OP_EXCLUSIVE)
+      scan_exclusive_host(src, expect, n);
+    else if(op == OP_INCLUSIVE)
+      scan_inclusive_host(src, expect, n);
+    else
+      expect_count = scan_compact_host(src, expect, n, threshold);
+    double host = now() - t;
+
+    ret = run(&scan, queue, op, src_buf, dst_buf, n, threshold, &count);
+    // A compaction may keep nothing (-t 0), and a zero-size read is an error.
+    if(ret == CL_SUCCESS && count > 0)
+      ret = clEnqueueReadBuffer(queue, dst_buf, CL_TRUE, 0, count * sizeof(cl_uint), dst,
+                                0, NULL, NULL);
+    if(ret != CL_SUCCESS) {
+      printf("%s %d\n", op_names[op], ret);
+      return -1;
+    }
+    int ok = count == expect_count &&
+             (count == 0 || memcmp(dst, expect, count * sizeof(cl_uint)) == 0);
+    correct &= ok;
+
+    t = now();
+    for(int i = 0; i < NLOOPS && ret == CL_SUCCESS; i++)
+      ret = run(&scan, queue, op, src_buf, dst_buf, n, threshold, NULL);
+    clFinish(queue);
+    t = (now() - t) / NLOOPS;
+    if(ret != CL_SUCCESS) {
+      printf("%s %d\n", op_names[op], ret);
+      return -1;
+    }
+
+    double bytes = (2.0 * n + count) * sizeof(cl_uint);
+    printf("%s: %u launches, %.3f ms, %.2f Gitems/sec, B/W %.2f GB/sec (host %.3f ms)",
+           op_names[op], scan.launches, t * 1e3, n / t / 1e9, bytes / t / 1e9, host * 1e3);
+    if(op == OP_COMPACT)
+      printf(", kept %u", count);
+    printf(", result %s\n", ok ? "correct" : "INcorrect");
+  }
+
+  clReleaseMemObject(src_buf);
+  clReleaseMemObject(dst_buf);
+  scan_release(&scan);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  free(src);
+  free(dst);
+  free(expect);
+  return correct ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+// clCreateProgramWithIL is OpenCL 2.1; only builds that embed SPIR-V
+// (embed_cl.sh -s, with -DPROGRAM_CACHE_IL) need a loader that has it.
+#ifdef PROGRAM_CACHE_IL
+#define CL_TARGET_OPENCL_VERSION 210
+#else
+#define CL_TARGET_OPENCL_VERSION 110
+#endif
+
+#include "program_cache.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "CLBC"
+
+static double
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// 64-bit FNV-1a, chained over several strings.
+static uint64_t
+fnv1a(uint64_t h, const char *s)
+{
+  if(s == NULL)
+    s = "";
+  for(; *s; s++) {
+    h ^= (unsigned char) *s;
+    h *= 0x100000001b3ULL;
+  }
+  // Separator so that ("ab", "c") and ("a", "bc") differ.
+  h ^= 0xff;
+  h *= 0x100000001b3ULL;
+  return h;
+}
+
+uint64_t
+program_cache_device_hash(cl_device_id device)
+{
+  char name[256] = "", version[256] = "", driver[256] = "", pversion[256] = "";
+  cl_platform_id platform;
+
+  clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(version), version, NULL);
+  clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+  clGetPlatformInfo(platform, CL_PLATFORM_VERSION, sizeof(pversion), pversion, NULL);
+
+  uint64_t h = 0xcbf29ce484222325ULL;
+  h = fnv1a(h, name);
+  h = fnv1a(h, version);
+  h = fnv1a(h, driver);
+  h = fnv1a(h, pversion);
+  return h;
+}
+
+static uint64_t
+cache_key(cl_device_id device, const char *source, const char *options)
+{
+  uint64_t h = program_cache_device_hash(device);
+  h = fnv1a(h, source);
+  h = fnv1a(h, options);
+  return h;
+}
+
+#ifdef PROGRAM_CACHE_IL
+// IL modules are hashed byte for byte, then tagged so that they never
+// share a key with a source of the same bytes.
+static uint64_t
+cache_key_il(cl_device_id device, const unsigned char *il, size_t size, const char *options)
+{
+  uint64_t h = program_cache_device_hash(device);
+  for(size_t i = 0; i < size; i++) {
+    h ^= il[i];
+    h *= 0x100000001b3ULL;
+  }
+  h = fnv1a(h, "il");
+  h = fnv1a(h, options);
+  return h;
+}
+#endif
+
+// mkdir -p; returns 0 on success.
+static int
+make_dirs(char *path)
+{
+  for(char *p = path + 1; *p; p++) {
+    if(*p != '/')
+      continue;
+    *p = '\0';
+    if(mkdir(path, 0755) == -1 && errno != EEXIST) {
+      *p = '/';
+      return -1;
+    }
+    *p = '/';
+  }
+  if(mkdir(path, 0755) == -1 && errno != EEXIST)
+    return -1;
+  return 0;
+}
+
+int
+program_cache_dir(char *dir, size_t size)
+{
+  const char *env = getenv("OPENCL_CACHE_DIR");
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+
+  if(env != NULL)
+    snprintf(dir, size, "%s", env);
+  else if(xdg != NULL)
+    snprintf(dir, size, "%s/opencl-learner", xdg);
+  else if(home != NULL)
+    snprintf(dir, size, "%s/.cache/opencl-learner", home);
+  else
+    return -1;
+  return make_dirs(dir);
+}
+
+// Fills `path` with the cache file name for `key`, creating the directory.
+static int
+cache_path(uint64_t key, char *path, size_t size)
+{
+  char dir[4000];
+  if(program_cache_dir(dir, sizeof(dir)) != 0)
+    return -1;
+  snprintf(path, size, "%s/%016llx.bin", dir, (unsigned long long) key);
+  return 0;
+}
+
+// Reads a cache file; returns a malloc'ed binary or NULL.
+static unsigned char *
+load_binary(const char *path, uint64_t key, size_t *size)
+{
+  FILE *fp = fopen(path, "rb");
+  if(fp == NULL)
+    return NULL;
+
+  char magic[4];
+  uint64_t stored_key;
+  uint64_t len;
+  unsigned char *bin = NULL;
+  if(fread(magic, 1, 4, fp) != 4 || memcmp(magic, CACHE_MAGIC, 4) != 0 ||
+     fread(&stored_key, sizeof(stored_key), 1, fp) != 1 || stored_key != key ||
+     fread(&len, sizeof(len), 1, fp) != 1 || len == 0)
+    goto out;
+  bin = (unsigned char *) malloc(len);
+  if(bin == NULL)
+    goto out;
+  if(fread(bin, 1, len, fp) != len) {
+    free(bin);
+    bin = NULL;
+    goto out;
+  }
+  *size = len;
+ out:
+  fclose(fp);
+  return bin;
+}
+
+// Writes to a temporary file and renames it, so concurrent runs never see
+// a partial binary.
+static void
+store_binary(const char *path, uint64_t key, const unsigned char *bin, size_t size)
+{
+  char tmp[4200];
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int) getpid());
+  FILE *fp = fopen(tmp, "wb");
+  if(fp == NULL)
+    return;
+
+  uint64_t len = size;
+  int ok = fwrite(CACHE_MAGIC, 1, 4, fp) == 4 &&
+           fwrite(&key, sizeof(key), 1, fp) == 1 &&
+           fwrite(&len, sizeof(len), 1, fp) == 1 &&
+           fwrite(bin, 1, size, fp) == size;
+  if(fclose(fp) != 0)
+    ok = 0;
+  if(!ok || rename(tmp, path) != 0)
+    unlink(tmp);
+}
+
+static cl_program
+build_from_binary(cl_context context, cl_device_id device,
+                  const unsigned char *bin, size_t size, const char *options)
+{
+  cl_int status, ret;
+  cl_program program = clCreateProgramWithBinary(context, 1, &device,
+                                                 &size, &bin, &status, &ret);
+  if(ret != CL_SUCCESS || status != CL_SUCCESS) {
+    if(program != NULL)
+      clReleaseProgram(program);
+    return NULL;
+  }
+  if(clBuildProgram(program, 1, &device, options, NULL, NULL) != CL_SUCCESS) {
+    clReleaseProgram(program);
+    return NULL;
+  }
+  return program;
+}
+
+static void
+save_program(cl_program program, const char *path, uint64_t key)
+{
+  size_t size = 0;
+  if(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS ||
+     size == 0)
+    return;
+  unsigned char *bin = (unsigned char *) malloc(size);
+  if(bin == NULL)
+    return;
+  if(clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(bin), &bin, NULL) == CL_SUCCESS)
+    store_binary(path, key, bin, size);
+  free(bin);
+}
+
+// Cache lookup, then `create` and a build on a miss. `what` names the
+// input in the message.
+static cl_program
+cached_build(cl_context context, cl_device_id device, uint64_t key, const char *options,
+             const char *source, const void *il, size_t il_size, const char *what,
+             cl_int *errcode_ret)
+{
+  double start = now_ms();
+  const char *mode = getenv("OPENCL_CACHE");
+  int enabled = mode == NULL || strcmp(mode, "off") != 0;
+  char path[4096];
+  cl_program program;
+  cl_int ret;
+
+  if(enabled && cache_path(key, path, sizeof(path)) != 0)
+    enabled = 0;
+
+  // 1. Warm start: reuse the binary from an earlier run.
+  if(enabled) {
+    size_t size;
+    unsigned char *bin = load_binary(path, key, &size);
+    if(bin != NULL) {
+      program = build_from_binary(context, device, bin, size, options);
+      free(bin);
+      if(program != NULL) {
+        printf("program cache: hit, %.1f ms\n", now_ms() - start);
+        if(errcode_ret)
+          *errcode_ret = CL_SUCCESS;
+        return program;
+      }
+      // Rejected (driver update, corrupt file): drop it and rebuild.
+      unlink(path);
+    }
+  }
+
+  // 2. Cold build from source or IL.
+#ifdef PROGRAM_CACHE_IL
+  if(il != NULL)
+    program = clCreateProgramWithIL(context, il, il_size, &ret);
+  else
+#else
+  (void) il;
+  (void) il_size;
+#endif
+    program = clCreateProgramWithSource(context, 1, &source, NULL, &ret);
+  if(ret != CL_SUCCESS) {
+    if(errcode_ret)
+      *errcode_ret = ret;
+    return NULL;
+  }
+  ret = clBuildProgram(program, 1, &device, options, NULL, NULL);
+  if(errcode_ret)
+    *errcode_ret = ret;
+  if(ret != CL_SUCCESS)
+    return program;
+  if(enabled)
+    save_program(program, path, key);
+  printf("program cache: %s, built from %s in %.1f ms\n",
+         enabled ? "miss" : "off", what, now_ms() - start);
+  return program;
+}
+
+cl_program
+program_cache_build(cl_context context,
+                    cl_device_id device,
+                    const char *source,
+                    const char *options,
+                    cl_int *errcode_ret)
+{
+  return cached_build(context, device, cache_key(device, source, options), options,
+                      source, NULL, 0, "source", errcode_ret);
+}
+
+#ifdef PROGRAM_CACHE_IL
+int
+program_cache_il_supported(cl_device_id device)
+{
+  char il[256] = "";
+  if(clGetDeviceInfo(device, CL_DEVICE_IL_VERSION, sizeof(il), il, NULL) != CL_SUCCESS)
+    return 0;
+  return strstr(il, "SPIR-V") != NULL;
+}
+
+cl_program
+program_cache_build_il(cl_context context,
+                       cl_device_id device,
+                       const void *il,
+                       size_t size,
+                       const char *options,
+                       cl_int *errcode_ret)
+{
+  if(!program_cache_il_supported(device)) {
+    if(errcode_ret)
+      *errcode_ret = CL_INVALID_OPERATION;
+    return NULL;
+  }
+  return cached_build(context, device,
+                      cache_key_il(device, (const unsigned char *) il, size, options), options,
+                      NULL, il, size, "SPIR-V", errcode_ret);
+}
+#endif
@@ -0,0 +1,58 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <CL/cl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// On-disk cache of program binaries.
+//
+// Binaries are keyed by a hash of the source, the build options, the
+// device name and version, the driver version and the platform version,
+// and stored under $OPENCL_CACHE_DIR (default ~/.cache/opencl-learner).
+// Set OPENCL_CACHE=off to always build from source.
+
+// Build `source` for `device`, loading a cached binary through
+// clCreateProgramWithBinary when there is one and falling back to a build
+// from source on a miss or when the binary is rejected. Prints whether the
+// program came from the cache and how long it took.
+// On CL_BUILD_PROGRAM_FAILURE the program is still returned so the caller
+// can fetch the build log; on other errors NULL is returned.
+cl_program program_cache_build(cl_context context,
+                               cl_device_id device,
+                               const char *source,
+                               const char *options,
+                               cl_int *errcode_ret);
+
+#ifdef PROGRAM_CACHE_IL
+// The same for an offline-compiled SPIR-V module (see embed_cl.sh),
+// through clCreateProgramWithIL. Returns NULL with CL_INVALID_OPERATION,
+// before creating anything, when the device takes no SPIR-V; callers fall
+// back to program_cache_build() with the source.
+cl_program program_cache_build_il(cl_context context,
+                                  cl_device_id device,
+                                  const void *il,
+                                  size_t size,
+                                  const char *options,
+                                  cl_int *errcode_ret);
+
+// Non-zero when CL_DEVICE_IL_VERSION lists SPIR-V (OpenCL 2.1 and up).
+int program_cache_il_supported(cl_device_id device);
+#endif
+
+// Cache directory, created if missing; returns 0 on success. Shared with
+// other per-device caches such as autotune.c.
+int program_cache_dir(char *dir, size_t size);
+
+// Hash of device name and version, driver version and platform version.
+uint64_t program_cache_device_hash(cl_device_id device);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
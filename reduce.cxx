@@ -0,0 +1,147 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+
+#include "reduction.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using namespace reduction;
+
+// Exercises every (op, type) of reduction.hpp against the serial host
+// reference and prints the bandwidth the same way parallel_min does.
+
+#define NLOOPS 100
+
+////////////////////////////////////////////////////////////////
+// Globals
+////////////////////////////////////////////////////////////////
+cl_uint length = 4096 * 4096;
+
+cl::Context context;
+cl::Device device;
+cl::CommandQueue queue;
+
+////////////////////////////////////////////////////////////////
+// Quick & dirty MWC random init, as in parallel_min
+////////////////////////////////////////////////////////////////
+template<typename T>
+std::vector<T> initHost()
+{
+  std::vector<T> data(length);
+  cl_uint a = (cl_uint) time(NULL), b = a;
+  for(cl_uint i = 0; i < length; i++)
+    {
+      b = (a * (b & 65535)) + (b >> 16);
+      // Small magnitudes keep device float sums close to the host one.
+      if(std::numeric_limits<T>::is_integer)
+        data[i] = (T) b;
+      else
+        data[i] = (T) (b & 0xff) / (T) 256;
+    }
+  return data;
+}
+
+template<typename T>
+bool same(T a, T b)
+{
+  if(std::numeric_limits<T>::is_integer)
+    return a == b;
+  return std::fabs((double) a - (double) b) <= 1e-4 * std::fabs((double) b);
+}
+
+////////////////////////////////////////////////////////////////
+// Run one reduction, time NLOOPS launches and verify
+////////////////////////////////////////////////////////////////
+template<typename Op, typename T, int W>
+bool run(const std::vector<T> &host, const cl::Buffer &buf)
+{
+  Reduction<Op, T, W> red(context, device);
+  Result<T> expect = Host<Op, T>::reduce(host.data(), length);
+
+  red.enqueue(queue, buf, length); // warm up
+  queue.finish();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(int i = 0; i < NLOOPS; i++)
+    red.enqueue(queue, buf, length);
+  queue.finish();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  Result<T> got = red.result(queue);
+
+  bool ok = same(got.value, expect.value) && (!Op::isArg || got.index == expect.index);
+  cout << Reduction<Op, T, W>::name() << ": B/W "
+       << (double) length * sizeof(T) * NLOOPS / elapsed / 1e9 << " GB/sec, "
+       << "value " << got.value;
+  if(Op::isArg)
+    cout << " @ " << got.index;
+  cout << (ok ? ", result correct" : ", result INcorrect") << endl;
+  return ok;
+}
+
+template<typename T>
+bool runType()
+{
+  std::vector<T> host = initHost<T>();
+  cl::Buffer buf(context,
+                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                 sizeof(T) * length,
+                 host.data());
+  bool ok = true;
+  ok &= run<Min, T, 4>(host, buf);
+  ok &= run<Max, T, 4>(host, buf);
+  ok &= run<Sum, T, 4>(host, buf);
+  ok &= run<ArgMin, T, 4>(host, buf);
+  ok &= run<ArgMax, T, 4>(host, buf);
+  return ok;
+}
+
+int main(int argc, char * argv[])
+{
+  try
+    {
+      if(argc > 1)
+        length = (cl_uint) strtoul(argv[1], NULL, 0);
+
+      device = cl::Device::getDefault();
+      context = cl::Context(device);
+      queue = cl::CommandQueue(context, device);
+      cout << device.getInfo<CL_DEVICE_NAME>() << ", " << length << " items" << endl;
+
+      bool ok = true;
+      ok &= runType<cl_uint>();
+      ok &= runType<cl_int>();
+      ok &= runType<cl_float>();
+      if(device.getInfo<CL_DEVICE_EXTENSIONS>().find("cl_khr_fp64") != string::npos)
+        ok &= runType<cl_double>();
+      else
+        cout << "double: cl_khr_fp64 not supported, skipped" << endl;
+      // Odd length and widths other than 4 exercise the tail path.
+      {
+        cl_uint full = length;
+        length = full - 3;
+        std::vector<cl_uint> host = initHost<cl_uint>();
+        cl::Buffer buf(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint) * length, host.data());
+        ok &= run<Min, cl_uint, 1>(host, buf);
+        ok &= run<Min, cl_uint, 8>(host, buf);
+        ok &= run<ArgMin, cl_uint, 16>(host, buf);
+        length = full;
+      }
+      return ok ? 0 : 1;
+    }
+  catch(cl::Error &err)
+    {
+      cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << endl;
+    }
+  catch(string msg)
+    {
+      cerr << "Exception caught in main(): " << msg << endl;
+    }
+  return 1;
+}
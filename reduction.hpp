@@ -0,0 +1,553 @@
+#ifndef REDUCTION_HPP
+#define REDUCTION_HPP
+
+////////////////////////////////////////////////////////////////
+// Generic single-pass reductions.
+//
+// Reduction<Op, T, W> generates the OpenCL source for one
+// (operation, element type, vector width) triple, builds it and runs it
+// the way parallel_min does: each work-item reduces a blocked (CPU) or
+// grid-strided (GPU) slice with W-wide loads, the work-group reduces in
+// local memory, and the last group to finish reduces the per-group
+// partials, so one launch yields the final value.
+//
+//   Reduction<ArgMin, cl_float, 4> argmin(context, device);
+//   Result<cl_float> r = argmin(queue, buf, n);  // r.value, r.index
+////////////////////////////////////////////////////////////////
+
+#include <CL/opencl.hpp>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace reduction {
+
+////////////////////////////////////////////////////////////////
+// Element types: OpenCL C spelling and limits.
+////////////////////////////////////////////////////////////////
+template<typename T> struct TypeTraits;
+
+template<> struct TypeTraits<cl_uint>
+{
+  static const char * name()    { return "uint"; }
+  static const char * maxval()  { return "UINT_MAX"; }
+  static const char * minval()  { return "0"; }
+  static const char * pragma()  { return ""; }
+};
+
+template<> struct TypeTraits<cl_int>
+{
+  static const char * name()    { return "int"; }
+  static const char * maxval()  { return "INT_MAX"; }
+  static const char * minval()  { return "INT_MIN"; }
+  static const char * pragma()  { return ""; }
+};
+
+template<> struct TypeTraits<cl_float>
+{
+  static const char * name()    { return "float"; }
+  static const char * maxval()  { return "INFINITY"; }
+  static const char * minval()  { return "-INFINITY"; }
+  static const char * pragma()  { return ""; }
+};
+
+template<> struct TypeTraits<cl_double>
+{
+  static const char * name()    { return "double"; }
+  static const char * maxval()  { return "INFINITY"; }
+  static const char * minval()  { return "-INFINITY"; }
+  static const char * pragma()  { return "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"; }
+};
+
+template<typename T>
+T hostMax()
+{
+  return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                              : std::numeric_limits<T>::max();
+}
+
+template<typename T>
+T hostMin()
+{
+  return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity()
+                                              : std::numeric_limits<T>::lowest();
+}
+
+////////////////////////////////////////////////////////////////
+// Operations.
+//
+// Value ops define combine(a, b) in OpenCL C and on the host; they
+// accumulate whole vectors. Arg ops define better(a, b) and carry the
+// index of the winning element (lowest index on ties).
+////////////////////////////////////////////////////////////////
+struct Min
+{
+  static const bool isArg = false;
+  static const char * name()    { return "min"; }
+  static const char * combine() { return "min(a, b)"; }
+  template<typename T> static T identityHost()         { return hostMax<T>(); }
+  template<typename T> static const char * identity()  { return TypeTraits<T>::maxval(); }
+  template<typename T> static T apply(T a, T b)        { return b < a ? b : a; }
+};
+
+struct Max
+{
+  static const bool isArg = false;
+  static const char * name()    { return "max"; }
+  static const char * combine() { return "max(a, b)"; }
+  template<typename T> static T identityHost()         { return hostMin<T>(); }
+  template<typename T> static const char * identity()  { return TypeTraits<T>::minval(); }
+  template<typename T> static T apply(T a, T b)        { return b > a ? b : a; }
+};
+
+struct Sum
+{
+  static const bool isArg = false;
+  static const char * name()    { return "sum"; }
+  static const char * combine() { return "(a) + (b)"; }
+  template<typename T> static T identityHost()         { return T(0); }
+  template<typename T> static const char * identity()  { return "0"; }
+  template<typename T> static T apply(T a, T b)        { return a + b; }
+};
+
+struct ArgMin
+{
+  static const bool isArg = true;
+  static const char * name()    { return "argmin"; }
+  static const char * better()  { return "(a) < (b)"; }
+  template<typename T> static T identityHost()         { return hostMax<T>(); }
+  template<typename T> static const char * identity()  { return TypeTraits<T>::maxval(); }
+  template<typename T> static bool isBetter(T a, T b)  { return a < b; }
+};
+
+struct ArgMax
+{
+  static const bool isArg = true;
+  static const char * name()    { return "argmax"; }
+  static const char * better()  { return "(a) > (b)"; }
+  template<typename T> static T identityHost()         { return hostMin<T>(); }
+  template<typename T> static const char * identity()  { return TypeTraits<T>::minval(); }
+  template<typename T> static bool isBetter(T a, T b)  { return a > b; }
+};
+
+template<typename T>
+struct Result
+{
+  T value;
+  cl_uint index; // only meaningful for ArgMin / ArgMax
+};
+
+////////////////////////////////////////////////////////////////
+// Kernel source generation
+////////////////////////////////////////////////////////////////
+namespace detail {
+
+inline const char * lane(int i)
+{
+  static const char * lanes[16] = { "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+                                    "s8", "s9", "sa", "sb", "sc", "sd", "se", "sf" };
+  return lanes[i];
+}
+
+template<typename Op, bool isArg = Op::isArg> struct OpSource;
+
+// Value ops: accumulate whole vectors, fold the lanes at the end.
+template<typename Op> struct OpSource<Op, false>
+{
+  static void defines(std::ostringstream &os)
+  {
+    os << "#define COMBINE(a, b) " << Op::combine() << "\n"
+       << "#define ACC(v, i, x, k) v = COMBINE(v, x)\n";
+  }
+  static void fold(std::ostringstream &os, int w)
+  {
+    os << "  T v = IDENT;\n  uint vi = 0;\n";
+    if(w == 1)
+      os << "  v = acc;\n";
+    else
+      for(int i = 0; i < w; i++)
+        os << "  v = COMBINE(v, acc." << lane(i) << ");\n";
+  }
+};
+
+// Arg ops: keep (value, index) per lane, pick the best lane at the end.
+template<typename Op> struct OpSource<Op, true>
+{
+  static void defines(std::ostringstream &os)
+  {
+    os << "#define BETTER(a, b) (" << Op::better() << ")\n"
+       << "#define ACC(v, i, x, k) { VI m = BETTER(x, v); v = select(v, x, m); i = select(i, (VU)(k), m); }\n";
+  }
+  static void fold(std::ostringstream &os, int w)
+  {
+    os << "  T v = IDENT;\n  uint vi = UINT_MAX;\n";
+    if(w == 1)
+      os << "  combine(&v, &vi, acc, acci);\n";
+    else
+      for(int i = 0; i < w; i++)
+        os << "  if(acci." << lane(i) << " != UINT_MAX)\n"
+           << "    combine(&v, &vi, acc." << lane(i) << ", acci." << lane(i) << " * W + " << i << ");\n";
+  }
+};
+
+// The source is a cl::Buffer, or anything with setArg(kernel, index)
+// such as the SharedBuffer of shared_buffer.hpp.
+inline void setSource(cl::Kernel &kernel, cl_uint index, const cl::Buffer &src)
+{
+  kernel.setArg(index, src);
+}
+
+template<typename Src>
+void setSource(cl::Kernel &kernel, cl_uint index, const Src &src)
+{
+  src.setArg(kernel, index);
+}
+
+} // namespace detail
+
+template<typename Op, typename T, int W = 4>
+class Reduction
+{
+public:
+  ////////////////////////////////////////////////////////////////
+  // OpenCL C source for this (Op, T, W)
+  ////////////////////////////////////////////////////////////////
+  static std::string source()
+  {
+    std::ostringstream os;
+    std::string t = TypeTraits<T>::name();
+    std::string vt = W == 1 ? t : t + std::to_string(W);
+    // select() needs a signed integer mask of the element width.
+    std::string it = sizeof(T) == 8 ? "long" : "int";
+    std::string ut = sizeof(T) == 8 ? "ulong" : "uint";
+    if(W > 1) {
+      it += std::to_string(W);
+      ut += std::to_string(W);
+    }
+
+    os << TypeTraits<T>::pragma()
+       << "#define T " << t << "\n"
+       << "#define TV " << vt << "\n"
+       << "#define VI " << it << "\n"
+       << "#define VU " << ut << "\n"
+       << "#define W " << W << "\n"
+       << "#define IDENT ((T) " << Op::template identity<T>() << ")\n";
+    if(W == 1)
+      os << "#define LOAD(k, p) (p)[k]\n";
+    else
+      os << "#define LOAD(k, p) vload" << W << "(k, p)\n";
+    detail::OpSource<Op>::defines(os);
+
+    os <<
+      "\n"
+      "inline void combine(T *v, uint *vi, T x, uint xi)\n"
+      "{\n"
+      "#ifdef BETTER\n"
+      "  if(BETTER(x, *v) || (x == *v && xi < *vi)) { *v = x; *vi = xi; }\n"
+      "#else\n"
+      "  *v = COMBINE(*v, x);\n"
+      "#endif\n"
+      "}\n"
+      "\n"
+      // Tree reduction of (lv, li) in local memory, local size is a power of 2.
+      "inline void group_reduce(__local T *lv, __local uint *li, T *v, uint *vi)\n"
+      "{\n"
+      "  uint lid = get_local_id(0);\n"
+      "  lv[lid] = *v;\n"
+      "  li[lid] = *vi;\n"
+      "  barrier(CLK_LOCAL_MEM_FENCE);\n"
+      "  for(uint s = get_local_size(0) / 2; s > 0; s >>= 1) {\n"
+      "    if(lid < s) {\n"
+      "      combine(v, vi, lv[lid + s], li[lid + s]);\n"
+      "      lv[lid] = *v;\n"
+      "      li[lid] = *vi;\n"
+      "    }\n"
+      "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+      "  }\n"
+      "  *v = lv[0];\n"
+      "  *vi = li[0];\n"
+      "}\n"
+      "\n"
+      "__kernel void reduce_single(__global const T *src,\n"
+      "                            uint nitems,\n"
+      "                            uint dev,\n"
+      "                            __global T *partial_v,\n"
+      "                            __global uint *partial_i,\n"
+      "                            __global atomic_uint *done,\n"
+      "                            __global T *result_v,\n"
+      "                            __global uint *result_i,\n"
+      "                            uint slot,\n"
+      "                            __local T *lv,\n"
+      "                            __local uint *li)\n"
+      "{\n"
+      "  __local uint last;\n"
+      "  uint nvec = nitems / W;\n"
+      "  uint gid = get_global_id(0);\n"
+      "  uint gsize = get_global_size(0);\n"
+      // Same access patterns as minp: blocked on CPU, grid-strided on GPU.
+      "  uint chunk = (nvec + gsize - 1) / gsize;\n"
+      "  uint k = (dev == 0) ? gid * chunk : gid;\n"
+      "  uint end = (dev == 0) ? min(nvec, k + chunk) : nvec;\n"
+      "  uint step = (dev == 0) ? 1 : gsize;\n"
+      "  TV acc = (TV) IDENT;\n"
+      "  VU acci = (VU) UINT_MAX;\n"
+      "  for(; k < end; k += step) {\n"
+      "    TV x = LOAD(k, src);\n"
+      "    ACC(acc, acci, x, k);\n"
+      "  }\n";
+    detail::OpSource<Op>::fold(os, W);
+    os <<
+      // Elements past the last full vector.
+      "  for(uint t = nvec * W + gid; t < nitems; t += gsize)\n"
+      "    combine(&v, &vi, src[t], t);\n"
+      "\n"
+      "  group_reduce(lv, li, &v, &vi);\n"
+      "  if(get_local_id(0) == 0) {\n"
+      "    partial_v[get_group_id(0)] = v;\n"
+      "    partial_i[get_group_id(0)] = vi;\n"
+      "    uint ticket = atomic_fetch_add_explicit(done, 1,\n"
+      "                                            memory_order_acq_rel,\n"
+      "                                            memory_scope_device);\n"
+      "    last = (ticket == get_num_groups(0) - 1);\n"
+      "  }\n"
+      "  barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);\n"
+      "  if(!last)\n"
+      "    return;\n"
+      "\n"
+      "  v = IDENT;\n"
+      "  vi = UINT_MAX;\n"
+      "  for(uint g = get_local_id(0); g < get_num_groups(0); g += get_local_size(0))\n"
+      "    combine(&v, &vi, partial_v[g], partial_i[g]);\n"
+      "  group_reduce(lv, li, &v, &vi);\n"
+      "  if(get_local_id(0) == 0) {\n"
+      "    result_v[slot] = v;\n"
+      "    result_i[slot] = vi;\n"
+      "    atomic_store_explicit(done, 0, memory_order_relaxed, memory_scope_device);\n"
+      "  }\n"
+      "}\n";
+    return os.str();
+  }
+
+  static std::string name()
+  {
+    return std::string(Op::name()) + "<" + TypeTraits<T>::name() + ", " + std::to_string(W) + ">";
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // Build the program and size the launch for this device
+  ////////////////////////////////////////////////////////////////
+  Reduction(const cl::Context &context, const cl::Device &device)
+    : context_(context), device_(device)
+  {
+    program_ = build(context_, device_);
+    init();
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // Share a program from build(): every instance has its own kernel
+  // object and partials, so instances can run concurrently.
+  ////////////////////////////////////////////////////////////////
+  Reduction(const cl::Context &context, const cl::Device &device, const cl::Program &program)
+    : context_(context), device_(device), program_(program)
+  {
+    init();
+  }
+
+  static cl::Program build(const cl::Context &context, const cl::Device &device)
+  {
+    cl::Program::Sources sources = { source() };
+    cl::Program program(context, sources);
+    try
+      {
+        program.build(std::vector<cl::Device>(1, device), "-cl-std=CL2.0");
+      }
+    catch(cl::Error &err)
+      {
+        if(err.err() == CL_BUILD_PROGRAM_FAILURE)
+          throw(std::string("Build of " + name() + " failed:\n" +
+                       program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device)));
+        throw;
+      }
+    return program;
+  }
+
+private:
+  void init()
+  {
+    kernel_ = cl::Kernel(program_, "reduce_single");
+
+    // Same heuristic as parallel_min: one work-item per core on CPUs,
+    // 7 wavefronts per SIMD on GPUs.
+    cl_uint computeUnits = device_.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    cpu_ = device_.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU;
+    if(cpu_)
+      {
+        local_ = 1;
+        global_ = computeUnits;
+      }
+    else
+      {
+        local_ = 64;
+        global_ = computeUnits * 7 * local_;
+      }
+
+    cl_uint zero = 0;
+    done_     = cl::Buffer(context_, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint), &zero);
+    resultV_  = cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(T));
+    resultI_  = cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    setWorkSize(global_, local_);
+  }
+
+public:
+  ////////////////////////////////////////////////////////////////
+  // Override the launch geometry. local must be a power of 2 and
+  // divide global.
+  ////////////////////////////////////////////////////////////////
+  void setWorkSize(size_t global, size_t local)
+  {
+    if(local == 0 || (local & (local - 1)) != 0 || global % local != 0)
+      throw(std::string("Reduction: local size must be a power of 2 dividing the global size"));
+    global_ = global;
+    local_ = local;
+    groups_ = global_ / local_;
+    partialV_ = cl::Buffer(context_, CL_MEM_READ_WRITE, groups_ * sizeof(T));
+    partialI_ = cl::Buffer(context_, CL_MEM_READ_WRITE, groups_ * sizeof(cl_uint));
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // Enqueue one reduction of the first n elements of src
+  ////////////////////////////////////////////////////////////////
+  template<typename Src>
+  void enqueue(const cl::CommandQueue &queue, const Src &src, cl_uint n,
+               const std::vector<cl::Event> *wait = NULL, cl::Event *ev = NULL)
+  {
+    setArgs(src, n, resultV_, resultI_, 0);
+    launch(queue, wait, ev);
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // Same, but write the result to outV[slot] / outI[slot], e.g. one
+  // slot per chunk when partial results are combined later.
+  // Launches sharing one Reduction must not overlap (in-order queue).
+  ////////////////////////////////////////////////////////////////
+  template<typename Src>
+  void enqueueTo(const cl::CommandQueue &queue, const Src &src, cl_uint n,
+                 const cl::Buffer &outV, const cl::Buffer &outI, cl_uint slot,
+                 const std::vector<cl::Event> *wait = NULL, cl::Event *ev = NULL)
+  {
+    setArgs(src, n, outV, outI, slot);
+    launch(queue, wait, ev);
+  }
+
+  // Blocking read of the result of the last enqueue().
+  Result<T> result(const cl::CommandQueue &queue)
+  {
+    Result<T> r;
+    queue.enqueueReadBuffer(resultV_, CL_TRUE, 0, sizeof(T), &r.value);
+    queue.enqueueReadBuffer(resultI_, CL_TRUE, 0, sizeof(cl_uint), &r.index);
+    return r;
+  }
+
+  template<typename Src>
+  Result<T> operator()(const cl::CommandQueue &queue, const Src &src, cl_uint n)
+  {
+    enqueue(queue, src, n);
+    return result(queue);
+  }
+
+  size_t globalSize() const { return global_; }
+  size_t localSize() const { return local_; }
+
+private:
+  template<typename Src>
+  void setArgs(const Src &src, cl_uint n,
+               const cl::Buffer &outV, const cl::Buffer &outI, cl_uint slot)
+  {
+    cl_uint dev = cpu_ ? 0 : 1;
+    detail::setSource(kernel_, 0, src);
+    kernel_.setArg(1, n);
+    kernel_.setArg(2, dev);
+    kernel_.setArg(3, partialV_);
+    kernel_.setArg(4, partialI_);
+    kernel_.setArg(5, done_);
+    kernel_.setArg(6, outV);
+    kernel_.setArg(7, outI);
+    kernel_.setArg(8, slot);
+    kernel_.setArg(9, cl::Local(local_ * sizeof(T)));
+    kernel_.setArg(10, cl::Local(local_ * sizeof(cl_uint)));
+  }
+
+  void launch(const cl::CommandQueue &queue, const std::vector<cl::Event> *wait, cl::Event *ev)
+  {
+    queue.enqueueNDRangeKernel(kernel_, cl::NullRange, cl::NDRange(global_), cl::NDRange(local_), wait, ev);
+  }
+
+  cl::Context context_;
+  cl::Device device_;
+  cl::Program program_;
+  cl::Kernel kernel_;
+  cl::Buffer partialV_;
+  cl::Buffer partialI_;
+  cl::Buffer done_;
+  cl::Buffer resultV_;
+  cl::Buffer resultI_;
+  size_t global_;
+  size_t local_;
+  size_t groups_;
+  bool cpu_;
+};
+
+////////////////////////////////////////////////////////////////
+// Serial host reference, used for verification
+////////////////////////////////////////////////////////////////
+template<typename Op, typename T, bool isArg = Op::isArg> struct Host;
+
+// Host accumulator: double for floating point; for integer sums the
+// unsigned type, which wraps like the device (signed overflow is
+// undefined on the host); T for integer min and max.
+template<typename Op, typename T, bool isInteger = std::numeric_limits<T>::is_integer>
+struct HostAcc
+{
+  typedef cl_double type;
+};
+
+template<typename Op, typename T> struct HostAcc<Op, T, true>
+{
+  typedef typename std::conditional<std::is_same<Op, Sum>::value,
+                                    typename std::make_unsigned<T>::type, T>::type type;
+};
+
+template<typename Op, typename T> struct Host<Op, T, false>
+{
+  typedef typename HostAcc<Op, T>::type Acc;
+
+  static Result<T> reduce(const T *src, cl_uint n)
+  {
+    Acc acc = Op::template identityHost<Acc>();
+    for(cl_uint i = 0; i < n; i++)
+      acc = Op::apply(acc, (Acc) src[i]);
+    Result<T> r = { (T) acc, 0 };
+    return r;
+  }
+};
+
+template<typename Op, typename T> struct Host<Op, T, true>
+{
+  static Result<T> reduce(const T *src, cl_uint n)
+  {
+    Result<T> r = { Op::template identityHost<T>(), (cl_uint) -1 };
+    for(cl_uint i = 0; i < n; i++)
+      if(Op::isBetter(src[i], r.value))
+        {
+          r.value = src[i];
+          r.index = i;
+        }
+    return r;
+  }
+};
+
+} // namespace reduction
+
+#endif
@@ -0,0 +1,227 @@
+#define CL_TARGET_OPENCL_VERSION 120
+
+#include "roofline.h"
+#include "program_cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ROOFLINE_TRIALS    5
+#define ROOFLINE_MAX_BYTES ((size_t) 256 << 20) // per triad array
+#define ROOFLINE_MAD_ITERS 4096
+#define ROOFLINE_MAD_ITEMS 4096                 // per compute unit
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+// mad_peak runs four independent float4 chains so that latency does not
+// hide the throughput; a = a * s + 0.5 with s < 1 stays finite.
+static const char *source =
+  "#define ROOFLINE_MAD_ITERS " XSTR(ROOFLINE_MAD_ITERS) "\n"
+  "\n"
+  "kernel void triad(global float4 *a, global const float4 *b,\n"
+  "                  global const float4 *c, float s)\n"
+  "{\n"
+  "  uint i = get_global_id(0);\n"
+  "  a[i] = b[i] + s * c[i];\n"
+  "}\n"
+  "\n"
+  "kernel void mad_peak(global float *out, float s)\n"
+  "{\n"
+  "  float4 a = (float4) (get_global_id(0) * 1e-6f, 1.f, 2.f, 3.f);\n"
+  "  float4 b = a + 1.f, c = a + 2.f, d = a + 3.f;\n"
+  "  for(int i = 0; i < ROOFLINE_MAD_ITERS; i++) {\n"
+  "    a = mad(a, s, 0.5f);\n"
+  "    b = mad(b, s, 0.5f);\n"
+  "    c = mad(c, s, 0.5f);\n"
+  "    d = mad(d, s, 0.5f);\n"
+  "  }\n"
+  "  out[get_global_id(0)] = dot(a + b, c + d);\n"
+  "}\n";
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Shortest of ROOFLINE_TRIALS runs after a warm-up, or < 0 on error.
+static double
+best_time(cl_command_queue queue, cl_kernel kernel, size_t global)
+{
+  double best = -1;
+  for(int t = 0; t <= ROOFLINE_TRIALS; t++) {
+    double start = now();
+    if(clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, NULL, 0, NULL, NULL) != CL_SUCCESS ||
+       clFinish(queue) != CL_SUCCESS)
+      return -1;
+    double elapsed = now() - start;
+    if(t > 0 && (best < 0 || elapsed < best))
+      best = elapsed;
+  }
+  return best;
+}
+
+cl_int
+roofline_measure_peak(cl_context context, cl_device_id device, cl_command_queue queue,
+                      struct roofline_peak *peak)
+{
+  cl_ulong max_alloc, global_mem;
+  cl_uint units;
+  cl_program program = NULL;
+  cl_kernel triad = NULL, mad = NULL;
+  cl_mem a = NULL, b = NULL, c = NULL, out = NULL;
+  cl_float one = 1.f, s = 0.999f;
+  double t;
+  cl_int ret;
+
+  ret = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+  if(ret == CL_SUCCESS)
+    ret = clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, NULL);
+  if(ret == CL_SUCCESS)
+    ret = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL);
+  if(ret != CL_SUCCESS)
+    return ret;
+
+  // Three arrays, well clear of the caches, that fit the device.
+  size_t bytes = ROOFLINE_MAX_BYTES;
+  if(bytes > max_alloc)
+    bytes = (size_t) max_alloc;
+  if(bytes > global_mem / 4)
+    bytes = (size_t) (global_mem / 4);
+  bytes &= ~(size_t) 15;
+  size_t items = (size_t) units * ROOFLINE_MAD_ITEMS;
+
+  program = program_cache_build(context, device, source, NULL, &ret);
+  if(ret == CL_SUCCESS)
+    triad = clCreateKernel(program, "triad", &ret);
+  if(ret == CL_SUCCESS)
+    mad = clCreateKernel(program, "mad_peak", &ret);
+  if(ret == CL_SUCCESS)
+    a = clCreateBuffer(context, CL_MEM_WRITE_ONLY, bytes, NULL, &ret);
+  if(ret == CL_SUCCESS)
+    b = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, &ret);
+  if(ret == CL_SUCCESS)
+    c = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, &ret);
+  if(ret == CL_SUCCESS)
+    out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, items * sizeof(cl_float), NULL, &ret);
+  if(ret == CL_SUCCESS)
+    ret = clEnqueueFillBuffer(queue, b, &one, sizeof(one), 0, bytes, 0, NULL, NULL);
+  if(ret == CL_SUCCESS)
+    ret = clEnqueueFillBuffer(queue, c, &one, sizeof(one), 0, bytes, 0, NULL, NULL);
+
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(triad, 0, sizeof(cl_mem), &a);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(triad, 1, sizeof(cl_mem), &b);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(triad, 2, sizeof(cl_mem), &c);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(triad, 3, sizeof(cl_float), &s);
+  if(ret == CL_SUCCESS) {
+    if((t = best_time(queue, triad, bytes / 16)) < 0)
+      ret = CL_OUT_OF_RESOURCES;
+    else
+      peak->bandwidth = 3.0 * bytes / t;
+  }
+
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(mad, 0, sizeof(cl_mem), &out);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(mad, 1, sizeof(cl_float), &s);
+  if(ret == CL_SUCCESS) {
+    if((t = best_time(queue, mad, items)) < 0)
+      ret = CL_OUT_OF_RESOURCES;
+    else // 4 chains x 4 lanes x (mul + add)
+      peak->flops = (double) items * ROOFLINE_MAD_ITERS * 4 * 4 * 2 / t;
+  }
+
+  if(out)     clReleaseMemObject(out);
+  if(c)       clReleaseMemObject(c);
+  if(b)       clReleaseMemObject(b);
+  if(a)       clReleaseMemObject(a);
+  if(mad)     clReleaseKernel(mad);
+  if(triad)   clReleaseKernel(triad);
+  if(program) clReleaseProgram(program);
+  return ret;
+}
+
+void
+roofline_init(struct roofline *r)
+{
+  memset(r, 0, sizeof(*r));
+}
+
+void
+roofline_record(struct roofline *r, const char *name, double bytes_read,
+                double bytes_written, double flops, double seconds)
+{
+  struct roofline_kernel *k = NULL;
+  for(int i = 0; i < r->count && k == NULL; i++)
+    if(strncmp(r->kernel[i].name, name, sizeof(k->name) - 1) == 0)
+      k = &r->kernel[i];
+  if(k == NULL) {
+    if(r->count == ROOFLINE_MAX_KERNELS)
+      return;
+    k = &r->kernel[r->count++];
+    snprintf(k->name, sizeof(k->name), "%s", name);
+  }
+  k->launches++;
+  k->bytes_read += bytes_read;
+  k->bytes_written += bytes_written;
+  k->flops += flops;
+  k->seconds += seconds;
+}
+
+cl_int
+roofline_record_event(struct roofline *r, const char *name, cl_event ev,
+                      double bytes_read, double bytes_written, double flops)
+{
+  cl_ulong started, ended;
+  cl_int ret = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &started, NULL);
+  if(ret == CL_SUCCESS)
+    ret = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ended, NULL);
+  if(ret == CL_SUCCESS)
+    roofline_record(r, name, bytes_read, bytes_written, flops, (ended - started) / 1e9);
+  return ret;
+}
+
+double
+roofline_fraction(const struct roofline_peak *peak, double bytes, double flops,
+                  double seconds, int *compute_bound)
+{
+  double ridge = peak->flops / peak->bandwidth;
+  int compute = bytes == 0 || flops / bytes >= ridge;
+  if(compute_bound)
+    *compute_bound = compute;
+  if(seconds <= 0)
+    return 0;
+  return compute ? flops / seconds / peak->flops : bytes / seconds / peak->bandwidth;
+}
+
+void
+roofline_print_peak(const struct roofline_peak *peak)
+{
+  printf("peak: %.2f GB/sec (triad), %.2f GFLOP/sec (mad), ridge %.2f flop/byte\n",
+         peak->bandwidth / 1e9, peak->flops / 1e9, peak->flops / peak->bandwidth);
+}
+
+void
+roofline_print(const struct roofline *r, const struct roofline_peak *peak)
+{
+  roofline_print_peak(peak);
+  printf("  %-16s %8s %10s %10s %10s %8s  %s\n",
+         "kernel", "launches", "GB/sec", "GFLOP/sec", "flop/byte", "of peak", "bound");
+  for(int i = 0; i < r->count; i++) {
+    const struct roofline_kernel *k = &r->kernel[i];
+    double bytes = k->bytes_read + k->bytes_written;
+    int compute;
+    double fraction = roofline_fraction(peak, bytes, k->flops, k->seconds, &compute);
+    printf("  %-16s %8lu %10.2f %10.2f %10.3f %7.1f%%  %s\n", k->name, k->launches,
+           k->seconds > 0 ? bytes / k->seconds / 1e9 : 0,
+           k->seconds > 0 ? k->flops / k->seconds / 1e9 : 0,
+           bytes > 0 ? k->flops / bytes : 0, fraction * 100, compute ? "compute" : "memory");
+  }
+}
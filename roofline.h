@@ -0,0 +1,76 @@
+#ifndef ROOFLINE_H
+#define ROOFLINE_H
+
+#include <CL/cl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Roofline accounting: what each kernel achieved against what the
+// device can do.
+//
+// The peak is measured on the current device: bandwidth with a
+// STREAM-style triad (a = b + s * c on float4, 12 bytes per float
+// counted, as STREAM does) and compute with independent float4 mad
+// chains. Kernels record bytes read, bytes written and operations per
+// launch; min and compare count as one operation, like an add. A kernel
+// whose intensity (operations per byte) is below the ridge point
+// (peak flops / peak bandwidth) is memory-bound and is scored against
+// the peak bandwidth, otherwise against the peak flops.
+//
+//   struct roofline_peak peak;
+//   roofline_measure_peak(context, device, queue, &peak);
+//   struct roofline r;
+//   roofline_init(&r);
+//   roofline_record_event(&r, "minp", ev, n * 4, groups * 4, n);
+//   roofline_print(&r, &peak);
+
+#define ROOFLINE_MAX_KERNELS 16
+
+struct roofline_peak {
+  double bandwidth;  // bytes/sec
+  double flops;      // operations/sec
+};
+
+// Totals of one kernel over its recorded launches.
+struct roofline_kernel {
+  char name[32];
+  unsigned long launches;
+  double bytes_read;
+  double bytes_written;
+  double flops;
+  double seconds;
+};
+
+struct roofline {
+  struct roofline_kernel kernel[ROOFLINE_MAX_KERNELS];
+  int count;
+};
+
+// Best of a few runs of each peak kernel; queue must be in order.
+cl_int roofline_measure_peak(cl_context context, cl_device_id device, cl_command_queue queue,
+                             struct roofline_peak *peak);
+
+void roofline_init(struct roofline *r);
+// Adds one launch to `name` (kernels past ROOFLINE_MAX_KERNELS are dropped).
+void roofline_record(struct roofline *r, const char *name, double bytes_read,
+                     double bytes_written, double flops, double seconds);
+// The same, timed by START..END of a profiled event.
+cl_int roofline_record_event(struct roofline *r, const char *name, cl_event ev,
+                             double bytes_read, double bytes_written, double flops);
+
+// Fraction of the attainable peak reached by `bytes` and `flops` in
+// `seconds`; *compute_bound (may be NULL) tells which roof applies.
+double roofline_fraction(const struct roofline_peak *peak, double bytes, double flops,
+                         double seconds, int *compute_bound);
+
+void roofline_print_peak(const struct roofline_peak *peak);
+// The peak, then one line per kernel.
+void roofline_print(const struct roofline *r, const struct roofline_peak *peak);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef RUNTIME_HPP
+#define RUNTIME_HPP
+
+////////////////////////////////////////////////////////////////
+// Thread-safe OpenCL runtime for one device.
+//
+// Owns the context, a buffer pool and every program built through it.
+// Each host thread that calls in gets its own command queue and its own
+// cl::Kernel objects (setArg is not thread-safe), created on first use,
+// so request threads submit in parallel and only take a lock the first
+// time they meet a runtime or a program.
+//
+//   runtime::Runtime rt(cl::Device::getDefault());
+//   // from any thread:
+//   rt.saxpy(2.f, x, y, n);
+//   cl_uint m = rt.min(src, n);
+//   cl::Kernel &k = rt.kernel(source, "name");   // this thread's copy
+//   rt.queue().enqueueNDRangeKernel(k, ...);
+//
+// Per-thread state lives until the runtime is destroyed; a thread must
+// not use the runtime after that.
+////////////////////////////////////////////////////////////////
+
+#include <CL/opencl.hpp>
+#include "buffer_pool.h"
+#include "program_cache.h"
+#include "reduction.hpp"
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace runtime
+{
+
+// Same grid-stride saxpy as saxpy.cxx.
+static const char *saxpySource =
+  "__kernel void saxpy(const global float *x,\n"
+  "                       __global float * y,\n"
+  "                            const float a,\n"
+  "                             const uint n)\n"
+  "{                                         \n"
+  "  for(uint gid = get_global_id(0); gid < n;\n"
+  "      gid += get_global_size(0))          \n"
+  "    y[gid] = a * x[gid] + y[gid];         \n"
+  "}                                         \n";
+
+typedef reduction::Reduction<reduction::Min, cl_uint, 4> MinReduction;
+
+class Runtime
+{
+public:
+  Runtime(const cl::Device &device, size_t poolCap = 0)
+    : device_(device), context_(device), id_(nextId())
+  {
+    pool_ = buffer_pool_create(context_(), poolCap);
+    if(pool_ == NULL)
+      throw(std::string("runtime: cannot create the buffer pool"));
+  }
+
+  ~Runtime()
+  {
+    try
+      {
+        for(auto &t : threads_)
+          t.second->queue.finish();
+      }
+    catch(...)
+      {
+      }
+    threads_.clear();
+    buffer_pool_destroy(pool_);
+  }
+
+  Runtime(const Runtime &) = delete;
+  Runtime & operator=(const Runtime &) = delete;
+
+  const cl::Context & context() const { return context_; }
+  const cl::Device & device() const { return device_; }
+  buffer_pool * pool() const { return pool_; }
+
+  // This thread's in-order queue.
+  const cl::CommandQueue & queue() { return local().queue; }
+
+  ////////////////////////////////////////////////////////////////
+  // Build (or fetch) a program; each (source, options) is built once
+  // per runtime, through the on-disk program cache.
+  ////////////////////////////////////////////////////////////////
+  cl::Program program(const std::string &source, const std::string &options = "")
+  {
+    std::lock_guard<std::mutex> lock(programsLock_);
+    cl::Program &p = programs_[options + '\n' + source];
+    if(!p())
+      {
+        cl_int err;
+        cl_program built = program_cache_build(context_(), device_(), source.c_str(),
+                                               options.c_str(), &err);
+        if(built == NULL || err != CL_SUCCESS)
+          {
+            if(built)
+              clReleaseProgram(built);
+            throw cl::Error(err, "program_cache_build");
+          }
+        p = cl::Program(built);
+      }
+    return p;
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // This thread's kernel object for `name` in (source, options). Its
+  // arguments are private to the thread.
+  ////////////////////////////////////////////////////////////////
+  cl::Kernel & kernel(const std::string &source, const std::string &name,
+                      const std::string &options = "")
+  {
+    ThreadState &t = local();
+    std::string key = name + '\n' + options + '\n' + std::to_string(std::hash<std::string>()(source));
+    cl::Kernel &k = t.kernels[key];
+    if(!k())
+      k = cl::Kernel(program(source, options), name.c_str());
+    return k;
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // y = a * x + y over n floats, blocking
+  ////////////////////////////////////////////////////////////////
+  void saxpy(cl_float a, const cl_float *x, cl_float *y, size_t n)
+  {
+    const cl::CommandQueue &q = queue();
+    cl::Kernel &k = kernel(saxpySource, "saxpy");
+    size_t bytes = n * sizeof(cl_float);
+    Pooled bx(*this, q, CL_MEM_READ_ONLY, bytes);
+    Pooled by(*this, q, CL_MEM_READ_WRITE, bytes);
+    q.enqueueWriteBuffer(bx.buffer, CL_FALSE, 0, bytes, x);
+    q.enqueueWriteBuffer(by.buffer, CL_FALSE, 0, bytes, y);
+    k.setArg(0, bx.buffer);
+    k.setArg(1, by.buffer);
+    k.setArg(2, a);
+    k.setArg(3, (cl_uint) n);
+    q.enqueueNDRangeKernel(k, cl::NullRange, cl::NDRange((n + 63) / 64 * 64), cl::NDRange(64));
+    q.enqueueReadBuffer(by.buffer, CL_TRUE, 0, bytes, y);
+  }
+
+  ////////////////////////////////////////////////////////////////
+  // min of n uints, blocking
+  ////////////////////////////////////////////////////////////////
+  cl_uint min(const cl_uint *src, size_t n)
+  {
+    ThreadState &t = local();
+    if(!t.min)
+      t.min.reset(new MinReduction(context_, device_, minProgram()));
+    Pooled bs(*this, t.queue, CL_MEM_READ_ONLY, n * sizeof(cl_uint));
+    t.queue.enqueueWriteBuffer(bs.buffer, CL_FALSE, 0, n * sizeof(cl_uint), src);
+    t.min->enqueue(t.queue, bs.buffer, (cl_uint) n);
+    return t.min->result(t.queue).value;
+  }
+
+private:
+  struct ThreadState
+  {
+    cl::CommandQueue queue;
+    std::map<std::string, cl::Kernel> kernels;
+    std::unique_ptr<MinReduction> min;
+  };
+
+  // A pool buffer, handed back once the queue using it is done.
+  struct Pooled
+  {
+    Runtime &rt;
+    const cl::CommandQueue &queue;
+    cl::Buffer buffer;
+
+    Pooled(Runtime &r, const cl::CommandQueue &q, cl_mem_flags flags, size_t bytes)
+      : rt(r), queue(q)
+    {
+      cl_int err;
+      cl_mem buf = buffer_pool_get(rt.pool_, flags, bytes, &err);
+      if(buf == NULL)
+        throw cl::Error(err, "buffer_pool_get");
+      buffer = cl::Buffer(buf, true);
+    }
+
+    ~Pooled()
+    {
+      try
+        {
+          queue.finish();
+        }
+      catch(...)
+        {
+        }
+      buffer_pool_put(rt.pool_, buffer());
+    }
+  };
+
+  static unsigned long nextId()
+  {
+    static std::atomic<unsigned long> next(1);
+    return next++;
+  }
+
+  // This thread's state. A one-entry thread-local cache keyed by the
+  // runtime's id (never reused) skips the lock after the first call.
+  ThreadState & local()
+  {
+    thread_local unsigned long cachedId = 0;
+    thread_local ThreadState *cached = NULL;
+    if(cachedId == id_)
+      return *cached;
+
+    std::lock_guard<std::mutex> lock(threadsLock_);
+    std::unique_ptr<ThreadState> &t = threads_[std::this_thread::get_id()];
+    if(!t)
+      {
+        t.reset(new ThreadState);
+        t->queue = cl::CommandQueue(context_, device_);
+      }
+    cachedId = id_;
+    cached = t.get();
+    return *t;
+  }
+
+  cl::Program minProgram()
+  {
+    std::lock_guard<std::mutex> lock(programsLock_);
+    if(!minProgram_())
+      minProgram_ = MinReduction::build(context_, device_);
+    return minProgram_;
+  }
+
+  cl::Device device_;
+  cl::Context context_;
+  unsigned long id_;
+  buffer_pool *pool_;
+  std::mutex programsLock_;
+  std::map<std::string, cl::Program> programs_;
+  cl::Program minProgram_;
+  std::mutex threadsLock_;
+  std::map<std::thread::id, std::unique_ptr<ThreadState> > threads_;
+};
+
+} // namespace runtime
+
+#endif
@@ -2,8 +2,22 @@
 #define CL_HPP_TARGET_OPENCL_VERSION 200
 
 #include <CL/opencl.hpp>
+#include "autotune.h"
+#include "buffer_pool.h"
+#include "dataset.h"
+#include "generate.h"
+#include "native.h"
+#include "program_cache.h"
+#include "specialize.h"
+#include "shared_buffer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <iostream>
+#include <memory>
 #include <string>
 
 using std::cout;
@@ -32,8 +46,6 @@ void printVector(
 // Globals
 ////////////////////////////////////////////////////////////////
 int length    = 256;
-cl_float * pX = NULL;
-cl_float * pY = NULL;
 cl_float a    = 2.f;
 
 std::vector<cl::Platform> platforms;
@@ -43,73 +55,406 @@ cl::CommandQueue queue;
 cl::Program program;
 
 cl::Kernel kernel;
-cl::Buffer bufX;
-cl::Buffer bufY;
+MemMode memMode = MEM_COPY;
+buffer_pool *pool = NULL;
+std::unique_ptr<SharedBuffer> bufX;
+std::unique_ptr<SharedBuffer> bufY;
+// -i: X is a mapped file instead, in fileX
+dataset input = {};
+cl::Buffer fileX;
+double mapTime = 0;
 
 ////////////////////////////////////////////////////////////////
 // The saxpy kernel
 ////////////////////////////////////////////////////////////////
+// Grid-stride loop, so any global size covers all n elements.
+// With -s, a, n and the vector width are baked in as SPEC_A, SPEC_N and
+// SPEC_WIDTH (see specialize.h); the first n % SPEC_WIDTH work-items
+// also do the scalar tail.
 string kernelStr =
+  "#ifdef SPEC_A                             \n"
+  "#define A SPEC_A                          \n"
+  "#else                                     \n"
+  "#define A a                               \n"
+  "#endif                                    \n"
+  "#ifdef SPEC_N                             \n"
+  "#define N SPEC_N                          \n"
+  "#else                                     \n"
+  "#define N n                               \n"
+  "#endif                                    \n"
+  "#define CAT_(a, b) a ## b                 \n"
+  "#define CAT(a, b) CAT_(a, b)              \n"
+  "                                          \n"
   "__kernel void saxpy(const global float *x,\n"
   "                       __global float * y,\n"
-  "                            const float a)\n"
+  "                            const float a,\n"
+  "                             const uint n)\n"
   "{                                         \n"
-  "  uint gid = get_global_id(0);            \n"
-  "  y[gid] = a * x[gid] + y[gid];           \n"
+  "#if !defined(SPEC_WIDTH) || SPEC_WIDTH == 1\n"
+  "  for(uint gid = get_global_id(0); gid < N;\n"
+  "      gid += get_global_size(0))          \n"
+  "    y[gid] = A * x[gid] + y[gid];         \n"
+  "#else                                     \n"
+  "  for(uint gid = get_global_id(0);        \n"
+  "      gid < N / SPEC_WIDTH;               \n"
+  "      gid += get_global_size(0))          \n"
+  "    CAT(vstore, SPEC_WIDTH)(A * CAT(vload, SPEC_WIDTH)(gid, x)\n"
+  "                            + CAT(vload, SPEC_WIDTH)(gid, y), gid, y);\n"
+  "  uint t = N / SPEC_WIDTH * SPEC_WIDTH + get_global_id(0);\n"
+  "  if(t < N)                               \n"
+  "    y[t] = A * x[t] + y[t];               \n"
+  "#endif                                    \n"
+  "}                                         \n"
+  "                                          \n"
+  // -f: x and y stored as half or bf16, math in float. vload_half and
+  // vstore_half need no cl_khr_fp16; bf16 is the top half of a float,
+  // rounded to nearest even like vstore_half_rte.
+  "__kernel void saxpy_half(const global half *x,\n"
+  "                               global half *y,\n"
+  "                            const float a,\n"
+  "                             const uint n)\n"
+  "{                                         \n"
+  "  for(uint gid = get_global_id(0); gid < N;\n"
+  "      gid += get_global_size(0))          \n"
+  "    vstore_half_rte(A * vload_half(gid, x) + vload_half(gid, y), gid, y);\n"
+  "}                                         \n"
+  "                                          \n"
+  "float bf16_load(ushort b) { return as_float((uint) b << 16); }\n"
+  "ushort bf16_store(float f)                \n"
+  "{                                         \n"
+  "  uint u = as_uint(f);                    \n"
+  "  if(isnan(f))                            \n"
+  "    return (ushort) ((u >> 16) | 0x40);   \n"
+  "  return (ushort) ((u + 0x7fff + ((u >> 16) & 1)) >> 16);\n"
+  "}                                         \n"
+  "                                          \n"
+  "__kernel void saxpy_bf16(const global ushort *x,\n"
+  "                               global ushort *y,\n"
+  "                            const float a,\n"
+  "                             const uint n)\n"
+  "{                                         \n"
+  "  for(uint gid = get_global_id(0); gid < N;\n"
+  "      gid += get_global_size(0))          \n"
+  "    y[gid] = bf16_store(A * bf16_load(x[gid]) + bf16_load(y[gid]));\n"
   "}                                         \n";
 
 ////////////////////////////////////////////////////////////////
-// Allocate and initialize memory on the host
+// Autotuner callback: seconds per launch for one work size, of the
+// cl::Kernel passed as arg or of the global kernel
 ////////////////////////////////////////////////////////////////
-void initHost()
+#define TUNE_LOOPS 20
+
+double timeSaxpy(const tune_config * cfg, void * arg)
 {
-  size_t sizeInBytes = length * sizeof(cl_float);
-  pX = (cl_float *) malloc(sizeInBytes);
-  if(pX == NULL)
-    throw(string("Error: Failed to allocate input memory on host\n"));
+  cl::Kernel &k = arg ? *(cl::Kernel *) arg : kernel;
+  try
+    {
+      cl::NDRange global(cfg->global), local(cfg->local);
+      queue.enqueueNDRangeKernel(k, cl::NullRange, global, local);
+      queue.finish();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for(int i = 0; i < TUNE_LOOPS; i++)
+        queue.enqueueNDRangeKernel(k, cl::NullRange, global, local);
+      queue.finish();
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / TUNE_LOOPS;
+    }
+  catch(cl::Error &)
+    {
+      return -1;
+    }
+}
 
-  pY = (cl_float *) malloc(sizeInBytes);
-  if(pY == NULL)
-    throw(string("Error: Failed to allocate input memory on host\n"));
-  for(int i = 0; i < length; i++)
+////////////////////////////////////////////////////////////////
+// Initial X and Y on the host, for the reference results only: the
+// buffers are filled in place. Same data as the device's iota_float
+// with -g; X is the file with -i.
+////////////////////////////////////////////////////////////////
+void hostX(std::vector<cl_float> &x)
+{
+  if(input.data)
+    x.assign((const cl_float *) input.data, (const cl_float *) input.data + length);
+  else
     {
-      pX[i] = cl_float(i);
-      pY[i] = cl_float(length-1-i);
+      x.resize(length);
+      generate_iota_float_host(x.data(), length, 0, 1);
     }
-  printVector("X", pX, length);
-  printVector("Y", pY, length);
+}
+
+void hostY(std::vector<cl_float> &y)
+{
+  y.resize(length);
+  generate_iota_float_host(y.data(), length, length - 1, -1);
 }
 
 ////////////////////////////////////////////////////////////////
-// Release host memory
+// Release host resources
 ////////////////////////////////////////////////////////////////
 void cleanupHost()
 {
-  if(pX)
+  fileX = cl::Buffer();
+  dataset_close(&input);
+}
+
+////////////////////////////////////////////////////////////////
+// Open and map the -i file; X is read from it in place
+////////////////////////////////////////////////////////////////
+void openInput(const char * path)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if(dataset_open(&input, path, sizeof(cl_float)) != 0)
+    throw(string("cannot map ") + path);
+  mapTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if(input.count > 0x7fffffff)
+    throw(string(path) + " has more than 2^31 - 1 elements");
+  length = (int) input.count;
+  cout << path << ": " << length << " floats, mapped in " << mapTime * 1e3 << " ms" << endl;
+}
+
+////////////////////////////////////////////////////////////////
+// Expected result from the native SIMD backend
+////////////////////////////////////////////////////////////////
+void nativeExpect(std::vector<cl_float> &expect)
+{
+  // A file is read in place, after the device has read it.
+  std::vector<cl_float> x;
+  if(!input.data)
+    hostX(x);
+  hostY(expect);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  native_saxpy(a, input.data ? (const cl_float *) input.data : x.data(), expect.data(), length);
+  double nativeTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  cout << endl << "native " << native_isa_name(native_isa()) << ", " << native_threads()
+       << " threads: " << nativeTime * 1e3 << " ms" << endl;
+}
+
+void setArgX(cl::Kernel &k)
+{
+  if(input.data)
+    k.setArg(0, fileX);
+  else
+    bufX->setArg(k, 0);
+}
+
+////////////////////////////////////////////////////////////////
+// Fill a shared buffer with iota through its mapping: in place in
+// the zero-copy modes, in the staging copy with -m copy
+////////////////////////////////////////////////////////////////
+void fillIota(SharedBuffer &buf, cl_int start, cl_int step)
+{
+  cl_float *p = (cl_float *) buf.map(CL_MAP_WRITE_INVALIDATE_REGION);
+  generate_iota_float_host(p, length, start, step);
+  buf.unmap();
+}
+
+////////////////////////////////////////////////////////////////
+// -g: fill X and Y on the device, matching initHost()
+////////////////////////////////////////////////////////////////
+struct generator gen;
+
+void generateXY()
+{
+  cl_int err = generate_iota_float(&gen, queue(), bufX->buffer()(), length, 0, 1, NULL);
+  if(err == CL_SUCCESS)
+    err = generate_iota_float(&gen, queue(), bufY->buffer()(), length, length - 1, -1, NULL);
+  if(err != CL_SUCCESS)
+    throw cl::Error(err, "generate_iota_float");
+  queue.finish();
+}
+
+////////////////////////////////////////////////////////////////
+// -f: host conversions matching the device's vstore_half_rte and
+// bf16_store, both round to nearest even
+////////////////////////////////////////////////////////////////
+cl_ushort floatToHalf(cl_float f)
+{
+  cl_uint u;
+  memcpy(&u, &f, sizeof(u));
+  cl_uint sign = (u >> 16) & 0x8000, abs = u & 0x7fffffff;
+  if(abs > 0x7f800000)
+    return sign | 0x7e00;
+  if(abs >= 0x477ff000) // 65520 and up round to infinity
+    return sign | 0x7c00;
+  if(abs < 0x38800000) // below 2^-14: subnormal, in units of 2^-24
     {
-      free(pX);
-      pX = NULL;
+      cl_float m;
+      memcpy(&m, &abs, sizeof(m));
+      return sign | (cl_ushort) std::nearbyint(m * 16777216.f);
     }
-  if(pY)
+  cl_uint h = (abs - 0x38000000) >> 13, rest = abs & 0x1fff;
+  if(rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+    h++;
+  return sign | h;
+}
+
+cl_float halfToFloat(cl_ushort h)
+{
+  cl_uint sign = (cl_uint) (h & 0x8000) << 16, e = (h >> 10) & 0x1f, m = h & 0x3ff, u;
+  if(e == 0)
+    return (sign ? -1.f : 1.f) * std::ldexp((cl_float) m, -24);
+  if(e == 31)
+    u = sign | 0x7f800000 | (m << 13);
+  else
+    u = sign | ((e + 112) << 23) | (m << 13);
+  cl_float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+cl_ushort floatToBf16(cl_float f)
+{
+  cl_uint u;
+  memcpy(&u, &f, sizeof(u));
+  if(f != f)
+    return (cl_ushort) ((u >> 16) | 0x40);
+  return (cl_ushort) ((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+}
+
+cl_float bf16ToFloat(cl_ushort b)
+{
+  cl_uint u = (cl_uint) b << 16;
+  cl_float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+////////////////////////////////////////////////////////////////
+// -f: run saxpy with x and y stored in 16 bits, check it against a
+// host emulation, report its error against the fp32 result and time
+// it against the fp32 kernel on the same work size
+////////////////////////////////////////////////////////////////
+void compareReduced(const string &storage, size_t globalSize, size_t localSize,
+                    const std::vector<cl_float> &expect)
+{
+  bool half = storage == "half";
+  cl_ushort (*encode)(cl_float) = half ? floatToHalf : floatToBf16;
+  cl_float (*decode)(cl_ushort) = half ? halfToFloat : bf16ToFloat;
+
+  std::vector<cl_float> x, y;
+  hostX(x);
+  hostY(y);
+  std::vector<cl_ushort> x16(length), y16(length), emulated(length), got(length);
+  for(int i = 0; i < length; i++)
+    {
+      x16[i] = encode(x[i]);
+      y16[i] = encode(y[i]);
+      emulated[i] = encode(a * decode(x16[i]) + decode(y16[i]));
+    }
+
+  cl::Buffer bx32(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, length * sizeof(cl_float), x.data());
+  cl::Buffer by32(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, length * sizeof(cl_float), y.data());
+  cl::Buffer bx16(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, length * sizeof(cl_ushort), x16.data());
+  cl::Buffer by16(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, length * sizeof(cl_ushort), y16.data());
+  cl::Kernel k32(program, "saxpy"), k16(program, half ? "saxpy_half" : "saxpy_bf16");
+  k32.setArg(0, bx32);
+  k32.setArg(1, by32);
+  k16.setArg(0, bx16);
+  k16.setArg(1, by16);
+  for(cl::Kernel *k : { &k32, &k16 })
     {
-      free(pY);
-      pY = NULL;
+      k->setArg(2, a);
+      k->setArg(3, (cl_uint) length);
     }
+
+  queue.enqueueNDRangeKernel(k16, cl::NullRange, cl::NDRange(globalSize), cl::NDRange(localSize));
+  queue.enqueueReadBuffer(by16, CL_TRUE, 0, length * sizeof(cl_ushort), got.data());
+  size_t mismatches = 0, overflows = 0;
+  double maxAbs = 0, maxRel = 0;
+  for(int i = 0; i < length; i++)
+    {
+      mismatches += got[i] != emulated[i];
+      cl_float v = decode(got[i]);
+      if(!std::isfinite(v))
+        {
+          overflows++;
+          continue;
+        }
+      double err = std::fabs((double) v - expect[i]);
+      maxAbs = std::max(maxAbs, err);
+      if(expect[i] != 0)
+        maxRel = std::max(maxRel, err / std::fabs(expect[i]));
+    }
+
+  tune_config current = { globalSize, localSize, 0, 0 };
+  double t32 = timeSaxpy(&current, &k32);
+  double t16 = timeSaxpy(&current, &k16);
+  cout << endl << storage << " storage: max abs error " << maxAbs << ", max rel error " << maxRel
+       << " vs fp32";
+  if(overflows)
+    cout << ", " << overflows << " out of range";
+  cout << endl << "fp32 " << t32 * 1e6 << " usec (" << 12.0 * length / t32 / 1e9 << " GB/sec), "
+       << storage << " " << t16 * 1e6 << " usec (" << 6.0 * length / t16 / 1e9 << " GB/sec), "
+       << t32 / t16 << "x" << endl;
+  cout << storage << (mismatches ? " result INcorrect" : " result correct") << endl;
 }
 
 int main(int argc, char * argv[])
 {
+  bool tune = false;
+  bool generate = false;
+  unsigned int specWidth = 0;
+  string storage;
+  const char * inputPath = NULL;
   try
     {
+      for(int i = 1; i < argc; i++)
+        {
+          if(!strcmp(argv[i], "-t"))
+            tune = true;
+          else if(!strcmp(argv[i], "-g"))
+            generate = true;
+          else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+            {
+              specWidth = atoi(argv[++i]);
+              if(specWidth == 0 || specWidth > 16 || (specWidth & (specWidth - 1)))
+                throw(string("-s takes a vector width of 1, 2, 4, 8 or 16"));
+            }
+          else if(!strcmp(argv[i], "-m") && i + 1 < argc)
+            memMode = parseMemMode(argv[++i]);
+          else if(!strcmp(argv[i], "-f") && i + 1 < argc)
+            {
+              storage = argv[++i];
+              if(storage != "half" && storage != "bf16")
+                throw(string("-f takes half or bf16"));
+            }
+          else if(!strcmp(argv[i], "-i") && i + 1 < argc)
+            inputPath = argv[++i];
+          else
+            length = atoi(argv[i]);
+        }
+
+      if(inputPath && generate)
+        throw(string("-i and -g both give X"));
+      if(inputPath)
+        openInput(inputPath);
+
       ////////////////////////////////////////////////////////////////
-      // Allocate and initialize memory on the host
+      // Expected result; for a file only after the device has read X,
+      // so that the host does not prefault the mapping
       ////////////////////////////////////////////////////////////////
-      initHost();
+      std::vector<cl_float> expect;
+      if(!inputPath)
+        nativeExpect(expect);
 
       ////////////////////////////////////////////////////////////////
-      // Find the platform
+      // Find the platform, or stop at the native result without one
       ////////////////////////////////////////////////////////////////
-      cl::Platform::get(&platforms);
+      try
+        {
+          cl::Platform::get(&platforms);
+        }
+      catch(cl::Error &)
+        {
+          platforms.clear();
+        }
+      if(platforms.empty())
+        {
+          if(expect.empty())
+            nativeExpect(expect);
+          printVector("Y", expect.data(), length);
+          cout << "no OpenCL platform, native result only" << endl;
+          cleanupHost();
+          return 0;
+        }
       std::vector<cl::Platform>::iterator iter;
       for(iter = platforms.begin(); iter != platforms.end(); ++iter)
         {
@@ -121,8 +466,21 @@ int main(int argc, char * argv[])
       ////////////////////////////////////////////////////////////////
       // Create an OpenCL context
       ////////////////////////////////////////////////////////////////
+      // Without an AMD platform take the first one, and its first device
+      // of any type if it has no GPU. multidev.cxx uses all of them.
+      if(iter == platforms.end())
+        iter = platforms.begin();
       cl_context_properties cps[3] = {CL_CONTEXT_PLATFORM, (cl_context_properties)(*iter)(), 0};
-      context = cl::Context(CL_DEVICE_TYPE_GPU, cps);
+      try
+        {
+          context = cl::Context(CL_DEVICE_TYPE_GPU, cps);
+        }
+      catch(cl::Error &err)
+        {
+          if(err.err() != CL_DEVICE_NOT_FOUND)
+            throw;
+          context = cl::Context(CL_DEVICE_TYPE_ALL, cps);
+        }
 
       ////////////////////////////////////////////////////////////////
       // Detect OpenCL devices
@@ -135,48 +493,179 @@ int main(int argc, char * argv[])
       queue = cl::CommandQueue(context, devices[0]);
 
       ////////////////////////////////////////////////////////////////
-      // Create OpenCL memory buffers
+      // Create OpenCL memory buffers with the selected strategy
       ////////////////////////////////////////////////////////////////
-      bufX = cl::Buffer(context,
-                        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                        sizeof(cl_float) * length,
-                        pX);
-      bufY = cl::Buffer(context,
-                        CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                        sizeof(cl_float) * length,
-                        pY);
+      if(!memModeSupported(devices[0], memMode))
+        throw(string("memory mode ") + memModeName(memMode) + " not supported by the device");
+      if(generate && (memMode == MEM_SVM_COARSE || memMode == MEM_SVM_FINE))
+        throw(string("-g needs a buffer memory mode"));
+      if(inputPath && memMode != MEM_COPY && memMode != MEM_USE_HOST)
+        throw(string("-i takes -m copy or usehost"));
+      if(inputPath && memMode == MEM_USE_HOST && !dataset_aligned(&input))
+        throw(string(inputPath) + ": data is not page-aligned, -m usehost would copy it");
+      if(generate)
+        {
+          cl_int err = generator_create(&gen, context(), devices[0]());
+          if(err != CL_SUCCESS)
+            throw cl::Error(err, "generator_create");
+        }
+      pool = buffer_pool_create(context(), 0);
+      if(pool == NULL)
+        throw(string("Error: Failed to create the buffer pool\n"));
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      // X is written by the generator with -g. A file goes to the device
+      // straight from the mapping: wrapped with usehost, else uploaded in
+      // chunks.
+      if(inputPath)
+        {
+          cl_int err;
+          if(memMode == MEM_USE_HOST)
+            fileX = cl::Buffer(dataset_create_buffer(&input, context(), CL_MEM_READ_ONLY, &err));
+          else
+            {
+              fileX = cl::Buffer(context, CL_MEM_READ_ONLY, dataset_bytes(&input));
+              err = dataset_upload(&input, queue(), fileX(), 0);
+            }
+          if(err != CL_SUCCESS)
+            throw cl::Error(err, "dataset");
+        }
+      else
+        {
+          cl_mem_flags xAccess = generate ? CL_MEM_READ_WRITE : CL_MEM_READ_ONLY;
+          bufX.reset(new SharedBuffer(context, queue, memMode, sizeof(cl_float) * length, xAccess, pool));
+        }
+      bufY.reset(new SharedBuffer(context, queue, memMode, sizeof(cl_float) * length, CL_MEM_READ_WRITE, pool));
+      if(generate)
+        generateXY();
+      else
+        {
+          if(!inputPath)
+            fillIota(*bufX, 0, 1);
+          fillIota(*bufY, length - 1, -1);
+        }
+      double uploadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
       ////////////////////////////////////////////////////////////////
       // Load CL file, build CL program object, create CL kernel object
       ////////////////////////////////////////////////////////////////
-      cl::Program::Sources sources = { kernelStr };
-      program = cl::Program(context, sources);
-      program.build(devices);
+      cl_int err;
+      program = cl::Program(program_cache_build(context(), devices[0](), kernelStr.c_str(), NULL, &err));
+      if(err != CL_SUCCESS)
+        throw cl::Error(err, "program_cache_build");
       kernel = cl::Kernel(program, "saxpy");
 
       ////////////////////////////////////////////////////////////////
       // Set the arguments that will be used for kernel execution
       ////////////////////////////////////////////////////////////////
-      kernel.setArg(0, bufX);
-      kernel.setArg(1, bufY);
+      setArgX(kernel);
+      bufY->setArg(kernel, 1);
       kernel.setArg(2, a);
+      kernel.setArg(3, (cl_uint) length);
+
+      ////////////////////////////////////////////////////////////////
+      // Pick the work size: search with -t, else a stored result,
+      // else 64-wide groups with one element per work-item
+      ////////////////////////////////////////////////////////////////
+      size_t globalSize = (length + 63) / 64 * 64, localSize = 64;
+      tune_config cfg;
+      bool tuned;
+      if(tune)
+        {
+          size_t maxLocal = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices[0]);
+          tuned = autotune_search(devices[0](), "saxpy", length, maxLocal, timeSaxpy, NULL, &cfg) == 0;
+        }
+      else
+        tuned = autotune_load(devices[0](), "saxpy", length, &cfg) == 0;
+      if(tuned)
+        {
+          cout << "tuned work size: global " << cfg.global << " local " << cfg.local << endl;
+          globalSize = cfg.global;
+          localSize = cfg.local;
+        }
+
+      ////////////////////////////////////////////////////////////////
+      // -s: specialize a, n and the vector width at build time, time
+      // it against the generic kernel and use it from here on
+      ////////////////////////////////////////////////////////////////
+      if(specWidth)
+        {
+          char opts[256] = "";
+          spec_define_float(opts, sizeof(opts), "SPEC_A", a);
+          spec_define_uint(opts, sizeof(opts), "SPEC_N", length);
+          // Unsuffixed: it is pasted into vload<W> / vstore<W>.
+          spec_define(opts, sizeof(opts), "SPEC_WIDTH", std::to_string(specWidth).c_str());
+          cl::Program spec(spec_build(context(), devices[0](), kernelStr.c_str(), opts, &err));
+          if(err != CL_SUCCESS)
+            throw cl::Error(err, "spec_build");
+          cl::Kernel specKernel(spec, "saxpy");
+          setArgX(specKernel);
+          bufY->setArg(specKernel, 1);
+          specKernel.setArg(2, a);
+          specKernel.setArg(3, (cl_uint) length);
+          tune_config current = { globalSize, localSize, 0, 0 };
+          double generic = timeSaxpy(&current, &kernel);
+          double special = timeSaxpy(&current, &specKernel);
+          cout << "specialization" << opts << ": generic " << generic * 1e6 << " usec, specialized "
+               << special * 1e6 << " usec (" << generic / special << "x)" << endl;
+          kernel = specKernel;
+        }
+
+      // Tuning and timing ran saxpy many times; start over from the
+      // initial data.
+      if(tune || specWidth)
+        {
+          if(generate)
+            generateXY();
+          else
+            fillIota(*bufY, length - 1, -1);
+        }
 
       ////////////////////////////////////////////////////////////////
       // Enqueue the kernel to the queue
       // with appropriate global and local work sizes
       ////////////////////////////////////////////////////////////////
-      queue.enqueueNDRangeKernel(kernel, cl::NDRange(), cl::NDRange(length), cl::NDRange(64));
+      start = std::chrono::steady_clock::now();
+      queue.enqueueNDRangeKernel(kernel, cl::NDRange(), cl::NDRange(globalSize), cl::NDRange(localSize));
 
       ////////////////////////////////////////////////////////////////
-      // Enqueue blocking call to read back buffer Y
+      // Blocking read back of buffer Y: mapped in place, or read into
+      // the staging copy with -m copy
       ////////////////////////////////////////////////////////////////
-      queue.enqueueReadBuffer(bufY, CL_TRUE, 0, length * sizeof(cl_float), pY);
+      const cl_float *y = (const cl_float *) bufY->map(CL_MAP_READ);
+      double runTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      printVector("Y", y, length);
+      if(inputPath)
+        {
+          double total = mapTime + uploadTime + runTime;
+          cout << endl << "file to result: " << total * 1e3 << " ms (map " << mapTime * 1e3
+               << ", upload " << uploadTime * 1e3 << ", kernel + read back " << runTime * 1e3 << "), "
+               << dataset_bytes(&input) / total / 1e9 << " GB/sec of X" << endl;
+          nativeExpect(expect);
+        }
+      bool correct = memcmp(y, expect.data(), sizeof(cl_float) * length) == 0;
+      bufY->unmap();
+      cout << (correct ? "result correct" : "result INcorrect") << endl;
+      cout << endl << "memory mode " << memModeName(memMode) << (generate ? ": generate " : ": upload ") << uploadTime * 1e3
+           << " ms, kernel + read back " << runTime * 1e3 << " ms" << endl;
 
-      printVector("Y", pY, length);
+      if(!storage.empty())
+        compareReduced(storage, globalSize, localSize, expect);
+
+      ////////////////////////////////////////////////////////////////
+      // Hand the buffers back to the pool and release it
+      ////////////////////////////////////////////////////////////////
+      bufX.reset();
+      bufY.reset();
+      buffer_pool_print_stats(pool);
+      buffer_pool_destroy(pool);
+      pool = NULL;
 
       ////////////////////////////////////////////////////////////////
       // Release host resources
       ////////////////////////////////////////////////////////////////
+      if(generate)
+        generator_release(&gen);
       cleanupHost();
   }
   catch(cl::Error err)
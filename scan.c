@@ -0,0 +1,300 @@
+#define CL_TARGET_OPENCL_VERSION 200
+
+#include "scan.h"
+#include "program_cache.h"
+#include <string.h>
+
+#define SCAN_MAX_LOCAL 256
+
+#define SCAN_MODE_SUM     0 // scan src
+#define SCAN_MODE_COMPACT 1 // scan src[i] < threshold, scatter the kept ones
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+// Each work-item owns one uint4 of its group's tile; lanes past n load 0
+// (and flag 0 when compacting).
+static const char *source =
+  "#define SCAN_MODE_COMPACT " XSTR(SCAN_MODE_COMPACT) "\n"
+  "\n"
+  "uint4 load4(global const uint *src, uint i, uint n)\n"
+  "{\n"
+  "  if(i + 4 <= n)\n"
+  "    return vload4(0, src + i);\n"
+  "  uint4 v = 0;\n"
+  "  if(i < n)     v.x = src[i];\n"
+  "  if(i + 1 < n) v.y = src[i + 1];\n"
+  "  if(i + 2 < n) v.z = src[i + 2];\n"
+  "  return v;\n"
+  "}\n"
+  "\n"
+  "uint4 value4(uint4 v, uint i, uint n, uint mode, uint threshold)\n"
+  "{\n"
+  "  if(mode != SCAN_MODE_COMPACT)\n"
+  "    return v;\n"
+  "  uint4 idx = (uint4) (i, i + 1, i + 2, i + 3);\n"
+  "  return select((uint4) 0, (uint4) 1, (v < threshold) & (idx < n));\n"
+  "}\n"
+  "\n"
+  "kernel void scan_reduce(global const uint *src, uint n, uint mode, uint threshold,\n"
+  "                        global uint *sums)\n"
+  "{\n"
+  "  uint i = get_global_id(0) * 4;\n"
+  "  uint4 v = value4(load4(src, i, n), i, n, mode, threshold);\n"
+  "  uint s = work_group_reduce_add(v.x + v.y + v.z + v.w);\n"
+  "  if(get_local_id(0) == 0)\n"
+  "    sums[get_group_id(0)] = s;\n"
+  "}\n"
+  "\n"
+  // offsets[g] is the exclusive scan of the tile sums; the last
+  // work-item writes the grand total.
+  "kernel void scan_down(global const uint *src, uint n, uint mode, uint threshold,\n"
+  "                      global const uint *offsets, uint use_offsets,\n"
+  "                      global uint *dst, uint inclusive, global uint *total)\n"
+  "{\n"
+  "  uint i = get_global_id(0) * 4;\n"
+  "  uint4 x = load4(src, i, n);\n"
+  "  uint4 v = value4(x, i, n, mode, threshold);\n"
+  "  uint base = work_group_scan_exclusive_add(v.x + v.y + v.z + v.w);\n"
+  "  if(use_offsets)\n"
+  "    base += offsets[get_group_id(0)];\n"
+  "  uint4 e = (uint4) (base, base + v.x, base + v.x + v.y, base + v.x + v.y + v.z);\n"
+  "  if(get_global_id(0) == get_global_size(0) - 1)\n"
+  "    *total = e.w + v.w;\n"
+  "  if(mode == SCAN_MODE_COMPACT) {\n"
+  "    if(v.x) dst[e.x] = x.x;\n"
+  "    if(v.y) dst[e.y] = x.y;\n"
+  "    if(v.z) dst[e.z] = x.z;\n"
+  "    if(v.w) dst[e.w] = x.w;\n"
+  "    return;\n"
+  "  }\n"
+  "  if(inclusive)\n"
+  "    e += v;\n"
+  "  if(i + 4 <= n)\n"
+  "    vstore4(e, 0, dst + i);\n"
+  "  else {\n"
+  "    if(i < n)     dst[i]     = e.x;\n"
+  "    if(i + 1 < n) dst[i + 1] = e.y;\n"
+  "    if(i + 2 < n) dst[i + 2] = e.z;\n"
+  "  }\n"
+  "}\n";
+
+static size_t
+floor_pow2(size_t x)
+{
+  size_t p = 1;
+  while(p * 2 <= x)
+    p *= 2;
+  return p;
+}
+
+cl_int
+scan_create(struct scan *scan, cl_context context, cl_device_id device)
+{
+  cl_int ret;
+  size_t wg[2];
+
+  memset(scan, 0, sizeof(*scan));
+  scan->program = program_cache_build(context, device, source, "-cl-std=CL2.0", &ret);
+  if(ret == CL_SUCCESS)
+    scan->reduce = clCreateKernel(scan->program, "scan_reduce", &ret);
+  if(ret == CL_SUCCESS)
+    scan->down = clCreateKernel(scan->program, "scan_down", &ret);
+  if(ret == CL_SUCCESS)
+    ret = clGetKernelWorkGroupInfo(scan->reduce, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                   sizeof(size_t), &wg[0], NULL);
+  if(ret == CL_SUCCESS)
+    ret = clGetKernelWorkGroupInfo(scan->down, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                   sizeof(size_t), &wg[1], NULL);
+  if(ret == CL_SUCCESS)
+    scan->total = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &ret);
+  if(ret != CL_SUCCESS) {
+    scan_release(scan);
+    return ret;
+  }
+  scan->local = wg[0] < wg[1] ? wg[0] : wg[1];
+  if(scan->local > SCAN_MAX_LOCAL)
+    scan->local = SCAN_MAX_LOCAL;
+  scan->local = floor_pow2(scan->local);
+  return CL_SUCCESS;
+}
+
+void
+scan_release(struct scan *scan)
+{
+  for(int i = 0; i < SCAN_MAX_LEVELS; i++)
+    if(scan->level[i])
+      clReleaseMemObject(scan->level[i]);
+  if(scan->total)   clReleaseMemObject(scan->total);
+  if(scan->reduce)  clReleaseKernel(scan->reduce);
+  if(scan->down)    clReleaseKernel(scan->down);
+  if(scan->program) clReleaseProgram(scan->program);
+  memset(scan, 0, sizeof(*scan));
+}
+
+// The tile sums of level `depth`, at least `size` uints.
+static cl_int
+level_buffer(struct scan *scan, cl_command_queue queue, int depth, size_t size)
+{
+  cl_context context;
+  cl_int ret;
+
+  if(scan->level_size[depth] >= size)
+    return CL_SUCCESS;
+  ret = clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+  if(ret != CL_SUCCESS)
+    return ret;
+  // In-flight launches keep the old buffer alive.
+  if(scan->level[depth])
+    clReleaseMemObject(scan->level[depth]);
+  scan->level_size[depth] = 0;
+  scan->level[depth] = clCreateBuffer(context, CL_MEM_READ_WRITE, size * sizeof(cl_uint), NULL, &ret);
+  if(ret == CL_SUCCESS)
+    scan->level_size[depth] = size;
+  else
+    scan->level[depth] = NULL;
+  return ret;
+}
+
+static cl_int
+launch(struct scan *scan, cl_command_queue queue, cl_kernel kernel, size_t groups)
+{
+  size_t global = groups * scan->local;
+  cl_int ret = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, &scan->local, 0, NULL, NULL);
+  if(ret == CL_SUCCESS)
+    scan->launches++;
+  return ret;
+}
+
+static cl_int
+scan_level(struct scan *scan, cl_command_queue queue, cl_mem src, cl_mem dst, size_t n,
+           cl_uint mode, cl_uint threshold, cl_uint inclusive, int depth)
+{
+  size_t tile = scan->local * SCAN_ITEMS;
+  size_t groups = (n + tile - 1) / tile;
+  cl_uint count = (cl_uint) n, use_offsets = groups > 1;
+  cl_mem sums = src;
+  cl_int ret = CL_SUCCESS;
+
+  // Steps 1 and 2: the exclusive scan of the tile sums, in place.
+  if(use_offsets) {
+    if(depth == SCAN_MAX_LEVELS)
+      return CL_INVALID_BUFFER_SIZE;
+    ret = level_buffer(scan, queue, depth, groups);
+    if(ret != CL_SUCCESS)
+      return ret;
+    sums = scan->level[depth];
+    ret = clSetKernelArg(scan->reduce, 0, sizeof(cl_mem), &src);
+    if(ret == CL_SUCCESS)
+      ret = clSetKernelArg(scan->reduce, 1, sizeof(cl_uint), &count);
+    if(ret == CL_SUCCESS)
+      ret = clSetKernelArg(scan->reduce, 2, sizeof(cl_uint), &mode);
+    if(ret == CL_SUCCESS)
+      ret = clSetKernelArg(scan->reduce, 3, sizeof(cl_uint), &threshold);
+    if(ret == CL_SUCCESS)
+      ret = clSetKernelArg(scan->reduce, 4, sizeof(cl_mem), &sums);
+    if(ret == CL_SUCCESS)
+      ret = launch(scan, queue, scan->reduce, groups);
+    if(ret == CL_SUCCESS)
+      ret = scan_level(scan, queue, sums, sums, groups, SCAN_MODE_SUM, 0, 0, depth + 1);
+    if(ret != CL_SUCCESS)
+      return ret;
+  }
+
+  // Step 3.
+  ret = clSetKernelArg(scan->down, 0, sizeof(cl_mem), &src);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(scan->down, 1, sizeof(cl_uint), &count);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(scan->down, 2, sizeof(cl_uint), &mode);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(scan->down, 3, sizeof(cl_uint), &threshold);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(scan->down, 4, sizeof(cl_mem), &sums);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(scan->down, 5, sizeof(cl_uint), &use_offsets);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(scan->down, 6, sizeof(cl_mem), &dst);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(scan->down, 7, sizeof(cl_uint), &inclusive);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(scan->down, 8, sizeof(cl_mem), &scan->total);
+  if(ret == CL_SUCCESS)
+    ret = launch(scan, queue, scan->down, groups);
+  return ret;
+}
+
+static cl_int
+run(struct scan *scan, cl_command_queue queue, cl_mem src, cl_mem dst, size_t n,
+    cl_uint mode, cl_uint threshold, cl_uint inclusive, cl_event *ev)
+{
+  cl_int ret = CL_SUCCESS;
+
+  scan->launches = 0;
+  if(n > ((size_t) 1 << 31))
+    return CL_INVALID_VALUE;
+  if(n > 0)
+    ret = scan_level(scan, queue, src, dst, n, mode, threshold, inclusive, 0);
+  else {
+    cl_uint zero = 0;
+    ret = clEnqueueFillBuffer(queue, scan->total, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, NULL);
+  }
+  if(ret == CL_SUCCESS && ev)
+    ret = clEnqueueMarkerWithWaitList(queue, 0, NULL, ev);
+  return ret;
+}
+
+cl_int
+scan_exclusive(struct scan *scan, cl_command_queue queue, cl_mem src, cl_mem dst,
+               size_t n, cl_event *ev)
+{
+  return run(scan, queue, src, dst, n, SCAN_MODE_SUM, 0, 0, ev);
+}
+
+cl_int
+scan_inclusive(struct scan *scan, cl_command_queue queue, cl_mem src, cl_mem dst,
+               size_t n, cl_event *ev)
+{
+  return run(scan, queue, src, dst, n, SCAN_MODE_SUM, 0, 1, ev);
+}
+
+cl_int
+scan_compact(struct scan *scan, cl_command_queue queue, cl_mem src, cl_mem dst,
+             size_t n, cl_uint threshold, cl_uint *count, cl_event *ev)
+{
+  cl_int ret = run(scan, queue, src, dst, n, SCAN_MODE_COMPACT, threshold, 0, ev);
+  if(ret == CL_SUCCESS && count)
+    ret = clEnqueueReadBuffer(queue, scan->total, CL_TRUE, 0, sizeof(cl_uint), count, 0, NULL, NULL);
+  return ret;
+}
+
+// Host versions.
+
+void
+scan_exclusive_host(const cl_uint *src, cl_uint *dst, size_t n)
+{
+  cl_uint sum = 0;
+  for(size_t i = 0; i < n; i++) {
+    cl_uint v = src[i];
+    dst[i] = sum;
+    sum += v;
+  }
+}
+
+void
+scan_inclusive_host(const cl_uint *src, cl_uint *dst, size_t n)
+{
+  cl_uint sum = 0;
+  for(size_t i = 0; i < n; i++)
+    dst[i] = sum += src[i];
+}
+
+size_t
+scan_compact_host(const cl_uint *src, cl_uint *dst, size_t n, cl_uint threshold)
+{
+  size_t count = 0;
+  for(size_t i = 0; i < n; i++)
+    if(src[i] < threshold)
+      dst[count++] = src[i];
+  return count;
+}
@@ -0,0 +1,68 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <CL/cl.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Prefix sums and stream compaction of uint buffers (sums wrap mod
+// 2^32), reduce-then-scan over tiles of SCAN_ITEMS * local elements:
+//
+//   1. scan_reduce  each group sums its tile into the level buffer
+//   2. the level buffer (one uint per tile) is scanned the same way,
+//      recursively, until it fits in one tile
+//   3. scan_down    each group scans its tile with
+//                   work_group_scan_exclusive_add, adds its tile's offset
+//                   and writes the result
+//
+// Every element is read twice and written once, so the scan is
+// work-efficient; a 10^8-element scan takes three levels. Compaction
+// scans the flags src[i] < threshold the same way, without storing
+// them, and the last pass scatters the kept elements in order.
+//
+// Kernels need OpenCL 2.0 work-group functions. Calls enqueue on an
+// in-order queue; ev, if not NULL, completes with the last launch.
+// n is limited to 2^31 elements; dst may be src for the scans, not for
+// compaction.
+
+#define SCAN_ITEMS 4      // consecutive elements per work-item, one uint4
+#define SCAN_MAX_LEVELS 16
+
+struct scan {
+  cl_program program;
+  cl_kernel reduce;
+  cl_kernel down;
+  size_t local;                   // work-group size, a power of two
+  cl_mem level[SCAN_MAX_LEVELS];  // tile sums, grown on demand
+  size_t level_size[SCAN_MAX_LEVELS];
+  cl_mem total;                   // the sum or the kept count of the last call
+  cl_uint launches;               // by the last call
+};
+
+// Builds the kernels (through program_cache) for `device`.
+cl_int scan_create(struct scan *scan, cl_context context, cl_device_id device);
+void scan_release(struct scan *scan);
+
+// dst[i] = src[0] + ... + src[i - 1] (exclusive) or + src[i] (inclusive).
+cl_int scan_exclusive(struct scan *scan, cl_command_queue queue, cl_mem src, cl_mem dst,
+                      size_t n, cl_event *ev);
+cl_int scan_inclusive(struct scan *scan, cl_command_queue queue, cl_mem src, cl_mem dst,
+                      size_t n, cl_event *ev);
+// Copies the elements of src below threshold to the front of dst, in
+// order. count, if not NULL, gets their number (a blocking read).
+cl_int scan_compact(struct scan *scan, cl_command_queue queue, cl_mem src, cl_mem dst,
+                    size_t n, cl_uint threshold, cl_uint *count, cl_event *ev);
+
+// Host versions.
+void scan_exclusive_host(const cl_uint *src, cl_uint *dst, size_t n);
+void scan_inclusive_host(const cl_uint *src, cl_uint *dst, size_t n);
+size_t scan_compact_host(const cl_uint *src, cl_uint *dst, size_t n, cl_uint threshold);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+#define CL_TARGET_OPENCL_VERSION 120
+
+#include <CL/cl.h>
+#include "segmin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Min of every segment (or every row) with segmin.c, checked against
+// the host. Segment lengths are random, most short and one in eight up
+// to -l items, so every lanes bucket gets used.
+
+#define NLOOPS 20
+
+static void
+usage(const char *prog)
+{
+  printf("usage: %s [-n segments] [-l max length]     variable-length segments\n"
+         "       %s -c cols [-n rows]                 rows of a matrix\n", prog, prog);
+}
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+  size_t nsegs = 100000, max_len = 10000, cols = 0;
+  int c;
+
+  while((c = getopt(argc, argv, "n:l:c:")) != -1) {
+    switch(c) {
+    case 'n': nsegs = strtoull(optarg, NULL, 0); break;
+    case 'l': max_len = strtoull(optarg, NULL, 0); break;
+    case 'c': cols = strtoull(optarg, NULL, 0); break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if(nsegs == 0 || max_len == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // 1. Segment offsets (a dense matrix for -c) and MWC random data.
+  cl_uint *offsets = (cl_uint *) malloc((nsegs + 1) * sizeof(cl_uint));
+  if(offsets == NULL) {
+    printf("malloc\n");
+    return -1;
+  }
+  cl_uint a = (cl_uint) time(NULL), b = a;
+  offsets[0] = 0;
+  for(size_t s = 0; s < nsegs; s++) {
+    size_t len;
+    b = (a * (b & 65535)) + (b >> 16);
+    if(cols)
+      len = cols;
+    else
+      len = b % 8 == 0 ? b / 8 % max_len : b / 8 % 32;
+    if(offsets[s] + len > 0xffffffffu) {
+      printf("more than 2^32 - 1 items\n");
+      return -1;
+    }
+    offsets[s + 1] = offsets[s] + (cl_uint) len;
+  }
+  size_t n = offsets[nsegs];
+  cl_uint *src = (cl_uint *) malloc((n ? n : 1) * sizeof(cl_uint));
+  cl_uint *dst = (cl_uint *) malloc(nsegs * sizeof(cl_uint));
+  cl_uint *expect = (cl_uint *) malloc(nsegs * sizeof(cl_uint));
+  if(src == NULL || dst == NULL || expect == NULL) {
+    printf("malloc\n");
+    return -1;
+  }
+  for(size_t i = 0; i < n; i++)
+    src[i] = b = (a * (b & 65535)) + (b >> 16);
+
+  // 2. Host reference.
+  double t = now();
+  if(cols)
+    segmin_rows_host(src, nsegs, cols, cols, expect);
+  else
+    segmin_segments_host(src, offsets, nsegs, expect);
+  t = now() - t;
+  printf("%zu %s, %zu items, host %.3f ms\n", nsegs, cols ? "rows" : "segments", n, t * 1e3);
+
+  // 3. Platform, device, context, queue.
+  cl_platform_id platform;
+  cl_device_id device;
+  cl_uint num_platforms = 0;
+  cl_int ret;
+  if(clGetPlatformIDs(1, &platform, &num_platforms) != CL_SUCCESS || num_platforms == 0) {
+    printf("no OpenCL platform\n");
+    return -1;
+  }
+  if(clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, NULL) != CL_SUCCESS) {
+    printf("clGetDeviceIDs\n");
+    return -1;
+  }
+  cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, &ret);
+  if(ret != CL_SUCCESS) {
+    printf("clCreateContext %d\n", ret);
+    return -1;
+  }
+  cl_command_queue queue = clCreateCommandQueue(context, device, 0, &ret);
+  if(ret != CL_SUCCESS) {
+    printf("clCreateCommandQueue %d\n", ret);
+    return -1;
+  }
+
+  // 4. Kernels and buffers.
+  struct segmin seg;
+  ret = segmin_create(&seg, context, device);
+  if(ret != CL_SUCCESS) {
+    printf("segmin_create %d\n", ret);
+    return -1;
+  }
+  cl_mem src_buf = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  (n ? n : 1) * sizeof(cl_uint), src, &ret);
+  cl_mem off_buf = NULL, dst_buf = NULL;
+  if(ret == CL_SUCCESS)
+    off_buf = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                             (nsegs + 1) * sizeof(cl_uint), offsets, &ret);
+  if(ret == CL_SUCCESS)
+    dst_buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, nsegs * sizeof(cl_uint), NULL, &ret);
+  if(ret != CL_SUCCESS) {
+    printf("clCreateBuffer %d\n", ret);
+    return -1;
+  }
+
+  // 5. Warm up, then time NLOOPS calls.
+  for(int i = 0; i <= NLOOPS && ret == CL_SUCCESS; i++) {
+    if(i == 1) {
+      clFinish(queue);
+      t = now();
+    }
+    if(cols)
+      ret = segmin_rows(&seg, queue, src_buf, nsegs, cols, cols, dst_buf, NULL);
+    else
+      ret = segmin_segments(&seg, queue, src_buf, off_buf, offsets, nsegs, dst_buf, NULL);
+  }
+  clFinish(queue);
+  t = (now() - t) / NLOOPS;
+  if(ret != CL_SUCCESS) {
+    printf("segmin %d\n", ret);
+    return -1;
+  }
+
+  // 6. Read back and check.
+  ret = clEnqueueReadBuffer(queue, dst_buf, CL_TRUE, 0, nsegs * sizeof(cl_uint), dst, 0, NULL, NULL);
+  if(ret != CL_SUCCESS) {
+    printf("clEnqueueReadBuffer %d\n", ret);
+    return -1;
+  }
+  printf("device: %u launches, local size %zu, %.3f ms, %.2f GB/sec\n",
+         seg.launches, seg.local, t * 1e3, n * sizeof(cl_uint) / t / 1e9);
+  int correct = memcmp(dst, expect, nsegs * sizeof(cl_uint)) == 0;
+  printf("%s\n", correct ? "result correct" : "result INcorrect");
+
+  clReleaseMemObject(src_buf);
+  clReleaseMemObject(off_buf);
+  clReleaseMemObject(dst_buf);
+  segmin_release(&seg);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  free(offsets);
+  free(src);
+  free(dst);
+  free(expect);
+  return correct ? 0 : 1;
+}
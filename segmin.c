@@ -0,0 +1,232 @@
+#define CL_TARGET_OPENCL_VERSION 120
+
+#include "segmin.h"
+#include "program_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SEGMIN_MAX_LOCAL 256
+
+// The team of a segment is `lanes` consecutive work-items of one group;
+// SEG and the bounds are evaluated only by teams with a segment.
+static const char *source =
+  "#define SEGMIN_BODY(SEG, BEGIN, END)                        \\\n"
+  "  uint lid = get_local_id(0), lane = lid & (lanes - 1);     \\\n"
+  "  uint slot = get_global_id(0) / lanes, seg = 0;            \\\n"
+  "  uint m = 0xffffffff;                                      \\\n"
+  "  if(slot < nsegs) {                                        \\\n"
+  "    seg = SEG;                                              \\\n"
+  "    uint end = END;                                         \\\n"
+  "    for(uint i = BEGIN + lane; i < end; i += lanes)         \\\n"
+  "      m = min(m, src[i]);                                   \\\n"
+  "  }                                                         \\\n"
+  "  scratch[lid] = m;                                         \\\n"
+  "  barrier(CLK_LOCAL_MEM_FENCE);                             \\\n"
+  "  for(uint s = lanes / 2; s > 0; s >>= 1) {                 \\\n"
+  "    if(lane < s)                                            \\\n"
+  "      scratch[lid] = min(scratch[lid], scratch[lid + s]);   \\\n"
+  "    barrier(CLK_LOCAL_MEM_FENCE);                           \\\n"
+  "  }                                                         \\\n"
+  "  if(lane == 0 && slot < nsegs)                             \\\n"
+  "    dst[seg] = scratch[lid];\n"
+  "\n"
+  "// ids[first ..] are the segments of one lanes bucket.\n"
+  "kernel void segmin_segments(global const uint *src, global const uint *offsets,\n"
+  "                            global const uint *ids, uint first, uint nsegs,\n"
+  "                            uint lanes, global uint *dst, local uint *scratch)\n"
+  "{\n"
+  "  SEGMIN_BODY(ids[first + slot], offsets[seg], offsets[seg + 1])\n"
+  "}\n"
+  "\n"
+  "kernel void segmin_rows(global const uint *src, uint cols, uint stride,\n"
+  "                        uint nsegs, uint lanes, global uint *dst, local uint *scratch)\n"
+  "{\n"
+  "  SEGMIN_BODY(slot, seg * stride, seg * stride + cols)\n"
+  "}\n";
+
+static unsigned
+ilog2(size_t x)
+{
+  unsigned r = 0;
+  while(x >>= 1)
+    r++;
+  return r;
+}
+
+cl_int
+segmin_create(struct segmin *seg, cl_context context, cl_device_id device)
+{
+  cl_int ret;
+  size_t wg[2];
+
+  memset(seg, 0, sizeof(*seg));
+  seg->program = program_cache_build(context, device, source, NULL, &ret);
+  if(ret == CL_SUCCESS)
+    seg->segments = clCreateKernel(seg->program, "segmin_segments", &ret);
+  if(ret == CL_SUCCESS)
+    seg->rows = clCreateKernel(seg->program, "segmin_rows", &ret);
+  if(ret == CL_SUCCESS)
+    ret = clGetKernelWorkGroupInfo(seg->segments, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                   sizeof(size_t), &wg[0], NULL);
+  if(ret == CL_SUCCESS)
+    ret = clGetKernelWorkGroupInfo(seg->rows, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                   sizeof(size_t), &wg[1], NULL);
+  if(ret != CL_SUCCESS) {
+    segmin_release(seg);
+    return ret;
+  }
+  seg->local = wg[0] < wg[1] ? wg[0] : wg[1];
+  if(seg->local > SEGMIN_MAX_LOCAL)
+    seg->local = SEGMIN_MAX_LOCAL;
+  seg->local = (size_t) 1 << ilog2(seg->local);
+  return CL_SUCCESS;
+}
+
+void
+segmin_release(struct segmin *seg)
+{
+  if(seg->segments) clReleaseKernel(seg->segments);
+  if(seg->rows)     clReleaseKernel(seg->rows);
+  if(seg->program)  clReleaseProgram(seg->program);
+  memset(seg, 0, sizeof(*seg));
+}
+
+size_t
+segmin_lanes(const struct segmin *seg, size_t len)
+{
+  size_t lanes = 1;
+  while(lanes < seg->local && lanes * SEGMIN_ITEMS_PER_LANE < len)
+    lanes *= 2;
+  return lanes;
+}
+
+// `count` teams of `lanes`, rounded up to whole groups.
+static cl_int
+launch(struct segmin *seg, cl_command_queue queue, cl_kernel kernel, size_t count, size_t lanes)
+{
+  size_t global = (count * lanes + seg->local - 1) / seg->local * seg->local;
+  cl_uint n = (cl_uint) count, l = (cl_uint) lanes;
+  cl_uint first = kernel == seg->segments ? 4 : 3;
+  cl_int ret = clSetKernelArg(kernel, first, sizeof(cl_uint), &n);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(kernel, first + 1, sizeof(cl_uint), &l);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(kernel, first + 3, seg->local * sizeof(cl_uint), NULL);
+  if(ret == CL_SUCCESS)
+    ret = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, &seg->local, 0, NULL, NULL);
+  if(ret == CL_SUCCESS)
+    seg->launches++;
+  return ret;
+}
+
+static cl_int
+finish(cl_command_queue queue, cl_int ret, cl_event *ev)
+{
+  if(ret == CL_SUCCESS && ev)
+    ret = clEnqueueMarkerWithWaitList(queue, 0, NULL, ev);
+  return ret;
+}
+
+cl_int
+segmin_segments(struct segmin *seg, cl_command_queue queue, cl_mem src,
+                cl_mem offsets, const cl_uint *host_offsets, size_t nsegs,
+                cl_mem dst, cl_event *ev)
+{
+  size_t count[32] = { 0 }, start[32], pos[32];
+  unsigned nbuckets = ilog2(seg->local) + 1;
+  cl_context context;
+  cl_mem ids_buf;
+  cl_uint *ids;
+  cl_int ret;
+
+  seg->launches = 0;
+  if(nsegs == 0)
+    return finish(queue, CL_SUCCESS, ev);
+
+  // Bucket the segments by team size; ids lists them bucket by bucket.
+  for(size_t s = 0; s < nsegs; s++)
+    count[ilog2(segmin_lanes(seg, host_offsets[s + 1] - host_offsets[s]))]++;
+  for(unsigned b = 0, sum = 0; b < nbuckets; sum += count[b], b++)
+    start[b] = pos[b] = sum;
+  ids = (cl_uint *) malloc(nsegs * sizeof(cl_uint));
+  if(ids == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+  for(size_t s = 0; s < nsegs; s++)
+    ids[pos[ilog2(segmin_lanes(seg, host_offsets[s + 1] - host_offsets[s]))]++] = (cl_uint) s;
+
+  ret = clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+  if(ret != CL_SUCCESS) {
+    free(ids);
+    return ret;
+  }
+  ids_buf = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                           nsegs * sizeof(cl_uint), ids, &ret);
+  free(ids);
+  if(ret != CL_SUCCESS)
+    return ret;
+
+  ret = clSetKernelArg(seg->segments, 0, sizeof(cl_mem), &src);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(seg->segments, 1, sizeof(cl_mem), &offsets);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(seg->segments, 2, sizeof(cl_mem), &ids_buf);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(seg->segments, 6, sizeof(cl_mem), &dst);
+  for(unsigned b = 0; b < nbuckets && ret == CL_SUCCESS; b++) {
+    cl_uint first = (cl_uint) start[b];
+    if(count[b] == 0)
+      continue;
+    ret = clSetKernelArg(seg->segments, 3, sizeof(cl_uint), &first);
+    if(ret == CL_SUCCESS)
+      ret = launch(seg, queue, seg->segments, count[b], (size_t) 1 << b);
+  }
+  // Released once the launches using it are done.
+  clReleaseMemObject(ids_buf);
+  return finish(queue, ret, ev);
+}
+
+cl_int
+segmin_rows(struct segmin *seg, cl_command_queue queue, cl_mem src,
+            size_t rows, size_t cols, size_t stride, cl_mem dst, cl_event *ev)
+{
+  cl_uint c = (cl_uint) cols, st = (cl_uint) stride;
+  cl_int ret;
+
+  seg->launches = 0;
+  if(rows == 0)
+    return finish(queue, CL_SUCCESS, ev);
+  ret = clSetKernelArg(seg->rows, 0, sizeof(cl_mem), &src);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(seg->rows, 1, sizeof(cl_uint), &c);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(seg->rows, 2, sizeof(cl_uint), &st);
+  if(ret == CL_SUCCESS)
+    ret = clSetKernelArg(seg->rows, 5, sizeof(cl_mem), &dst);
+  if(ret == CL_SUCCESS)
+    ret = launch(seg, queue, seg->rows, rows, segmin_lanes(seg, cols));
+  return finish(queue, ret, ev);
+}
+
+// Host versions.
+
+void
+segmin_segments_host(const cl_uint *src, const cl_uint *offsets, size_t nsegs, cl_uint *dst)
+{
+  for(size_t s = 0; s < nsegs; s++) {
+    cl_uint m = 0xffffffff;
+    for(cl_uint i = offsets[s]; i < offsets[s + 1]; i++)
+      m = src[i] < m ? src[i] : m;
+    dst[s] = m;
+  }
+}
+
+void
+segmin_rows_host(const cl_uint *src, size_t rows, size_t cols, size_t stride, cl_uint *dst)
+{
+  for(size_t r = 0; r < rows; r++) {
+    cl_uint m = 0xffffffff;
+    for(size_t c = 0; c < cols; c++)
+      m = src[r * stride + c] < m ? src[r * stride + c] : m;
+    dst[r] = m;
+  }
+}
@@ -0,0 +1,63 @@
+#ifndef SEGMIN_H
+#define SEGMIN_H
+
+#include <CL/cl.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Min of many segments of one uint buffer in a handful of launches,
+// instead of one parallel_min launch per segment.
+//
+//   segments  dst[s] = min(src[offsets[s] .. offsets[s + 1])), s < nsegs
+//   rows      dst[r] = min(src[r * stride .. r * stride + cols)), r < rows
+//
+// Each segment is reduced by a team of `lanes` work-items (a power of
+// two) that stride through it and finish with a tree in local memory.
+// lanes grows with the segment length, about SEGMIN_ITEMS_PER_LANE
+// elements per work-item, up to the work-group size: long segments get
+// a whole work-group each, short ones are packed local / lanes to a
+// group. Segments are bucketed by lanes on the host and each bucket is
+// one launch, so a call makes at most log2(local size) + 1 launches;
+// rows have one length and take one.
+//
+// An empty segment gives 0xffffffff. Offsets and indexes are uints, so
+// src is limited to 2^32 - 1 elements. Calls enqueue on an in-order
+// queue; ev, if not NULL, completes with the last launch.
+
+#define SEGMIN_ITEMS_PER_LANE 8
+
+struct segmin {
+  cl_program program;
+  cl_kernel segments;
+  cl_kernel rows;
+  size_t local;      // work-group size, a power of two
+  cl_uint launches;  // by the last call
+};
+
+// Builds the kernels (through program_cache) for `device`.
+cl_int segmin_create(struct segmin *seg, cl_context context, cl_device_id device);
+void segmin_release(struct segmin *seg);
+
+// offsets is the device copy of host_offsets (nsegs + 1 entries); the
+// host copy decides the bucketing. dst holds nsegs uints.
+cl_int segmin_segments(struct segmin *seg, cl_command_queue queue, cl_mem src,
+                       cl_mem offsets, const cl_uint *host_offsets, size_t nsegs,
+                       cl_mem dst, cl_event *ev);
+cl_int segmin_rows(struct segmin *seg, cl_command_queue queue, cl_mem src,
+                   size_t rows, size_t cols, size_t stride, cl_mem dst, cl_event *ev);
+
+// Work-items per segment of `len` elements.
+size_t segmin_lanes(const struct segmin *seg, size_t len);
+
+// Host versions.
+void segmin_segments_host(const cl_uint *src, const cl_uint *offsets, size_t nsegs, cl_uint *dst);
+void segmin_rows_host(const cl_uint *src, size_t rows, size_t cols, size_t stride, cl_uint *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
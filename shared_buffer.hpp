@@ -0,0 +1,264 @@
+#ifndef SHARED_BUFFER_HPP
+#define SHARED_BUFFER_HPP
+
+////////////////////////////////////////////////////////////////
+// Host-visible device memory with a selectable strategy.
+//
+//   copy        host array + device buffer, explicit write/read
+//               (what saxpy.cxx always did with COPY_HOST_PTR)
+//   usehost     page-aligned host array wrapped with USE_HOST_PTR,
+//               accessed through map/unmap
+//   allochost   ALLOC_HOST_PTR buffer, accessed through map/unmap
+//   svm-coarse  coarse-grained SVM, accessed through SVM map/unmap
+//   svm-fine    fine-grained SVM, accessed directly after a finish
+//
+// On CPU and integrated devices every strategy but copy can avoid the
+// transfer entirely.
+//
+// Given a buffer_pool, copy and allochost take their buffers from it
+// (copy stages through a pinned pool buffer instead of a host vector)
+// and hand them back on destruction, so the next SharedBuffer of a
+// similar size skips the allocation.
+//
+//   SharedBuffer x(context, queue, MEM_USE_HOST, bytes, CL_MEM_READ_ONLY);
+//   float *p = (float *) x.map(CL_MAP_WRITE_INVALIDATE_REGION);
+//   ... fill p ...
+//   x.unmap();
+//   x.setArg(kernel, 0);
+////////////////////////////////////////////////////////////////
+
+#include <CL/opencl.hpp>
+#include "buffer_pool.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+enum MemMode
+{
+  MEM_COPY,
+  MEM_USE_HOST,
+  MEM_ALLOC_HOST,
+  MEM_SVM_COARSE,
+  MEM_SVM_FINE
+};
+
+inline const char * memModeName(MemMode m)
+{
+  switch(m)
+    {
+    case MEM_COPY:       return "copy";
+    case MEM_USE_HOST:   return "usehost";
+    case MEM_ALLOC_HOST: return "allochost";
+    case MEM_SVM_COARSE: return "svm-coarse";
+    case MEM_SVM_FINE:   return "svm-fine";
+    }
+  return "?";
+}
+
+inline MemMode parseMemMode(const std::string &s)
+{
+  for(int m = MEM_COPY; m <= MEM_SVM_FINE; m++)
+    if(s == memModeName((MemMode) m))
+      return (MemMode) m;
+  throw(std::string("unknown memory mode " + s + " (copy, usehost, allochost, svm-coarse, svm-fine)"));
+}
+
+inline bool memModeSupported(const cl::Device &device, MemMode m)
+{
+  if(m != MEM_SVM_COARSE && m != MEM_SVM_FINE)
+    return true;
+  cl_device_svm_capabilities caps = 0;
+  try
+    {
+      caps = device.getInfo<CL_DEVICE_SVM_CAPABILITIES>();
+    }
+  catch(cl::Error &)
+    {
+      return false; // pre-2.0 device
+    }
+  return m == MEM_SVM_COARSE ? (caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER) != 0
+                             : (caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) != 0;
+}
+
+class SharedBuffer
+{
+public:
+  SharedBuffer(const cl::Context &context, const cl::CommandQueue &queue,
+               MemMode mode, size_t bytes, cl_mem_flags access,
+               buffer_pool *pool = NULL)
+    : context_(context), queue_(queue), mode_(mode), bytes_(bytes),
+      host_(NULL), svm_(NULL), mapped_(NULL), mapFlags_(0), pool_(pool), shadow_(NULL)
+  {
+    switch(mode_)
+      {
+      case MEM_COPY:
+        if(pool_)
+          {
+            void *host;
+            buffer_ = pooled(buffer_pool_get(pool_, access, bytes_, &err_));
+            cl_mem staging = buffer_pool_get_staging(pool_, queue_(), bytes_, &host, &err_);
+            if(staging == NULL)
+              {
+                buffer_pool_put(pool_, buffer_());
+                throw cl::Error(err_, "buffer_pool_get_staging");
+              }
+            staging_ = cl::Buffer(staging, true);
+            shadow_ = (unsigned char *) host;
+            break;
+          }
+        shadowVec_.resize(bytes_);
+        shadow_ = shadowVec_.data();
+        buffer_ = cl::Buffer(context_, access, bytes_);
+        break;
+      case MEM_USE_HOST:
+        // Page-aligned, size rounded to a cache line, as zero-copy
+        // implementations require.
+        if(posix_memalign(&host_, 4096, (bytes_ + 63) / 64 * 64) != 0)
+          throw(std::string("Error: Failed to allocate page-aligned host memory\n"));
+        buffer_ = cl::Buffer(context_, access | CL_MEM_USE_HOST_PTR, bytes_, host_);
+        break;
+      case MEM_ALLOC_HOST:
+        if(pool_)
+          buffer_ = pooled(buffer_pool_get(pool_, access | CL_MEM_ALLOC_HOST_PTR, bytes_, &err_));
+        else
+          buffer_ = cl::Buffer(context_, access | CL_MEM_ALLOC_HOST_PTR, bytes_);
+        break;
+      case MEM_SVM_COARSE:
+      case MEM_SVM_FINE:
+        svm_ = clSVMAlloc(context_(),
+                          CL_MEM_READ_WRITE | (mode_ == MEM_SVM_FINE ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0),
+                          bytes_, 0);
+        if(svm_ == NULL)
+          throw(std::string("Error: clSVMAlloc failed\n"));
+        break;
+      }
+  }
+
+  ~SharedBuffer()
+  {
+    if(mapped_)
+      unmap();
+    if(svm_)
+      {
+        queue_.finish();
+        clSVMFree(context_(), svm_);
+      }
+    if(pool_)
+      {
+        // Pending commands must not see the buffers change hands.
+        queue_.finish();
+        if(buffer_())
+          buffer_pool_put(pool_, buffer_());
+        if(staging_())
+          buffer_pool_put(pool_, staging_());
+      }
+    free(host_);
+  }
+
+  SharedBuffer(const SharedBuffer &) = delete;
+  SharedBuffer & operator=(const SharedBuffer &) = delete;
+
+  ////////////////////////////////////////////////////////////////
+  // Blocking host access. CL_MAP_READ sees the device's writes,
+  // CL_MAP_WRITE(_INVALIDATE_REGION) is published by unmap().
+  ////////////////////////////////////////////////////////////////
+  void * map(cl_map_flags flags)
+  {
+    mapFlags_ = flags;
+    switch(mode_)
+      {
+      case MEM_COPY:
+        if(flags & CL_MAP_READ)
+          queue_.enqueueReadBuffer(buffer_, CL_TRUE, 0, bytes_, shadow_);
+        mapped_ = shadow_;
+        break;
+      case MEM_USE_HOST:
+      case MEM_ALLOC_HOST:
+        mapped_ = queue_.enqueueMapBuffer(buffer_, CL_TRUE, flags, 0, bytes_);
+        break;
+      case MEM_SVM_COARSE:
+        {
+          cl_int err = clEnqueueSVMMap(queue_(), CL_TRUE, flags, svm_, bytes_, 0, NULL, NULL);
+          if(err != CL_SUCCESS)
+            throw cl::Error(err, "clEnqueueSVMMap");
+          mapped_ = svm_;
+        }
+        break;
+      case MEM_SVM_FINE:
+        queue_.finish();
+        mapped_ = svm_;
+        break;
+      }
+    return mapped_;
+  }
+
+  void unmap()
+  {
+    switch(mode_)
+      {
+      case MEM_COPY:
+        if(mapFlags_ & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION))
+          queue_.enqueueWriteBuffer(buffer_, CL_TRUE, 0, bytes_, shadow_);
+        break;
+      case MEM_USE_HOST:
+      case MEM_ALLOC_HOST:
+        queue_.enqueueUnmapMemObject(buffer_, mapped_);
+        break;
+      case MEM_SVM_COARSE:
+        {
+          cl_int err = clEnqueueSVMUnmap(queue_(), svm_, 0, NULL, NULL);
+          if(err != CL_SUCCESS)
+            throw cl::Error(err, "clEnqueueSVMUnmap");
+        }
+        break;
+      case MEM_SVM_FINE:
+        break;
+      }
+    mapped_ = NULL;
+  }
+
+  // Bind as kernel argument `index`: the buffer, or the SVM pointer.
+  void setArg(cl::Kernel &kernel, cl_uint index) const
+  {
+    if(svm_)
+      {
+        cl_int err = clSetKernelArgSVMPointer(kernel(), index, svm_);
+        if(err != CL_SUCCESS)
+          throw cl::Error(err, "clSetKernelArgSVMPointer");
+      }
+    else
+      kernel.setArg(index, buffer_);
+  }
+
+  // The buffer object, NULL in the SVM modes.
+  const cl::Buffer & buffer() const { return buffer_; }
+  MemMode mode() const { return mode_; }
+  size_t size() const { return bytes_; }
+
+private:
+  // Wrap a pool buffer; the wrapper takes its own reference and the pool
+  // keeps the one it hands back.
+  cl::Buffer pooled(cl_mem buf)
+  {
+    if(buf == NULL)
+      throw cl::Error(err_, "buffer_pool_get");
+    return cl::Buffer(buf, true);
+  }
+
+  cl::Context context_;
+  cl::CommandQueue queue_;
+  MemMode mode_;
+  size_t bytes_;
+  cl::Buffer buffer_;
+  cl::Buffer staging_;
+  std::vector<unsigned char> shadowVec_;
+  void *host_;
+  void *svm_;
+  void *mapped_;
+  cl_map_flags mapFlags_;
+  buffer_pool *pool_;
+  unsigned char *shadow_;
+  cl_int err_;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#define CL_TARGET_OPENCL_VERSION 110
+
+#include "specialize.h"
+#include "program_cache.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_VARIANTS 64
+
+struct variant {
+  cl_context context;
+  cl_device_id device;
+  uint64_t source_hash;
+  char *options;
+  cl_program program;
+};
+
+static struct variant variants[MAX_VARIANTS];
+static int nvariants;
+static int next_evict;
+
+// FNV-1a, as in program_cache.
+static uint64_t
+hash_string(const char *s)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for(; *s; s++) {
+    h ^= (unsigned char) *s;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+int
+spec_define(char *opts, size_t size, const char *name, const char *value)
+{
+  size_t len = strlen(opts);
+  int n = snprintf(opts + len, size - len, " -D%s=%s", name, value);
+  if(n < 0 || (size_t) n >= size - len) {
+    opts[len] = '\0';
+    return -1;
+  }
+  return 0;
+}
+
+int
+spec_define_uint(char *opts, size_t size, const char *name, unsigned long value)
+{
+  char v[32];
+  snprintf(v, sizeof(v), "%luu", value);
+  return spec_define(opts, size, name, v);
+}
+
+int
+spec_define_float(char *opts, size_t size, const char *name, float value)
+{
+  char v[48];
+  snprintf(v, sizeof(v), "(%af)", (double) value);
+  return spec_define(opts, size, name, v);
+}
+
+static void
+release_variant(struct variant *v)
+{
+  clReleaseProgram(v->program);
+  free(v->options);
+  memset(v, 0, sizeof(*v));
+}
+
+cl_program
+spec_build(cl_context context,
+           cl_device_id device,
+           const char *source,
+           const char *options,
+           cl_int *errcode_ret)
+{
+  uint64_t h = hash_string(source);
+  const char *opts = options ? options : "";
+
+  for(int i = 0; i < nvariants; i++) {
+    struct variant *v = &variants[i];
+    if(v->context == context && v->device == device && v->source_hash == h &&
+       strcmp(v->options, opts) == 0) {
+      clRetainProgram(v->program);
+      *errcode_ret = CL_SUCCESS;
+      return v->program;
+    }
+  }
+
+  cl_program program = program_cache_build(context, device, source, options, errcode_ret);
+  if(program == NULL || *errcode_ret != CL_SUCCESS)
+    return program;
+
+  char *copy = strdup(opts);
+  if(copy == NULL)
+    return program; // not cached, still usable
+
+  // Full: replace the oldest entry.
+  struct variant *v;
+  if(nvariants < MAX_VARIANTS)
+    v = &variants[nvariants++];
+  else {
+    v = &variants[next_evict];
+    next_evict = (next_evict + 1) % MAX_VARIANTS;
+    release_variant(v);
+  }
+  v->context = context;
+  v->device = device;
+  v->source_hash = h;
+  v->options = copy;
+  v->program = program;
+  clRetainProgram(program);
+  return program;
+}
+
+void
+spec_release_all(void)
+{
+  for(int i = 0; i < nvariants; i++)
+    release_variant(&variants[i]);
+  nvariants = 0;
+  next_evict = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef SPECIALIZE_H
+#define SPECIALIZE_H
+
+#include <CL/cl.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Compile-time specialization of kernels through -D build options.
+//
+// A kernel reads its tunables through SPEC_* macros that fall back to
+// its runtime arguments when undefined, e.g.
+//
+//   #ifdef SPEC_COUNT
+//   #define COUNT SPEC_COUNT
+//   #else
+//   #define COUNT ((nitems / 4) / get_global_size(0))
+//   #endif
+//
+// so the generic build and every specialized build come from the same
+// source. Defining them lets the compiler fold the values, unroll loops
+// with known trip counts and drop branches on the access pattern.
+//
+// spec_build() keeps each (context, device, source, options) variant for
+// the life of the process, on top of the on-disk program_cache, so
+// sweeping parameters builds each set once. Not thread-safe.
+
+// Append " -D<name>=<value>" to the option string opts (size bytes).
+// Returns 0, or -1 if it does not fit.
+int spec_define(char *opts, size_t size, const char *name, const char *value);
+int spec_define_uint(char *opts, size_t size, const char *name, unsigned long value);
+// As an exact hexadecimal float literal.
+int spec_define_float(char *opts, size_t size, const char *name, float value);
+
+// Like program_cache_build(); the caller owns one reference to the
+// returned program and releases it as usual.
+cl_program spec_build(cl_context context,
+                      cl_device_id device,
+                      const char *source,
+                      const char *options,
+                      cl_int *errcode_ret);
+
+// Drop every cached variant. Variants are keyed by the context handle,
+// so call this before releasing a context that may be reused.
+void spec_release_all(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
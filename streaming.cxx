@@ -0,0 +1,338 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+
+#include "buffer_pool.h"
+#include "reduction.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+////////////////////////////////////////////////////////////////
+// Out-of-core streaming for min and saxpy.
+//
+// The input stays in host memory and is fed to the device in chunks
+// through a ring of `nbuf` device staging buffers. Each slot also has
+// a pinned host buffer (the pool's mapped CL_MEM_ALLOC_HOST_PTR
+// staging): the host copies a chunk into it and the transfer runs from
+// there, since drivers copy non-blocking transfers from pageable memory
+// synchronously. Uploads run on one queue, kernels on another and
+// (saxpy) downloads on a third; events link them:
+//
+//   upload(i)   waits for the compute (min) / download (saxpy) that last
+//               used slot i % nbuf
+//   compute(i)  waits for upload(i)
+//   download(i) waits for compute(i)
+//
+// so the transfer of chunk i+1 overlaps the kernel of chunk i and the
+// total time approaches max(transfer, compute) instead of the sum. Each
+// min chunk writes its own partial result, combined on the host at the
+// end.
+//
+//   ./streaming min|saxpy [-n items] [-c chunk items] [-b buffers]
+////////////////////////////////////////////////////////////////
+
+void usage()
+{
+  cerr << "usage: streaming min|saxpy [-n items] [-c chunk items] [-b buffers]" << endl;
+}
+
+////////////////////////////////////////////////////////////////
+// Globals
+////////////////////////////////////////////////////////////////
+cl::Context context;
+cl::Device device;
+cl::CommandQueue upload;
+cl::CommandQueue compute;
+cl::CommandQueue download;
+buffer_pool *pool = NULL;
+
+// Same grid-stride saxpy as saxpy.cxx.
+string saxpyStr =
+  "__kernel void saxpy(const global float *x,\n"
+  "                       __global float * y,\n"
+  "                            const float a,\n"
+  "                             const uint n)\n"
+  "{                                         \n"
+  "  for(uint gid = get_global_id(0); gid < n;\n"
+  "      gid += get_global_size(0))          \n"
+  "    y[gid] = a * x[gid] + y[gid];         \n"
+  "}                                         \n";
+
+////////////////////////////////////////////////////////////////
+// A pinned host slot: a mapped staging buffer from the pool
+////////////////////////////////////////////////////////////////
+struct Pinned
+{
+  cl::Buffer buf;
+  void *host;
+};
+
+Pinned pinned(size_t bytes)
+{
+  Pinned p;
+  cl_int err;
+  cl_mem buf = buffer_pool_get_staging(pool, upload(), bytes, &p.host, &err);
+  if(buf == NULL)
+    throw cl::Error(err, "buffer_pool_get_staging");
+  p.buf = cl::Buffer(buf, true);
+  return p;
+}
+
+void putPinned(std::vector<Pinned> &slots)
+{
+  for(Pinned &p : slots)
+    buffer_pool_put(pool, p.buf());
+  slots.clear();
+}
+
+////////////////////////////////////////////////////////////////
+// START->END time covered by a list of profiled events: the union of
+// their intervals, so that overlapping uploads and downloads on
+// different queues count once
+////////////////////////////////////////////////////////////////
+double busySeconds(const std::vector<cl::Event> &evs)
+{
+  std::vector<std::pair<cl_ulong, cl_ulong> > spans;
+  for(const cl::Event &ev : evs)
+    spans.push_back(std::make_pair(ev.getProfilingInfo<CL_PROFILING_COMMAND_START>(),
+                                   ev.getProfilingInfo<CL_PROFILING_COMMAND_END>()));
+  std::sort(spans.begin(), spans.end());
+  cl_ulong ns = 0, end = 0;
+  for(const std::pair<cl_ulong, cl_ulong> &sp : spans)
+    {
+      cl_ulong from = std::max(sp.first, end);
+      if(sp.second > from)
+        {
+          ns += sp.second - from;
+          end = sp.second;
+        }
+    }
+  return ns / 1e9;
+}
+
+void report(const char *name, size_t bytes, double wall,
+            const std::vector<cl::Event> &transfers, const std::vector<cl::Event> &kernels)
+{
+  double t = busySeconds(transfers), k = busySeconds(kernels);
+  cout << name << ": " << bytes / 1e9 << " GB in " << wall * 1e3 << " ms, "
+       << bytes / wall / 1e9 << " GB/sec" << endl
+       << "  transfer busy " << t * 1e3 << " ms, compute busy " << k * 1e3 << " ms, "
+       << "sum " << (t + k) * 1e3 << " ms, max " << std::max(t, k) * 1e3 << " ms" << endl;
+}
+
+////////////////////////////////////////////////////////////////
+// Streaming min over n uints
+////////////////////////////////////////////////////////////////
+bool streamMin(size_t n, size_t chunk, size_t nbuf)
+{
+  // MWC init, as in parallel_min.
+  std::vector<cl_uint> host(n);
+  cl_uint a = (cl_uint) time(NULL), b = a;
+  cl_uint expect = (cl_uint) -1;
+  for(size_t i = 0; i < n; i++)
+    {
+      host[i] = b = (a * (b & 65535)) + (b >> 16);
+      expect = std::min(expect, host[i]);
+    }
+
+  size_t nchunks = (n + chunk - 1) / chunk;
+  reduction::Reduction<reduction::Min, cl_uint, 4> red(context, device);
+  std::vector<cl::Buffer> staging(nbuf);
+  std::vector<Pinned> pin;
+  for(size_t s = 0; s < nbuf; s++)
+    {
+      staging[s] = cl::Buffer(context, CL_MEM_READ_ONLY, chunk * sizeof(cl_uint));
+      pin.push_back(pinned(chunk * sizeof(cl_uint)));
+    }
+  cl::Buffer partV(context, CL_MEM_READ_WRITE, nchunks * sizeof(cl_uint));
+  cl::Buffer partI(context, CL_MEM_READ_WRITE, nchunks * sizeof(cl_uint));
+
+  std::vector<cl::Event> writes(nchunks), kernels(nchunks);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(size_t i = 0; i < nchunks; i++)
+    {
+      size_t s = i % nbuf;
+      size_t off = i * chunk;
+      size_t len = std::min(chunk, n - off);
+      std::vector<cl::Event> reuse;
+      if(i >= nbuf)
+        {
+          // The pinned slot is free once its last upload is done.
+          writes[i - nbuf].wait();
+          reuse.push_back(kernels[i - nbuf]);
+        }
+      memcpy(pin[s].host, &host[off], len * sizeof(cl_uint));
+      upload.enqueueWriteBuffer(staging[s], CL_FALSE, 0, len * sizeof(cl_uint), pin[s].host,
+                                reuse.empty() ? NULL : &reuse, &writes[i]);
+      std::vector<cl::Event> ready(1, writes[i]);
+      red.enqueueTo(compute, staging[s], (cl_uint) len, partV, partI, (cl_uint) i, &ready, &kernels[i]);
+      // Let both queues start work without waiting for the next finish.
+      upload.flush();
+      compute.flush();
+    }
+  std::vector<cl_uint> partial(nchunks);
+  compute.enqueueReadBuffer(partV, CL_TRUE, 0, nchunks * sizeof(cl_uint), partial.data());
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  putPinned(pin);
+
+  cl_uint got = *std::min_element(partial.begin(), partial.end());
+  report("min", n * sizeof(cl_uint), wall, writes, kernels);
+  cout << "computed value: " << got << (got == expect ? ", result correct" : ", result INcorrect") << endl;
+  return got == expect;
+}
+
+////////////////////////////////////////////////////////////////
+// Streaming y = a * x + y over n floats
+////////////////////////////////////////////////////////////////
+bool streamSaxpy(size_t n, size_t chunk, size_t nbuf)
+{
+  const cl_float a = 2.f;
+  std::vector<cl_float> x(n), y(n);
+  for(size_t i = 0; i < n; i++)
+    {
+      x[i] = cl_float(i % 1024);
+      y[i] = cl_float(1023 - i % 1024);
+    }
+
+  cl::Program::Sources sources = { saxpyStr };
+  cl::Program program(context, sources);
+  program.build(std::vector<cl::Device>(1, device));
+  cl::Kernel kernel(program, "saxpy");
+
+  size_t nchunks = (n + chunk - 1) / chunk;
+  std::vector<cl::Buffer> bufX(nbuf), bufY(nbuf);
+  std::vector<Pinned> pinX, pinY;
+  for(size_t s = 0; s < nbuf; s++)
+    {
+      bufX[s] = cl::Buffer(context, CL_MEM_READ_ONLY, chunk * sizeof(cl_float));
+      bufY[s] = cl::Buffer(context, CL_MEM_READ_WRITE, chunk * sizeof(cl_float));
+      pinX.push_back(pinned(chunk * sizeof(cl_float)));
+      pinY.push_back(pinned(chunk * sizeof(cl_float)));
+    }
+  // Chunk i comes back into pinY[i % nbuf]; copy it out to y.
+  auto drain = [&](size_t i)
+    {
+      size_t off = i * chunk;
+      memcpy(&y[off], pinY[i % nbuf].host, std::min(chunk, n - off) * sizeof(cl_float));
+    };
+
+  std::vector<cl::Event> transfers, kernels(nchunks), reads(nchunks);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(size_t i = 0; i < nchunks; i++)
+    {
+      size_t s = i % nbuf;
+      size_t off = i * chunk;
+      size_t len = std::min(chunk, n - off);
+      std::vector<cl::Event> reuse;
+      if(i >= nbuf)
+        {
+          // The slot's last download is done, so are its uploads.
+          reads[i - nbuf].wait();
+          drain(i - nbuf);
+          reuse.push_back(reads[i - nbuf]);
+        }
+      memcpy(pinX[s].host, &x[off], len * sizeof(cl_float));
+      memcpy(pinY[s].host, &y[off], len * sizeof(cl_float));
+      cl::Event wx, wy;
+      upload.enqueueWriteBuffer(bufX[s], CL_FALSE, 0, len * sizeof(cl_float), pinX[s].host,
+                                reuse.empty() ? NULL : &reuse, &wx);
+      upload.enqueueWriteBuffer(bufY[s], CL_FALSE, 0, len * sizeof(cl_float), pinY[s].host,
+                                reuse.empty() ? NULL : &reuse, &wy);
+      std::vector<cl::Event> ready = { wx, wy };
+      // setArg is captured at enqueue time, so one kernel object serves
+      // every slot.
+      kernel.setArg(0, bufX[s]);
+      kernel.setArg(1, bufY[s]);
+      kernel.setArg(2, a);
+      kernel.setArg(3, (cl_uint) len);
+      compute.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((len + 63) / 64 * 64), cl::NDRange(64),
+                                   &ready, &kernels[i]);
+      std::vector<cl::Event> done(1, kernels[i]);
+      download.enqueueReadBuffer(bufY[s], CL_FALSE, 0, len * sizeof(cl_float), pinY[s].host, &done, &reads[i]);
+      transfers.push_back(wx);
+      transfers.push_back(wy);
+      transfers.push_back(reads[i]);
+      upload.flush();
+      compute.flush();
+      download.flush();
+    }
+  download.finish();
+  for(size_t i = nchunks > nbuf ? nchunks - nbuf : 0; i < nchunks; i++)
+    drain(i);
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  putPinned(pinX);
+  putPinned(pinY);
+
+  bool ok = true;
+  for(size_t i = 0; i < n && ok; i++)
+    ok = y[i] == a * cl_float(i % 1024) + cl_float(1023 - i % 1024);
+  report("saxpy", 3 * n * sizeof(cl_float), wall, transfers, kernels);
+  cout << (ok ? "result correct" : "result INcorrect") << endl;
+  return ok;
+}
+
+int main(int argc, char * argv[])
+{
+  if(argc < 2 || (strcmp(argv[1], "min") && strcmp(argv[1], "saxpy")))
+    {
+      usage();
+      return 1;
+    }
+  string which = argv[1];
+  size_t n = (size_t) 1 << 28;
+  size_t chunk = (size_t) 1 << 22;
+  size_t nbuf = 2;
+  for(int i = 2; i + 1 < argc; i += 2)
+    {
+      if(!strcmp(argv[i], "-n"))      n = strtoull(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-c")) chunk = strtoull(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-b")) nbuf = strtoull(argv[i + 1], NULL, 0);
+      else
+        {
+          usage();
+          return 1;
+        }
+    }
+  if(n == 0 || chunk == 0 || nbuf < 2)
+    {
+      usage();
+      return 1;
+    }
+
+  try
+    {
+      device = cl::Device::getDefault();
+      context = cl::Context(device);
+      upload = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+      compute = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+      download = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+      pool = buffer_pool_create(context(), 0);
+      if(pool == NULL)
+        throw(string("cannot create the buffer pool"));
+      cout << device.getInfo<CL_DEVICE_NAME>() << ": " << n << " items, chunks of " << chunk
+           << ", " << nbuf << " staging buffers" << endl;
+      bool ok = which == "min" ? streamMin(n, chunk, nbuf) : streamSaxpy(n, chunk, nbuf);
+      buffer_pool_destroy(pool);
+      return ok ? 0 : 1;
+    }
+  catch(cl::Error &err)
+    {
+      cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << endl;
+    }
+  catch(string msg)
+    {
+      cerr << "Exception caught in main(): " << msg << endl;
+    }
+  return 1;
+}
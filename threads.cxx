@@ -0,0 +1,139 @@
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 200
+
+#include "runtime.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+////////////////////////////////////////////////////////////////
+// Many host threads sharing one runtime::Runtime.
+//
+// Every thread issues `requests` blocking requests, alternating saxpy
+// and min on its own data, through its own queue and kernel objects,
+// and checks each result on the host. Compare -t 1 with more threads to
+// see how far concurrent submission scales on the device.
+//
+//   ./threads [-t threads] [-r requests per thread] [-n items]
+////////////////////////////////////////////////////////////////
+
+void usage()
+{
+  cerr << "usage: threads [-t threads] [-r requests per thread] [-n items]" << endl;
+}
+
+////////////////////////////////////////////////////////////////
+// One request thread; returns through ok whether every result matched
+////////////////////////////////////////////////////////////////
+void worker(runtime::Runtime &rt, int id, size_t requests, size_t n, bool *ok, string *error)
+{
+  try
+    {
+      const cl_float a = 2.f;
+      std::vector<cl_float> x(n), y(n);
+      std::vector<cl_uint> src(n);
+      // MWC init, as in parallel_min, seeded per thread.
+      cl_uint ma = 0x12345678 + id, mb = ma;
+      cl_uint expect = (cl_uint) -1;
+      for(size_t i = 0; i < n; i++)
+        {
+          x[i] = cl_float((i + id) % 1024);
+          src[i] = mb = (ma * (mb & 65535)) + (mb >> 16);
+          expect = std::min(expect, src[i]);
+        }
+
+      *ok = true;
+      for(size_t r = 0; r < requests && *ok; r++)
+        if(r % 2 == 0)
+          {
+            std::fill(y.begin(), y.end(), cl_float(id));
+            rt.saxpy(a, x.data(), y.data(), n);
+            for(size_t i = 0; i < n && *ok; i++)
+              *ok = y[i] == a * x[i] + cl_float(id);
+          }
+        else
+          *ok = rt.min(src.data(), n) == expect;
+    }
+  catch(cl::Error &err)
+    {
+      *ok = false;
+      *error = string(err.what()) + " (" + std::to_string(err.err()) + ")";
+    }
+  catch(string msg)
+    {
+      *ok = false;
+      *error = msg;
+    }
+}
+
+int main(int argc, char * argv[])
+{
+  size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+  size_t requests = 100;
+  size_t n = (size_t) 1 << 20;
+  for(int i = 1; i + 1 < argc; i += 2)
+    {
+      if(!strcmp(argv[i], "-t"))      nthreads = strtoull(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-r")) requests = strtoull(argv[i + 1], NULL, 0);
+      else if(!strcmp(argv[i], "-n")) n = strtoull(argv[i + 1], NULL, 0);
+      else
+        {
+          usage();
+          return 1;
+        }
+    }
+  if(argc % 2 == 0 || nthreads == 0 || requests == 0 || n == 0 || n > 0xffffffffu)
+    {
+      usage();
+      return 1;
+    }
+
+  try
+    {
+      runtime::Runtime rt(cl::Device::getDefault());
+      cout << rt.device().getInfo<CL_DEVICE_NAME>() << ": " << nthreads << " threads x "
+           << requests << " requests of " << n << " items" << endl;
+
+      std::vector<std::thread> threads;
+      std::unique_ptr<bool[]> ok(new bool[nthreads]);
+      std::vector<string> errors(nthreads);
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for(size_t t = 0; t < nthreads; t++)
+        threads.push_back(std::thread(worker, std::ref(rt), (int) t, requests, n, &ok[t], &errors[t]));
+      for(std::thread &t : threads)
+        t.join();
+      double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      bool allOk = true;
+      for(size_t t = 0; t < nthreads; t++)
+        {
+          if(!errors[t].empty())
+            cerr << "thread " << t << ": " << errors[t] << endl;
+          allOk &= ok[t];
+        }
+      cout << nthreads * requests << " requests in " << wall * 1e3 << " ms, "
+           << nthreads * requests / wall << " requests/sec" << endl;
+      buffer_pool_print_stats(rt.pool());
+      cout << (allOk ? "result correct" : "result INcorrect") << endl;
+      return allOk ? 0 : 1;
+    }
+  catch(cl::Error &err)
+    {
+      cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << endl;
+    }
+  catch(string msg)
+    {
+      cerr << "Exception caught in main(): " << msg << endl;
+    }
+  return 1;
+}